@@ -0,0 +1,74 @@
+"""Throughput of `AsyncMemHive.listen()` with the listener proxy vs.
+a thread handing every message to the event loop separately.
+
+Usage: python bench/bench_async_listen.py [--messages N] [--workers N]
+"""
+
+import argparse
+import asyncio
+import threading
+import time
+
+import memhive
+import memhive.asyncio
+
+
+class UnbatchedListenerProxy(memhive.asyncio.ListenerProxy):
+
+    # One `call_soon_threadsafe()` per message, like the proxy used
+    # to do before batching.
+
+    def start(self):
+        self._batches = asyncio.Queue()
+        self._listener_thread = threading.Thread(
+            target=self._receiver, args=(asyncio.get_running_loop(),))
+        self._listener_thread.start()
+
+    def _receiver(self, loop):
+        while True:
+            try:
+                msg = self._hub.listen()
+            except memhive.core.ClosedQueueError as ex:
+                loop.call_soon_threadsafe(self._deliver, [], ex)
+                return
+            loop.call_soon_threadsafe(self._deliver, [msg], None)
+
+
+def worker(sub):
+    n = sub['messages']
+    for i in range(n):
+        sub.request(i)
+
+
+async def run(messages, workers, batched):
+    hive = memhive.asyncio.AsyncMemHive()
+    if not batched:
+        hive._listen_proxy = UnbatchedListenerProxy(
+            hive._hive._mem, route=hive._route_map_response)
+
+    async with hive as m:
+        m['messages'] = messages
+        started = time.monotonic()
+        m.add_workers(workers, main=worker)
+        received = 0
+        async for _ in m.listen():
+            received += 1
+            if received == messages * workers:
+                break
+        return received / (time.monotonic() - started)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--messages', type=int, default=100000)
+    parser.add_argument('--workers', type=int, default=2)
+    args = parser.parse_args()
+
+    for batched in (False, True):
+        rate = asyncio.run(run(args.messages, args.workers, batched))
+        name = 'listener proxy' if batched else 'one wakeup per message'
+        print(f'{name:<24} {rate:>10.0f} msg/s')
+
+
+if __name__ == '__main__':
+    main()
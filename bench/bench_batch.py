@@ -0,0 +1,73 @@
+"""Round-trip throughput of fine-grained messages sent one per call
+(`push()`, `request()`, `listen()`) vs. in batches (`push_many()`,
+`request_many()`, `listen_many()`).
+
+Usage: python bench/bench_batch.py [--messages N] [--batch N]
+                                   [--workers N]
+"""
+
+import argparse
+import time
+
+import memhive
+
+
+# Workers stop on a broadcast, which every one of them gets once.
+# They don't see this module's globals, hence the imports.
+
+def one_by_one(sub):
+    from memhive.core import QueueRequest
+    while isinstance(msg := sub.listen(), QueueRequest):
+        sub.request(msg.arg)
+
+
+def batched(sub):
+    from memhive.core import QueueRequest
+    batch = sub['batch']
+    while True:
+        msgs = sub.listen_many(batch, None)
+        args = [msg.arg for msg in msgs if isinstance(msg, QueueRequest)]
+        sub.request_many(args)
+        if len(args) < len(msgs):
+            return
+
+
+def run(messages, batch, workers, batching):
+    with memhive.MemHive(pool_size=workers) as m:
+        m['batch'] = batch
+        m.add_workers(workers, main=batched if batching else one_by_one)
+        m.wait_workers_started()
+        started = time.monotonic()
+        received = 0
+        for i in range(0, messages, batch):
+            chunk = range(i, min(i + batch, messages))
+            if batching:
+                m.push_many(chunk)
+                while received < chunk.stop:
+                    received += len(m.listen_many(batch, None))
+            else:
+                for arg in chunk:
+                    m.push(arg)
+                while received < chunk.stop:
+                    m.listen()
+                    received += 1
+        elapsed = time.monotonic() - started
+        m.broadcast(None)
+        return messages / elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--messages', type=int, default=200000)
+    parser.add_argument('--batch', type=int, default=256)
+    parser.add_argument('--workers', type=int, default=2)
+    args = parser.parse_args()
+
+    for batching in (False, True):
+        rate = run(args.messages, args.batch, args.workers, batching)
+        name = '*_many()' if batching else 'one message per call'
+        print(f'{name:<24} {rate:>10.0f} msg/s')
+
+
+if __name__ == '__main__':
+    main()
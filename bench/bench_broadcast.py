@@ -0,0 +1,47 @@
+"""Cost of `broadcast()` for the producer as the number of workers
+grows; every broadcast is stored once however many workers get it.
+
+Usage: python bench/bench_broadcast.py [--messages N]
+                                       [--workers N [N ...]]
+"""
+
+import argparse
+import time
+
+import memhive
+
+
+def worker(sub):
+    while sub.listen().arg is not None:
+        pass
+
+
+def run(messages, workers):
+    with memhive.MemHive(pool_size=workers) as m:
+        m.add_workers(workers, main=worker)
+        m.wait_workers_started()
+        started = time.monotonic()
+        for i in range(messages):
+            m.broadcast(i)
+        elapsed = time.monotonic() - started
+        m.broadcast(None)
+        for w in m._workers.values():
+            w.completed.wait()
+        return messages / elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--messages', type=int, default=100000)
+    parser.add_argument('--workers', type=int, nargs='+',
+                        default=[1, 2, 4, 8, 16, 32, 64])
+    args = parser.parse_args()
+
+    print(f'{"workers":>8} {"broadcast()":>18}')
+    for workers in args.workers:
+        rate = run(args.messages, workers)
+        print(f'{workers:>8} {rate:>12.0f} msg/s')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,63 @@
+"""Throughput of `MemHive.map()` vs. `ProcessPoolExecutor.map()`.
+
+Usage: python bench/bench_map.py [--items N] [--cost N] [--chunksize N]
+                                  [--workers N]
+"""
+
+import argparse
+import concurrent.futures
+import os
+import time
+
+import memhive
+
+
+def work(n):
+    # A bit of CPU-bound work per item.
+    total = 0
+    for i in range(n):
+        total += i * i
+    return total
+
+
+def run_memhive(items, chunksize, workers):
+    with memhive.MemHive() as m:
+        # Start the workers before measuring.
+        list(m.map(work, [0] * workers, workers=workers))
+        started = time.monotonic()
+        results = list(m.map(work, items, chunksize=chunksize,
+                             workers=workers))
+        return time.monotonic() - started, results
+
+
+def run_processes(items, chunksize, workers):
+    with concurrent.futures.ProcessPoolExecutor(workers) as ex:
+        # Start the processes before measuring.
+        list(ex.map(work, [0] * workers))
+        started = time.monotonic()
+        results = list(ex.map(work, items, chunksize=chunksize))
+        return time.monotonic() - started, results
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--items', type=int, default=20000)
+    parser.add_argument('--cost', type=int, default=200)
+    parser.add_argument('--chunksize', type=int, default=64)
+    parser.add_argument('--workers', type=int, default=os.cpu_count() or 1)
+    args = parser.parse_args()
+
+    items = [args.cost] * args.items
+    expected = None
+    for name, run in (('ProcessPoolExecutor', run_processes),
+                      ('MemHive.map()', run_memhive)):
+        elapsed, results = run(items, args.chunksize, args.workers)
+        if expected is None:
+            expected = results
+        assert results == expected
+        print(f'{name:<20} {args.items / elapsed:>10.0f} items/s '
+              f'({elapsed * 1000:.0f}ms)')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,52 @@
+"""Push throughput to workers with the default linked-list queue vs.
+the lock-free ring (`MemHive(ring_capacity=...)`) vs. per-worker
+queues with work stealing (`MemHive(work_stealing=True)`).
+
+Usage: python bench/bench_queue.py [--messages N] [--capacity N]
+                                   [--workers N [N ...]]
+"""
+
+import argparse
+import time
+
+import memhive
+
+
+def worker(sub):
+    while sub.listen().arg is not None:
+        pass
+
+
+def run(messages, workers, **kwargs):
+    with memhive.MemHive(pool_size=workers, **kwargs) as m:
+        m.add_workers(workers, main=worker)
+        m.wait_workers_started()
+        started = time.monotonic()
+        for i in range(messages):
+            m.push(i)
+        for _ in range(workers):
+            m.push(None)
+        for w in m._workers.values():
+            w.completed.wait()
+        return messages / (time.monotonic() - started)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--messages', type=int, default=200000)
+    parser.add_argument('--capacity', type=int, default=1024)
+    parser.add_argument('--workers', type=int, nargs='+',
+                        default=[1, 2, 4, 8, 16, 32, 64])
+    args = parser.parse_args()
+
+    print(f'{"workers":>8} {"list":>14} {"ring":>14} {"stealing":>14}')
+    for workers in args.workers:
+        list_rate = run(args.messages, workers)
+        ring_rate = run(args.messages, workers, ring_capacity=args.capacity)
+        steal_rate = run(args.messages, workers, work_stealing=True)
+        print(f'{workers:>8} {list_rate:>8.0f} msg/s {ring_rate:>8.0f} msg/s '
+              f'{steal_rate:>8.0f} msg/s')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,72 @@
+"""Read throughput in workers, with and without a local index replica,
+while the main interpreter keeps writing to the index.
+
+Usage: python bench/bench_replica_reads.py [--workers N] [--reads N]
+"""
+
+import argparse
+import threading
+
+import memhive
+
+
+NKEYS = 1000
+
+
+def reader(sub):
+    import time
+
+    replica = sub['replica']
+    reads = sub['reads']
+    if replica is not None:
+        sub.enable_replica(replica)
+
+    started = time.monotonic()
+    for i in range(reads):
+        sub[f'k{i % 1000}']
+    elapsed = time.monotonic() - started
+
+    print(f'  worker: {reads / elapsed:>12,.0f} reads/s', flush=True)
+    sub.request('done')
+
+
+def run(workers, reads, replica):
+    with memhive.MemHive() as m:
+        m['replica'] = replica
+        m['reads'] = reads
+        for i in range(NKEYS):
+            m[f'k{i}'] = (i, f'value {i}' * 10)
+
+        done = threading.Event()
+
+        def writer():
+            i = 0
+            while not done.is_set():
+                m[f'k{i % NKEYS}'] = (i, f'value {i}' * 10)
+                i += 1
+
+        w = threading.Thread(target=writer)
+        w.start()
+        try:
+            for _ in range(workers):
+                m.add_worker(main=reader)
+            for _ in range(workers):
+                m.listen()
+        finally:
+            done.set()
+            w.join()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--workers', type=int, default=4)
+    parser.add_argument('--reads', type=int, default=200000)
+    args = parser.parse_args()
+
+    for replica in (None, 0.001, 0.1):
+        print(f'replica={replica}')
+        run(args.workers, args.reads, replica)
+
+
+if __name__ == '__main__':
+    main()
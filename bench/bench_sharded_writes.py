@@ -0,0 +1,65 @@
+"""Write throughput of the hive index with readers in subinterpreters.
+
+Usage: python bench/bench_sharded_writes.py [--workers N] [--writes N]
+"""
+
+import argparse
+import threading
+import time
+
+import memhive
+
+
+NKEYS = 1000
+
+
+def reader(sub):
+    nkeys = sub['nkeys']
+    i = 0
+    while 'stop' not in sub:
+        sub[f'k{i % nkeys}']
+        i += 1
+
+
+def run(shards, workers, writers, writes):
+    with memhive.MemHive(shards=shards) as m:
+        m['nkeys'] = NKEYS
+        for i in range(NKEYS):
+            m[f'k{i}'] = i
+        for _ in range(workers):
+            m.add_worker(main=reader)
+
+        def writer(n):
+            for i in range(writes):
+                m[f'k{(i * writers + n) % NKEYS}'] = i
+
+        threads = [
+            threading.Thread(target=writer, args=(n,))
+            for n in range(writers)
+        ]
+        started = time.monotonic()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.monotonic() - started
+
+        m['stop'] = True
+
+    return writers * writes / elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--workers', type=int, default=4)
+    parser.add_argument('--writers', type=int, default=4)
+    parser.add_argument('--writes', type=int, default=20000)
+    args = parser.parse_args()
+
+    for shards in (1, 4, 16, 64):
+        rate = run(shards, args.workers, args.writers, args.writes)
+        print(f'shards={shards:<3} {rate:>12,.0f} writes/s')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,61 @@
+"""Latency of `add_worker()` with and without a pool of subinterpreters,
+and of starting many workers one by one vs. with `add_workers()`.
+
+Usage: python bench/bench_worker_startup.py [--workers N] [--pool N]
+"""
+
+import argparse
+import time
+
+import memhive
+
+
+def worker(sub):
+    pass
+
+
+def run(pool_size, workers):
+    timings = []
+    with memhive.MemHive(pool_size=pool_size) as m:
+        # Let the pool warm up before measuring.
+        time.sleep(0.5)
+        for _ in range(workers):
+            started = time.monotonic()
+            m.add_worker(main=worker)
+            timings.append(time.monotonic() - started)
+            # Give a finished interpreter time to return to the pool.
+            time.sleep(0.05)
+    timings.sort()
+    return timings[len(timings) // 2], timings[-1]
+
+
+def run_cold(workers, concurrent):
+    with memhive.MemHive() as m:
+        started = time.monotonic()
+        if concurrent:
+            m.add_workers(workers, main=worker)
+        else:
+            for _ in range(workers):
+                m.add_worker(main=worker)
+        return time.monotonic() - started
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--workers', type=int, default=20)
+    parser.add_argument('--pool', type=int, default=4)
+    args = parser.parse_args()
+
+    for pool_size in (0, args.pool):
+        median, worst = run(pool_size, args.workers)
+        print(f'pool_size={pool_size:<3} '
+              f'median={median * 1000:>8.2f}ms  max={worst * 1000:>8.2f}ms')
+
+    for concurrent in (False, True):
+        elapsed = run_cold(args.workers, concurrent)
+        name = 'add_workers()' if concurrent else 'add_worker() x N'
+        print(f'{name:<17} {args.workers} workers in {elapsed * 1000:.0f}ms')
+
+
+if __name__ == '__main__':
+    main()
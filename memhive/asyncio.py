@@ -1,4 +1,6 @@
 import asyncio
+import collections
+import os
 import threading
 
 from . import memhive
@@ -7,50 +9,126 @@ from . import core
 
 class ListenerProxy:
 
-    def __init__(self, hub):
+    # Messages are handed to the event loop in batches of up to
+    # `max_batch`. Where the hub has a readiness fd (Linux), the loop
+    # watches it with `add_reader()` and takes the messages itself with
+    # `listen_many()`; otherwise a thread blocks in `listen()` and
+    # passes whatever else is already queued along with each message,
+    # so a busy queue costs one loop wakeup per batch.
+
+    def __init__(self, hub, *, route=None, max_batch=1024):
+        # `route(msg)` is called in the event loop for every message
+        # and returns True if it took care of it; other messages are
+        # passed to `listen()`.
         self._hub = hub
-        self._messages = None
+        self._route = route
+        self._max_batch = max_batch
+        self._batches = None
+        self._pending = collections.deque()
+        self._loop = None
+        self._fd = None
         self._listener_thread = None
 
     async def listen(self):
+        pending = self._pending
         try:
             while True:
+                while pending:
+                    yield pending.popleft()
                 self._hub.process_refs()
-                msg = await self._messages.get()
-                if msg[0] == 'e':
-                    raise msg[1]
-                else:
-                    yield msg[1]
+                batch, error = await self._batches.get()
+                pending.extend(batch)
+                if error is not None:
+                    while pending:
+                        yield pending.popleft()
+                    raise error
         except core.ClosedQueueError:
             self.join()
             raise
 
     def start(self):
-        self._messages = asyncio.Queue()
-        self._listener_thread = threading.Thread(
-            target=self._receiver, args=(asyncio.get_running_loop(),))
-        self._listener_thread.start()
+        self._batches = asyncio.Queue()
+        self._loop = asyncio.get_running_loop()
+        try:
+            self._fd = self._hub.readiness_fd()
+        except NotImplementedError:
+            self._listener_thread = threading.Thread(
+                target=self._receiver, args=(self._loop,))
+            self._listener_thread.start()
+        else:
+            self._loop.add_reader(self._fd, self._on_readable)
+
+    def stop(self):
+        # Must be called before the hub is closed if it would close
+        # the readiness fd.
+        if self._fd is not None:
+            self._loop.remove_reader(self._fd)
+            self._fd = None
 
     def join(self):
+        if self._fd is not None:
+            # Pick up the ClosedQueueError for `listen()`.
+            self._drain()
+            self.stop()
         if self._listener_thread is not None:
             self._listener_thread.join()
             self._listener_thread = None
 
+    def _on_readable(self):
+        # Reset the fd before taking messages so that none
+        # arriving meanwhile go unnoticed.
+        try:
+            os.eventfd_read(self._fd)
+        except BlockingIOError:
+            pass
+        self._drain()
+
+    def _drain(self):
+        if self._fd is None:
+            return
+        try:
+            batch = self._hub.listen_many(self._max_batch)
+        except core.ClosedQueueError as ex:
+            self.stop()
+            self._deliver([], ex)
+            return
+        except Exception as ex:
+            self._deliver([], ex)
+            return
+
+        if batch:
+            self._deliver(batch, None)
+        if len(batch) == self._max_batch:
+            # There can be more; the fd won't tell us.
+            self._loop.call_soon(self._drain)
+
     def _receiver(self, loop):
+        hub = self._hub
         going = True
         while going:
+            batch = []
+            error = None
             try:
-                msg = ('d', self._hub.listen())
+                batch.append(hub.listen())
+                while len(batch) < self._max_batch:
+                    msg = hub.try_listen()
+                    if msg is None:
+                        break
+                    batch.append(msg)
             except core.ClosedQueueError as ex:
-                msg = ('e', ex)
+                error = ex
                 going = False
             except Exception as ex:
-                msg = ('e', ex)
+                error = ex
+
+            loop.call_soon_threadsafe(self._deliver, batch, error)
 
-            loop.call_soon_threadsafe(
-                self._messages.put_nowait,
-                msg
-            )
+    def _deliver(self, batch, error):
+        if self._route is not None:
+            batch = [msg for msg in batch if not self._route(msg)]
+            if not batch and error is None:
+                return
+        self._batches.put_nowait((batch, error))
 
 
 class AsyncMemHive:
@@ -61,7 +139,9 @@ class AsyncMemHive:
 
         self._hive = memhive.MemHive()
         self._active = False
-        self._listen_proxy = ListenerProxy(self._hive)
+        self._map_waiters = {}
+        self._listen_proxy = ListenerProxy(
+            self._hive._mem, route=self._route_map_response)
 
     def _ensure_active(self):
         if not self._active:
@@ -80,9 +160,18 @@ class AsyncMemHive:
         self._hive._mem[key] = val
 
     def add_worker(self, **kwargs):
-        self._hive.add_worker(**kwargs)
+        # Doesn't block, use `ensure_workers_started()` to wait
+        # for workers to start.
+        self._hive.start_workers(1, **kwargs)
 
-    def add_async_worker(self, *, setup=None, main):
+    def add_workers(self, n, **kwargs):
+        self._hive.start_workers(n, **kwargs)
+
+    async def ensure_workers_started(self):
+        self._ensure_active()
+        await asyncio.to_thread(self._hive.wait_workers_started)
+
+    def add_async_worker(self, *, main):
         def new_main(sub, main_code=main.__code__, main_name=main.__name__):
             import asyncio
             import types
@@ -96,14 +185,90 @@ class AsyncMemHive:
 
             asyncio.run(main_wrapper())
 
-        self.add_worker(setup=setup, main=new_main)
+        self.add_worker(main=new_main)
+
+    def autoscale(self, **kwargs):
+        self._hive.autoscale(**kwargs)
 
-    def push(self, *args):
-        self._hive.push(*args)
+    def push(self, *args, **kwargs):
+        return self._hive.push(*args, **kwargs)
+
+    def push_to(self, *args):
+        return self._hive.push_to(*args)
+
+    def push_keyed(self, *args):
+        return self._hive.push_keyed(*args)
+
+    def push_many(self, *args):
+        return self._hive.push_many(*args)
 
     def broadcast(self, *args):
         self._hive.broadcast(*args)
 
+    async def map(self, fn, iterable, *, chunksize=1, workers=None,
+                  max_inflight=None):
+        # See `MemHive.map()`; results are yielded in input order.
+        # Other messages are still delivered by `listen()`.
+        self._ensure_active()
+        if chunksize < 1:
+            raise ValueError('chunksize must be >= 1')
+        if workers is None:
+            workers = os.cpu_count() or 1
+        if workers < 1:
+            raise ValueError('workers must be >= 1')
+        if max_inflight is None:
+            max_inflight = 2 * workers
+        if max_inflight < 1:
+            raise ValueError('max_inflight must be >= 1')
+
+        loop = asyncio.get_running_loop()
+        mapped = memhive._MapWorkers(
+            self._hive, self._hive._map_workers(workers))
+        packed_fn = self._hive._mem.pack_main(fn)
+        inflight = collections.deque()
+        try:
+            # Chunks are pushed to the workers' own channels, which
+            # exist once they've started.
+            await asyncio.to_thread(mapped.wait_started)
+            for chunk in memhive._map_chunks(iterable, chunksize):
+                if len(inflight) >= max_inflight:
+                    data = await self._map_wait(inflight.popleft(), mapped)
+                    for result in memhive._map_results(data):
+                        yield result
+                # The response is routed in the event loop, so it can't
+                # arrive before the waiter is registered.
+                msg_id = mapped.push((packed_fn, chunk))
+                self._map_waiters[msg_id] = fut = loop.create_future()
+                fut.add_done_callback(
+                    lambda _, msg_id=msg_id: mapped.done(msg_id))
+                inflight.append(fut)
+            while inflight:
+                data = await self._map_wait(inflight.popleft(), mapped)
+                for result in memhive._map_results(data):
+                    yield result
+        finally:
+            while inflight:
+                await self._map_wait(inflight.popleft(), mapped)
+
+    async def _map_wait(self, fut, mapped):
+        while True:
+            exited = mapped.exited()
+            await asyncio.wait((fut,), timeout=memhive._MAP_POLL_INTERVAL)
+            if fut.done():
+                return fut.result()
+            if exited is not None:
+                raise mapped.exited_error(exited) from exited.error
+
+    def _route_map_response(self, msg):
+        if not isinstance(msg, core.QueueResponse):
+            return False
+        fut = self._map_waiters.pop(msg.id, None)
+        if fut is None:
+            return False
+        if not fut.cancelled():
+            fut.set_result(msg.data)
+        return True
+
     async def __aenter__(self):
         if self._active:
             raise RuntimeError('already running')
@@ -144,8 +309,17 @@ class AsyncMemSub:
         self._ensure_active()
         return key in self._sub
 
-    def request(self, arg):
-        self._sub.request(arg)
+    def request(self, arg, *, priority=0):
+        self._sub.request(arg, priority=priority)
+
+    def request_many(self, args):
+        self._sub.request_many(args)
+
+    def watch(self, keys_or_prefix):
+        self._sub.watch(keys_or_prefix)
+
+    def enable_replica(self, max_staleness):
+        self._sub.enable_replica(max_staleness)
 
     async def __aenter__(self):
         self._active = True
@@ -153,6 +327,7 @@ class AsyncMemSub:
         return self
 
     async def __aexit__(self, *e):
+        self._listen_proxy.stop()
         self._sub.close()
         self._active = False
         self._listen_proxy.join()
@@ -1,6 +1,7 @@
 from ._core import Map
 from ._core import MemHive, MemHiveSub
-from ._core import ClosedQueueError
+from ._core import ClosedQueueError, QueueFullError
+from ._core import QueueRequest, QueueResponse, QueueBroadcast
 
 try:
     from ._core import enable_object_tracking, disable_object_tracking
@@ -4208,6 +4208,266 @@ map_py_class_getitem(PyObject *type, PyObject *item)
 }
 #endif
 
+static Py_ssize_t
+map_obj_sizeof(PyObject *o)
+{
+    // Only reads the struct fields, so this is safe to use on objects
+    // from other interpreters (where calling `__sizeof__()` isn't).
+    PyTypeObject *tp = Py_TYPE(o);
+
+    if (PyUnicode_Check(o)) {
+        Py_ssize_t size = PyUnicode_IS_COMPACT_ASCII(o)
+            ? (Py_ssize_t)sizeof(PyASCIIObject)
+            : (Py_ssize_t)sizeof(PyCompactUnicodeObject);
+        return size + (PyUnicode_GET_LENGTH(o) + 1) * PyUnicode_KIND(o);
+    }
+
+    Py_ssize_t size = tp->tp_basicsize;
+
+#if PY_VERSION_HEX >= 0x030D0000
+    // `Py_SIZE()` doesn't apply to ints anymore.
+    if (PyLong_Check(o)) {
+        Py_ssize_t nbytes = PyLong_AsNativeBytes(o, NULL, 0, -1);
+        Py_ssize_t ndigits = (nbytes * 8 + PyLong_SHIFT - 1) / PyLong_SHIFT;
+        return size + (ndigits > 0 ? ndigits : 1) * tp->tp_itemsize;
+    }
+#endif
+
+    if (tp->tp_itemsize) {
+        Py_ssize_t n = Py_SIZE(o);
+        size += (n < 0 ? -n : n) * tp->tp_itemsize;
+    }
+    return size;
+}
+
+static int
+map_node_memory_usage(module_state *state, MapNode *node, int deep,
+                      PyObject *shared, int is_shared, MapMemoryUsage *usage);
+
+static int
+map_obj_memory_usage(module_state *state, PyObject *o, int deep,
+                     PyObject *shared, Py_ssize_t *bytes,
+                     MapMemoryUsage *usage)
+{
+    *bytes += map_obj_sizeof(o);
+
+    if (!deep) {
+        return 0;
+    }
+
+    if (IS_MAP_SLOW(state, o)) {
+        return map_node_memory_usage(
+            state, ((MapObject *)o)->h_root, deep, shared, 0, usage);
+    }
+
+    if (PyTuple_Check(o)) {
+        for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(o); i++) {
+            if (map_obj_memory_usage(state, PyTuple_GET_ITEM(o, i), deep,
+                                     shared, bytes, usage))
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+map_node_memory_usage(module_state *state, MapNode *node, int deep,
+                      PyObject *shared, int is_shared, MapMemoryUsage *usage)
+{
+    // Once a node is found in `shared`, its whole subtree is shared.
+    if (!is_shared && shared != NULL) {
+        PyObject *addr = PyLong_FromVoidPtr(node);
+        if (addr == NULL) {
+            return -1;
+        }
+        is_shared = PySet_Contains(shared, addr);
+        Py_DECREF(addr);
+        if (is_shared < 0) {
+            return -1;
+        }
+    }
+    if (is_shared) {
+        usage->shared_nodes++;
+    }
+
+    usage->node_bytes += map_obj_sizeof((PyObject *)node);
+
+    if (IS_ARRAY_NODE(state, node)) {
+        usage->array_nodes++;
+        MapNode_Array *n = (MapNode_Array *)node;
+        for (Py_ssize_t i = 0; i < HAMT_ARRAY_NODE_SIZE; i++) {
+            if (n->a_array[i] != NULL
+                && map_node_memory_usage(state, n->a_array[i], deep,
+                                         shared, is_shared, usage))
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    PyObject **array;
+    if (IS_BITMAP_NODE(state, node)) {
+        usage->bitmap_nodes++;
+        array = ((MapNode_Bitmap *)node)->b_array;
+    } else {
+        assert(IS_COLLISION_NODE(state, node));
+        usage->collision_nodes++;
+        array = ((MapNode_Collision *)node)->c_array;
+    }
+
+    for (Py_ssize_t i = 0; i < Py_SIZE(node); i += 2) {
+        if (array[i] == NULL) {
+            if (map_node_memory_usage(state, (MapNode *)array[i + 1], deep,
+                                      shared, is_shared, usage))
+            {
+                return -1;
+            }
+            continue;
+        }
+        if (map_obj_memory_usage(state, array[i], deep, shared,
+                                 &usage->key_bytes, usage)
+            || map_obj_memory_usage(state, array[i + 1], deep, shared,
+                                    &usage->value_bytes, usage))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+map_node_collect(module_state *state, MapNode *node, PyObject *nodes)
+{
+    PyObject *addr = PyLong_FromVoidPtr(node);
+    if (addr == NULL) {
+        return -1;
+    }
+    int r = PySet_Add(nodes, addr);
+    Py_DECREF(addr);
+    if (r) {
+        return -1;
+    }
+
+    if (IS_ARRAY_NODE(state, node)) {
+        MapNode_Array *n = (MapNode_Array *)node;
+        for (Py_ssize_t i = 0; i < HAMT_ARRAY_NODE_SIZE; i++) {
+            if (n->a_array[i] != NULL
+                && map_node_collect(state, n->a_array[i], nodes))
+            {
+                return -1;
+            }
+        }
+    } else if (IS_BITMAP_NODE(state, node)) {
+        MapNode_Bitmap *n = (MapNode_Bitmap *)node;
+        for (Py_ssize_t i = 0; i < Py_SIZE(n); i += 2) {
+            if (n->b_array[i] == NULL
+                && map_node_collect(state, (MapNode *)n->b_array[i + 1],
+                                    nodes))
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int
+MemHive_MapMemoryUsage(module_state *state, PyObject *map, int deep,
+                       PyObject *shared_with, MapMemoryUsage *usage)
+{
+    if (!IS_MAP_SLOW(state, map)
+        || (shared_with != NULL && !IS_MAP_SLOW(state, shared_with)))
+    {
+        PyErr_SetString(PyExc_TypeError, "not a map");
+        return -1;
+    }
+
+    PyObject *shared = NULL;
+    if (shared_with != NULL) {
+        shared = PySet_New(NULL);
+        if (shared == NULL) {
+            return -1;
+        }
+        if (map_node_collect(
+                state, ((MapObject *)shared_with)->h_root, shared))
+        {
+            Py_DECREF(shared);
+            return -1;
+        }
+    }
+
+    int ret = map_node_memory_usage(
+        state, ((MapObject *)map)->h_root, deep, shared, 0, usage);
+    Py_XDECREF(shared);
+    return ret;
+}
+
+PyObject *
+MemHive_MapMemoryUsageAsDict(MapMemoryUsage *usage, int with_shared)
+{
+    PyObject *nodes = Py_BuildValue(
+        "{snsnsn}",
+        "N_BITMAP", usage->bitmap_nodes,
+        "N_ARRAY", usage->array_nodes,
+        "N_COLLISION", usage->collision_nodes);
+    if (nodes == NULL) {
+        return NULL;
+    }
+
+    PyObject *ret = Py_BuildValue(
+        "{sNsnsnsn}",
+        "nodes", nodes,
+        "node_bytes", usage->node_bytes,
+        "key_bytes", usage->key_bytes,
+        "value_bytes", usage->value_bytes);
+    if (ret == NULL || !with_shared) {
+        return ret;
+    }
+
+    PyObject *shared = PyLong_FromSsize_t(usage->shared_nodes);
+    if (shared == NULL || PyDict_SetItemString(ret, "shared_nodes", shared)) {
+        Py_XDECREF(shared);
+        Py_DECREF(ret);
+        return NULL;
+    }
+    Py_DECREF(shared);
+    return ret;
+}
+
+static PyObject *
+map_py_memory_usage(MapObject *self, PyObject *args, PyObject *kwds)
+{
+    // With `deep`, nested Maps and tuples are walked too (nested Maps'
+    // nodes are added to the node counts).
+    static char *kwlist[] = {"deep", "shared_with", NULL};
+    int deep = 0;
+    PyObject *shared_with = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pO:memory_usage", kwlist,
+                                     &deep, &shared_with))
+    {
+        return NULL;
+    }
+    if (shared_with == Py_None) {
+        shared_with = NULL;
+    }
+
+    module_state *state = MemHive_GetModuleStateByObj((PyObject *)self);
+    MapMemoryUsage usage = {0};
+    if (MemHive_MapMemoryUsage(state, (PyObject *)self, deep,
+                               shared_with, &usage))
+    {
+        return NULL;
+    }
+    return MemHive_MapMemoryUsageAsDict(&usage, shared_with != NULL);
+}
+
 static PyMethodDef Map_methods[] = {
     {"set", (PyCFunction)map_py_set, METH_VARARGS, NULL},
     {"get", (PyCFunction)map_py_get, METH_VARARGS, NULL},
@@ -4217,6 +4477,8 @@ static PyMethodDef Map_methods[] = {
     {"keys", (PyCFunction)map_py_keys, METH_NOARGS, NULL},
     {"values", (PyCFunction)map_py_values, METH_NOARGS, NULL},
     {"update", (PyCFunction)map_py_update, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"memory_usage", (PyCFunction)map_py_memory_usage,
+        METH_VARARGS | METH_KEYWORDS, NULL},
     {"__reduce__", (PyCFunction)map_reduce, METH_NOARGS, NULL},
     {"__dump__", (PyCFunction)map_py_dump, METH_NOARGS, NULL},
     {
@@ -5046,6 +5308,13 @@ MemHive_NewMap(module_state *state)
 }
 
 
+int32_t
+MemHive_MapHash(PyObject *key)
+{
+    return map_hash(key);
+}
+
+
 PyObject *
 MemHive_NewMapProxy(module_state *state, PyObject *map)
 {
@@ -5097,6 +5366,45 @@ MemHive_MapSetItem(module_state *state, PyObject *self,
 }
 
 
+PyObject *
+MemHive_MapDelItem(module_state *state, PyObject *self, PyObject *key)
+{
+    if (!IS_MAP_SLOW(state, self)) {
+        PyErr_SetString(PyExc_TypeError, "not a map");
+        return NULL;
+    }
+    TRACK(state, key);
+    MapObject *map = (MapObject *)self;
+    return (PyObject *)map_without(state, map, key);
+}
+
+
+int
+MemHive_MapFind(module_state *state, PyObject *self,
+                PyObject *key, PyObject **val)
+{
+    if (!IS_MAP_SLOW(state, self)) {
+        PyErr_SetString(PyExc_TypeError, "not a map");
+        return -1;
+    }
+
+    TRACK(state, key);
+    map_find_t res = map_find(state, (BaseMapObject *)self, key, val);
+    switch (res) {
+        case F_ERROR:
+            return -1;
+        case F_NOT_FOUND:
+            *val = NULL;
+            return 0;
+        case F_FOUND_EXT:
+        case F_FOUND:
+            return 1;
+        default:
+            abort();
+    }
+}
+
+
 int
 MemHive_MapContains(module_state *state, PyObject *self, PyObject *key)
 {
@@ -5273,3 +5581,236 @@ MemHive_CopyMapProxy(module_state *state, PyObject *map)
 
     return (PyObject *)o;
 }
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+// Replication keeps a local copy of a remote map up to date. Copies
+// mirror the structure of the remote tree exactly, so when the remote
+// map changes, the new copy can be built by walking both versions
+// of the remote tree side by side: subtrees and leaves shared by
+// the versions are taken from the old copy, only the rest is copied.
+// The old remote tree must be kept alive while we compare pointers.
+
+
+static PyObject *
+map_node_replicate(module_state *state, MapNode *node,
+                   MapNode *old_node, MapNode *old_copy);
+
+static PyObject *
+map_node_bitmap_replicate(module_state *state, MapNode_Bitmap *node,
+                          MapNode_Bitmap *old_node, MapNode_Bitmap *old_copy)
+{
+    MapNode_Bitmap *new_node = (MapNode_Bitmap*)map_node_bitmap_new(
+        state, Py_SIZE(node), 0);
+    if (new_node == NULL) {
+        return NULL;
+    }
+    new_node->b_bitmap = node->b_bitmap;
+
+    uint32_t bitmap = node->b_bitmap;
+    while (bitmap) {
+        uint32_t bit = bitmap & (~bitmap + 1);
+        bitmap &= bitmap - 1;
+
+        Py_ssize_t k = (Py_ssize_t)map_bitindex(node->b_bitmap, bit) * 2;
+        PyObject *key = node->b_array[k];
+        PyObject *val = node->b_array[k + 1];
+
+        Py_ssize_t ok = -1;
+        if (old_node != NULL && (old_node->b_bitmap & bit)) {
+            ok = (Py_ssize_t)map_bitindex(old_node->b_bitmap, bit) * 2;
+        }
+
+        if (key == NULL) {
+            MapNode *old_child = NULL;
+            MapNode *old_child_copy = NULL;
+            if (ok >= 0 && old_node->b_array[ok] == NULL) {
+                old_child = (MapNode *)old_node->b_array[ok + 1];
+                old_child_copy = (MapNode *)old_copy->b_array[ok + 1];
+            }
+            PyObject *child = map_node_replicate(
+                state, (MapNode *)val, old_child, old_child_copy);
+            if (child == NULL) {
+                goto err;
+            }
+            new_node->b_array[k + 1] = child;
+            continue;
+        }
+
+        if (ok >= 0 && old_node->b_array[ok] == key) {
+            new_node->b_array[k] = old_copy->b_array[ok];
+            INCREF(state, new_node->b_array[k]);
+        } else {
+            new_node->b_array[k] = COPY_OBJ(state, key);
+            if (new_node->b_array[k] == NULL) {
+                goto err;
+            }
+        }
+
+        if (ok >= 0 && old_node->b_array[ok] == key
+            && old_node->b_array[ok + 1] == val)
+        {
+            new_node->b_array[k + 1] = old_copy->b_array[ok + 1];
+            INCREF(state, new_node->b_array[k + 1]);
+        } else {
+            new_node->b_array[k + 1] = COPY_OBJ(state, val);
+            if (new_node->b_array[k + 1] == NULL) {
+                goto err;
+            }
+        }
+    }
+
+    return (PyObject *)new_node;
+
+err:
+    Py_DECREF((PyObject *)new_node);
+    return NULL;
+}
+
+static PyObject *
+map_node_array_replicate(module_state *state, MapNode_Array *node,
+                         MapNode_Array *old_node, MapNode_Array *old_copy)
+{
+    MapNode_Array *new_node = (MapNode_Array *)map_node_array_new(
+        state, node->a_count, 0);
+    if (new_node == NULL) {
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < HAMT_ARRAY_NODE_SIZE; i++) {
+        if (node->a_array[i] == NULL) {
+            continue;
+        }
+
+        PyObject *child = map_node_replicate(
+            state, node->a_array[i],
+            old_node != NULL ? old_node->a_array[i] : NULL,
+            old_node != NULL ? old_copy->a_array[i] : NULL);
+        if (child == NULL) {
+            Py_DECREF((PyObject *)new_node);
+            return NULL;
+        }
+        new_node->a_array[i] = (MapNode *)child;
+    }
+
+    return (PyObject *)new_node;
+}
+
+static PyObject *
+map_node_collision_replicate(module_state *state, MapNode_Collision *node,
+                             MapNode_Collision *old_node,
+                             MapNode_Collision *old_copy)
+{
+    MapNode_Collision *new_node = (MapNode_Collision *)map_node_collision_new(
+        state, node->c_hash, Py_SIZE(node), 0);
+    if (new_node == NULL) {
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < Py_SIZE(node); i += 2) {
+        PyObject *key = node->c_array[i];
+        PyObject *val = node->c_array[i + 1];
+
+        Py_ssize_t ok = -1;
+        if (old_node != NULL) {
+            for (Py_ssize_t j = 0; j < Py_SIZE(old_node); j += 2) {
+                if (old_node->c_array[j] == key) {
+                    ok = j;
+                    break;
+                }
+            }
+        }
+
+        if (ok >= 0) {
+            new_node->c_array[i] = old_copy->c_array[ok];
+            INCREF(state, new_node->c_array[i]);
+        } else {
+            new_node->c_array[i] = COPY_OBJ(state, key);
+            if (new_node->c_array[i] == NULL) {
+                goto err;
+            }
+        }
+
+        if (ok >= 0 && old_node->c_array[ok + 1] == val) {
+            new_node->c_array[i + 1] = old_copy->c_array[ok + 1];
+            INCREF(state, new_node->c_array[i + 1]);
+        } else {
+            new_node->c_array[i + 1] = COPY_OBJ(state, val);
+            if (new_node->c_array[i + 1] == NULL) {
+                goto err;
+            }
+        }
+    }
+
+    return (PyObject *)new_node;
+
+err:
+    Py_DECREF((PyObject *)new_node);
+    return NULL;
+}
+
+static PyObject *
+map_node_replicate(module_state *state, MapNode *node,
+                   MapNode *old_node, MapNode *old_copy)
+{
+    if (node == old_node) {
+        NODE_INCREF(state, old_copy);
+        return (PyObject *)old_copy;
+    }
+
+    // Nodes of different kinds have nothing to share.
+    if (old_node != NULL && old_node->node_kind != node->node_kind) {
+        old_node = NULL;
+        old_copy = NULL;
+    }
+
+    if (IS_BITMAP_NODE(state, node)) {
+        return map_node_bitmap_replicate(
+            state, (MapNode_Bitmap *)node,
+            (MapNode_Bitmap *)old_node, (MapNode_Bitmap *)old_copy);
+    }
+    else if (IS_ARRAY_NODE(state, node)) {
+        return map_node_array_replicate(
+            state, (MapNode_Array *)node,
+            (MapNode_Array *)old_node, (MapNode_Array *)old_copy);
+    }
+    else {
+        assert(IS_COLLISION_NODE(state, node));
+        return map_node_collision_replicate(
+            state, (MapNode_Collision *)node,
+            (MapNode_Collision *)old_node, (MapNode_Collision *)old_copy);
+    }
+}
+
+
+PyObject *
+MemHive_ReplicateMap(module_state *state, PyObject *map,
+                     PyObject *old_map, PyObject *old_copy)
+{
+    assert((old_map == NULL) == (old_copy == NULL));
+
+    MapObject *o = map_alloc(state);
+    if (o == NULL) {
+        return NULL;
+    }
+
+    o->h_count = ((MapObject *)map)->h_count;
+
+    MapNode *new_root = (MapNode *)map_node_replicate(
+        state,
+        ((MapObject *)map)->h_root,
+        old_map != NULL ? ((MapObject *)old_map)->h_root : NULL,
+        old_copy != NULL ? ((MapObject *)old_copy)->h_root : NULL);
+    if (new_root == NULL) {
+        Py_DECREF((PyObject *)o);
+        return NULL;
+    }
+
+    o->h_root = new_root;
+
+    VALIDATE_NODE(state, new_root);
+
+    return (PyObject *)o;
+}
@@ -129,13 +129,41 @@ extern PyType_Spec ArrayNode_TypeSpec;
 extern PyType_Spec BitmapNode_TypeSpec;
 extern PyType_Spec CollisionNode_TypeSpec;
 
+/* Totals collected by `MemHive_MapMemoryUsage()`; sizes are in bytes
+   and don't include the GC headers. */
+typedef struct {
+    Py_ssize_t bitmap_nodes;
+    Py_ssize_t array_nodes;
+    Py_ssize_t collision_nodes;
+    Py_ssize_t node_bytes;
+    Py_ssize_t key_bytes;
+    Py_ssize_t value_bytes;
+    Py_ssize_t shared_nodes;
+} MapMemoryUsage;
+
 PyObject * MemHive_NewMap(module_state *);
+int32_t MemHive_MapHash(PyObject *key);
 PyObject * MemHive_MapSetItem(module_state *state,
                               PyObject *self, PyObject *key, PyObject *val);
+PyObject * MemHive_MapDelItem(module_state *state,
+                              PyObject *self, PyObject *key);
 PyObject * MemHive_MapGetItem(module_state *state, PyObject *self,
                               PyObject *key, PyObject *def);
 int MemHive_MapContains(module_state *state, PyObject *self, PyObject *key);
+// Borrowed, uncopied `*val`; returns 1 if found, 0 if not, -1 on error.
+int MemHive_MapFind(module_state *state, PyObject *self,
+                    PyObject *key, PyObject **val);
 PyObject * MemHive_NewMapProxy(module_state *, PyObject *);
 PyObject * MemHive_CopyMapProxy(module_state *, PyObject *);
+// A local copy of a remote `map`, reusing the parts of `old_copy`
+// (a copy of `old_map`) that `map` shares with `old_map`.
+PyObject * MemHive_ReplicateMap(module_state *state, PyObject *map,
+                                PyObject *old_map, PyObject *old_copy);
+// Add the memory used by `map` to `usage`. Nodes that are also part
+// of `shared_with` (can be NULL) are counted in `shared_nodes`.
+int MemHive_MapMemoryUsage(module_state *state, PyObject *map, int deep,
+                           PyObject *shared_with, MapMemoryUsage *usage);
+PyObject * MemHive_MapMemoryUsageAsDict(MapMemoryUsage *usage,
+                                        int with_shared);
 
 #endif
@@ -1,33 +1,150 @@
+#include <math.h>
+#include <time.h>
+
 #include "errormech.h"
 #include "memhive.h"
 #include "module.h"
 #include "queue.h"
 #include "track.h"
+#include "utils.h"
+
 
+static void
+memhive_worker_lost(void *arg, uint64_t sub_id)
+{
+    // A worker the pool couldn't start, see pool.h; there's no sub to
+    // report it, so we do. Called with our GIL held.
+    MemHive *o = (MemHive *)arg;
+    PyObject *exc = PyErr_GetRaisedException();
+    if (MemQueue_Put(&o->subs_health, o->mod_state, E_HEALTH_LOST,
+                     0, (PyObject *)o, sub_id, NULL))
+    {
+        // The hive is closing, nobody is waiting for the worker.
+        PyErr_Clear();
+    }
+    PyErr_SetRaisedException(exc);
+}
 
 static int
 memhive_tp_init(MemHive *o, PyObject *args, PyObject *kwds)
 {
+    static char *kwlist[] = {
+        "group_commit_window", "shards", "ring_capacity", "queue_capacity",
+        "work_stealing", NULL};
+    PyObject *gc_window = Py_None;
+    Py_ssize_t nshards = 1;
+    Py_ssize_t ring_capacity = 0;
+    Py_ssize_t queue_capacity = 0;
+    int work_stealing = 0;
+
     module_state *state = MemHive_GetModuleStateByPythonType(Py_TYPE(o));
 
-    if (pthread_rwlock_init(&o->index_rwlock, NULL)) {
-        Py_FatalError("Failed to initialize an RWLock");
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$Onnnp:MemHive", kwlist,
+                                     &gc_window, &nshards, &ring_capacity,
+                                     &queue_capacity, &work_stealing))
+    {
+        return -1;
     }
 
-    o->index = MemHive_NewMap(state);
-    if (o->index == NULL) {
-        goto err;
+    if (ring_capacity < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "ring_capacity must be non-negative");
+        return -1;
+    }
+    if (queue_capacity < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "queue_capacity must be non-negative");
+        return -1;
+    }
+    if (ring_capacity > 0 && queue_capacity > 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "ring_capacity already bounds the queue, "
+                        "queue_capacity can't be used with it");
+        return -1;
+    }
+    if (work_stealing && (ring_capacity > 0 || queue_capacity > 0)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "work_stealing can't be used with ring_capacity "
+                        "or queue_capacity");
+        return -1;
     }
 
-    o->mod_state = state;
+    if (nshards < 1 || nshards > MEMHIVE_MAX_SHARDS) {
+        PyErr_Format(PyExc_ValueError,
+                     "shards must be between 1 and %d", MEMHIVE_MAX_SHARDS);
+        return -1;
+    }
+
+    o->gc_window = -1;
+    if (gc_window != Py_None) {
+        double window = PyFloat_AsDouble(gc_window);
+        if (window == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (!isfinite(window) || window < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "group_commit_window must be a finite, "
+                            "non-negative number");
+            return -1;
+        }
+        if (window > MEMHIVE_TIMEOUT_MAX) {
+            window = MEMHIVE_TIMEOUT_MAX;
+        }
+        o->gc_window = (int64_t)(window * 1e9);
+    }
+
+    o->shards = PyMem_RawMalloc((size_t)nshards * sizeof(MemHiveShard));
+    if (o->shards == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (o->nshards = 0; o->nshards < nshards; o->nshards++) {
+        MemHiveShard *shard = &o->shards[o->nshards];
+
+        shard->index = MemHive_NewMap(state);
+        if (shard->index == NULL) {
+            goto err;
+        }
+        shard->version = 0;
+
+        if (pthread_rwlock_init(&shard->rwlock, NULL)) {
+            Py_FatalError("Failed to initialize an RWLock");
+        }
+    }
+
+    o->gc_first = NULL;
+    o->gc_last = NULL;
+    o->gc_leading = 0;
+    if (pthread_mutex_init(&o->gc_mut, NULL)) {
+        Py_FatalError("Failed to initialize a mutex");
+    }
+    if (pthread_cond_init(&o->gc_cond, NULL)) {
+        Py_FatalError("Failed to initialize a condition");
+    }
 
-    if (MemQueue_Init(&o->subs_health, 0)) {
+    o->ttl = NULL;
+
+    if (MemQueue_Init(&o->subs_health, 0, 0)) {
         Py_FatalError("Failed to initialize the system queue");
     }
-    if (MemQueue_Init(&o->for_subs, MEMHIVE_MAX_WORKERS)) {
+    // With `ring_capacity` > 0 pushes to workers go through a bounded
+    // lock-free ring, see MemQueue_InitRing(); `queue_capacity` bounds
+    // the default list instead. With `work_stealing` they're dealt to
+    // the workers' own channels, see MemQueue_InitStealing().
+    int r;
+    if (ring_capacity > 0) {
+        r = MemQueue_InitRing(&o->for_subs, MEMHIVE_MAX_WORKERS,
+                              (size_t)ring_capacity);
+    } else if (work_stealing) {
+        r = MemQueue_InitStealing(&o->for_subs, MEMHIVE_MAX_WORKERS);
+    } else {
+        r = MemQueue_Init(&o->for_subs, MEMHIVE_MAX_WORKERS, queue_capacity);
+    }
+    if (r) {
         Py_FatalError("Failed to initialize the subs intake queue");
     }
-    if (MemQueue_Init(&o->for_main, 0)) {
+    // Every worker gets its own intake channel, see MemHive_RegisterSub().
+    if (MemQueue_InitFair(&o->for_main, MEMHIVE_MAX_WORKERS)) {
         Py_FatalError("Failed to initialize the subs output queue");
     }
 
@@ -36,14 +153,35 @@ memhive_tp_init(MemHive *o, PyObject *args, PyObject *kwds)
         Py_FatalError("Failed to initialize a mutex");
     }
 
+    o->watches = NULL;
+    if (pthread_mutex_init(&o->watches_mut, NULL)) {
+        Py_FatalError("Failed to initialize a mutex");
+    }
+
     o->push_id_cnt = 0;
 
+    if (MemHivePool_Init(&o->pool, (uint64_t)(uintptr_t)o, &o->for_subs,
+                         memhive_worker_lost, o))
+    {
+        Py_FatalError("Failed to initialize the worker pool");
+    }
+
+    // Set last: `memhive_tp_dealloc()` uses it to tell if the hive
+    // was fully initialized.
+    o->mod_state = state;
+
     TRACK(state, o);
 
     return 0;
 
 err:
-    Py_CLEAR(o->index);
+    for (Py_ssize_t i = 0; i < o->nshards; i++) {
+        Py_CLEAR(o->shards[i].index);
+        pthread_rwlock_destroy(&o->shards[i].rwlock);
+    }
+    PyMem_RawFree(o->shards);
+    o->shards = NULL;
+    o->nshards = 0;
     return -1;
 }
 
@@ -54,14 +192,25 @@ MemHive_RegisterSub(MemHive *hive, MemHiveSub *sub,
     pthread_mutex_lock(&hive->subs_list_mut);
 
     // Adding channel might fail, so do it first.
-    ssize_t channel = MemQueue_AddChannel(&hive->for_subs, remote_state);
+    ssize_t channel = MemQueue_AddChannel(
+        &hive->for_subs, remote_state, 0, sub->exclusive);
     if (channel < 0) {
         goto err_from_locked;
     }
+    sub->main_channel = MemQueue_AddChannel(
+        &hive->for_main, remote_state, 0, 0);
+    if (sub->main_channel < 0) {
+        MemQueue_ReleaseChannel(&hive->for_subs, channel);
+        goto err_from_locked;
+    }
+
+    sub->channel_gen = MemQueue_ChannelGeneration(&hive->for_subs, channel);
 
     SubsList *cnt = PyMem_RawMalloc(sizeof (SubsList));
     if (cnt == NULL) {
         PyErr_NoMemory();
+        MemQueue_ReleaseChannel(&hive->for_main, sub->main_channel);
+        MemQueue_ReleaseChannel(&hive->for_subs, channel);
         goto err_from_locked;
     }
 
@@ -112,6 +261,54 @@ MemHive_UnregisterSub(MemHive *hive, MemHiveSub *sub)
     pthread_mutex_unlock(&hive->subs_list_mut);
 
     assert(removed);
+
+    pthread_mutex_lock(&hive->watches_mut);
+
+    MemHiveWatch **pw = &hive->watches;
+    while (*pw != NULL) {
+        MemHiveWatch *w = *pw;
+        if (w->channel == sub->channel
+            && w->generation == sub->channel_gen)
+        {
+            *pw = w->next;
+            PyMem_RawFree(w);
+        } else {
+            pw = &w->next;
+        }
+    }
+
+    pthread_mutex_unlock(&hive->watches_mut);
+
+    // A notification for these watches that is already on its way
+    // won't reach a new sub getting the channel: it's put with
+    // MemQueue_PutTo() and dropped once the generation changes.
+    MemQueue_ReleaseChannel(&hive->for_subs, sub->channel);
+    // Main still gets what's left in it.
+    MemQueue_ReleaseChannel(&hive->for_main, sub->main_channel);
+}
+
+MEMHIVE_REMOTE(int)
+MemHive_Watch(MemHive *hive, MemHiveSub *sub,
+              const char *key, Py_ssize_t len, int is_prefix)
+{
+    MemHiveWatch *w = PyMem_RawMalloc(sizeof(MemHiveWatch) + (size_t)len);
+    if (w == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    w->channel = sub->channel;
+    w->generation = sub->channel_gen;
+    w->is_prefix = is_prefix ? 1 : 0;
+    w->len = len;
+    memcpy(w->key, key, (size_t)len);
+
+    pthread_mutex_lock(&hive->watches_mut);
+    w->next = hive->watches;
+    hive->watches = w;
+    pthread_mutex_unlock(&hive->watches_mut);
+
+    return 0;
 }
 
 static void
@@ -132,19 +329,44 @@ memhive_do_refs(MemHive *hive)
 static void
 memhive_tp_dealloc(MemHive *o)
 {
-    if (pthread_rwlock_wrlock(&o->index_rwlock)) {
-        Py_FatalError("Failed to acquire the MemHive index write lock");
+    if (o->mod_state == NULL) {
+        // __init__ has failed or was never called.
+        goto free;
     }
 
-    Py_CLEAR(o->index);
+    // Normally the threads are already joined by
+    // `join_worker_threads()`; the workers must not outlive the hive.
+    Py_BEGIN_ALLOW_THREADS
+    MemHivePool_Join(&o->pool);
+    Py_END_ALLOW_THREADS
+    MemHivePool_Destroy(&o->pool);
 
-    if (pthread_rwlock_unlock(&o->index_rwlock)) {
-        Py_FatalError("Failed to release the MemHive index write lock");
-    }
+    for (Py_ssize_t i = 0; i < o->nshards; i++) {
+        MemHiveShard *shard = &o->shards[i];
+
+        if (pthread_rwlock_wrlock(&shard->rwlock)) {
+            Py_FatalError("Failed to acquire the MemHive index write lock");
+        }
+
+        Py_CLEAR(shard->index);
 
-    if (pthread_rwlock_destroy(&o->index_rwlock)) {
-        Py_FatalError("Failed to destroy the MemHive index lock");
+        if (pthread_rwlock_unlock(&shard->rwlock)) {
+            Py_FatalError("Failed to release the MemHive index write lock");
+        }
+
+        if (pthread_rwlock_destroy(&shard->rwlock)) {
+            Py_FatalError("Failed to destroy the MemHive index lock");
+        }
     }
+    PyMem_RawFree(o->shards);
+    o->shards = NULL;
+    o->nshards = 0;
+
+    Py_CLEAR(o->ttl);
+
+    assert(o->gc_first == NULL);
+    pthread_mutex_destroy(&o->gc_mut);
+    pthread_cond_destroy(&o->gc_cond);
 
     pthread_mutex_destroy(&o->subs_list_mut);
     SubsList *l = o->subs_list;
@@ -155,30 +377,253 @@ memhive_tp_dealloc(MemHive *o)
     }
     o->subs_list = NULL;
 
+    pthread_mutex_destroy(&o->watches_mut);
+    MemHiveWatch *w = o->watches;
+    while (w != NULL) {
+        MemHiveWatch *next = w->next;
+        PyMem_RawFree(w);
+        w = next;
+    }
+    o->watches = NULL;
+
     MemQueue_Destroy(&o->subs_health);
     MemQueue_Destroy(&o->for_main);
     MemQueue_Destroy(&o->for_subs);
 
+free:;
     PyTypeObject *tp = Py_TYPE(o);
     tp->tp_free((PyObject *)o);
     Py_DecRef((PyObject*)tp);
 }
 
 
-static Py_ssize_t
-memhive_tp_len(MemHive *o)
+static MemHiveShard *
+memhive_shard_for(MemHive *hive, PyObject *key)
 {
-    if (pthread_rwlock_rdlock(&o->index_rwlock)) {
-        Py_FatalError("Failed to acquire the MemHive index read lock");
+    if (hive->nshards == 1) {
+        return &hive->shards[0];
+    }
+
+    int32_t hash = MemHive_MapHash(key);
+    if (hash == -1) {
+        return NULL;
+    }
+
+    // Pick the shard by the high bits of the hash: the low ones select
+    // the slot at the root level of the shard's HAMT.
+    uint64_t idx = ((uint64_t)(uint32_t)hash * (uint64_t)hive->nshards) >> 32;
+    return &hive->shards[idx];
+}
+
+MEMHIVE_REMOTE(Py_ssize_t)
+MemHive_ShardIndex(MemHive *hive, PyObject *key)
+{
+    MemHiveShard *shard = memhive_shard_for(hive, key);
+    if (shard == NULL) {
+        return -1;
     }
+    return shard - hive->shards;
+}
 
-    Py_ssize_t size = PyObject_Length(o->index);
+static inline int
+memhive_is_owner(module_state *state, MemHive *hive)
+{
+    return state->interpreter_id == hive->mod_state->interpreter_id;
+}
+
+static inline PyObject *
+memhive_shard_read_begin(module_state *state, MemHive *hive,
+                         MemHiveShard *shard)
+{
+    // Returns the shard's index to read from until the matching
+    // `memhive_shard_read_end()`.
+    //
+    // The owner interpreter gets a new reference to the root instead
+    // of the read lock: a writer can release the GIL while holding the
+    // write lock (draining refqueues), so blocking on it with the GIL
+    // held would deadlock. Keys' __eq__/__hash__ can run Python code
+    // and let another thread swap the root while we're walking it, so
+    // the reference is what keeps the tree alive.
+    if (memhive_is_owner(state, hive)) {
+        return Py_NewRef(shard->index);
+    }
+    if (pthread_rwlock_rdlock(&shard->rwlock)) {
+        Py_FatalError("Failed to acquire the MemHive index read lock");
+    }
+    return shard->index;
+}
 
-    if (pthread_rwlock_unlock(&o->index_rwlock)) {
+static inline void
+memhive_shard_read_end(module_state *state, MemHive *hive,
+                       MemHiveShard *shard, PyObject *index)
+{
+    if (memhive_is_owner(state, hive)) {
+        Py_DECREF(index);
+        return;
+    }
+    if (pthread_rwlock_unlock(&shard->rwlock)) {
         Py_FatalError("Failed to release the MemHive index read lock");
     }
+}
 
-    return size;
+static void
+memhive_shard_wrlock(MemHiveShard *shard)
+{
+    if (pthread_rwlock_trywrlock(&shard->rwlock)) {
+        Py_BEGIN_ALLOW_THREADS
+        if (pthread_rwlock_wrlock(&shard->rwlock)) {
+            Py_FatalError("Failed to acquire the MemHive index write lock");
+        }
+        Py_END_ALLOW_THREADS
+    }
+}
+
+static void
+memhive_shard_wrunlock(MemHiveShard *shard)
+{
+    if (pthread_rwlock_unlock(&shard->rwlock)) {
+        Py_FatalError("Failed to release the MemHive index write lock");
+    }
+}
+
+
+static uint64_t
+memhive_index_version(MemHive *o)
+{
+    // Shard versions only ever grow, so their sum changes whenever
+    // any of the shards does.
+    uint64_t version = 0;
+    for (Py_ssize_t i = 0; i < o->nshards; i++) {
+        version += o->shards[i].version;
+    }
+    return version;
+}
+
+static void
+memhive_notify_watchers(MemHive *o, PyObject *const *keys, Py_ssize_t nkeys)
+{
+    // Send one notification with the changed keys to every channel
+    // watching any of them. Called after a commit with all keys it
+    // has changed, so a commit results in at most one notification
+    // per watching worker.
+    //
+    // Notifications are best-effort: the commit is already published,
+    // so the write must not fail because of them. Keys that can't be
+    // encoded can't match any watch and are skipped; any other error
+    // is reported as unraisable.
+
+    // Only workers add watches, the check is racy by design: a watch
+    // registered concurrently with a commit might miss it.
+    if (o->watches == NULL) {
+        return;
+    }
+
+    PyObject *routes = NULL;    // {(channel, generation): {key: None}}
+    int ret = -1;
+
+    pthread_mutex_lock(&o->watches_mut);
+
+    for (Py_ssize_t i = 0; i < nkeys; i++) {
+        if (!PyUnicode_Check(keys[i])) {
+            continue;
+        }
+        Py_ssize_t len;
+        const char *key = PyUnicode_AsUTF8AndSize(keys[i], &len);
+        if (key == NULL) {
+            // E.g. a lone surrogate; watches are always valid UTF-8.
+            PyErr_Clear();
+            continue;
+        }
+
+        for (MemHiveWatch *w = o->watches; w != NULL; w = w->next) {
+            if (w->is_prefix ? len < w->len : len != w->len) {
+                continue;
+            }
+            if (memcmp(key, w->key, (size_t)w->len) != 0) {
+                continue;
+            }
+
+            if (routes == NULL) {
+                routes = PyDict_New();
+                if (routes == NULL) {
+                    goto unlock;
+                }
+            }
+
+            PyObject *route = Py_BuildValue(
+                "nK", w->channel, (unsigned long long)w->generation);
+            if (route == NULL) {
+                goto unlock;
+            }
+            PyObject *chan_keys;
+            int r = PyDict_GetItemRef(routes, route, &chan_keys);
+            if (r == 0) {
+                chan_keys = PyDict_New();
+                if (chan_keys == NULL
+                    || PyDict_SetItem(routes, route, chan_keys))
+                {
+                    r = -1;
+                }
+            }
+            Py_DECREF(route);
+            if (r < 0) {
+                Py_XDECREF(chan_keys);
+                goto unlock;
+            }
+            r = PyDict_SetItem(chan_keys, keys[i], Py_None);
+            Py_DECREF(chan_keys);
+            if (r) {
+                goto unlock;
+            }
+        }
+    }
+
+    ret = 0;
+
+unlock:
+    pthread_mutex_unlock(&o->watches_mut);
+
+    if (ret) {
+        PyErr_WriteUnraisable((PyObject *)o);
+    }
+    if (ret || routes == NULL) {
+        Py_XDECREF(routes);
+        return;
+    }
+
+    uint64_t version = memhive_index_version(o);
+
+    Py_ssize_t pos = 0;
+    PyObject *route;
+    PyObject *chan_keys;
+    while (PyDict_Next(routes, &pos, &route, &chan_keys)) {
+        // A failure only costs this channel its notification.
+        PyObject *payload = PySequence_Tuple(chan_keys);
+        if (payload == NULL) {
+            PyErr_WriteUnraisable((PyObject *)o);
+            continue;
+        }
+        TRACK(o->mod_state, payload);
+        // Dropped if the watching sub has gone away since.
+        if (MemQueue_PutTo(&o->for_subs, o->mod_state, E_HUB_WATCH,
+                           PyLong_AsSsize_t(PyTuple_GET_ITEM(route, 0)),
+                           PyLong_AsUnsignedLongLong(
+                               PyTuple_GET_ITEM(route, 1)),
+                           (PyObject *)o, version, payload) < 0)
+        {
+            PyErr_WriteUnraisable((PyObject *)o);
+        }
+        Py_DECREF(payload);
+    }
+
+    Py_DECREF(routes);
+}
+
+
+static Py_ssize_t
+memhive_tp_len(MemHive *o)
+{
+    return MemHive_Len(o->mod_state, o);
 }
 
 
@@ -189,91 +634,1235 @@ memhive_tp_subscript(MemHive *o, PyObject *key)
 }
 
 
+typedef int (*memhive_index_mutator)(
+    MemHive *o, MemHiveShard *shard, PyObject *mut, void *arg);
+
 static int
-memhive_tp_ass_sub(MemHive *o, PyObject *key, PyObject *val)
+memhive_index_mutate(MemHive *o, MemHiveShard *shard,
+                     memhive_index_mutator mutator, void *arg)
+{
+    // Apply `mutator` to a MapMutation of the shard's current index
+    // and publish the result as the new version of it.
+    //
+    // Only main interpreter threads holding the GIL ever write to
+    // the index, so it's safe to build the new version outside of
+    // the write lock -- readers in other interpreters only ever
+    // schedule increfs, which we apply before the old version can be
+    // released. That keeps the write lock held only for the duration
+    // of the root swap. If someone else has published a new version
+    // while we were building ours (the GIL can be released by a key's
+    // __eq__ implemented in Python, or while waiting for the lock),
+    // we start over.
+
+    while (1) {
+        uint64_t base_version = shard->version;
+
+        PyObject *mut = PyObject_CallMethod(shard->index, "mutate", NULL);
+        if (mut == NULL) {
+            return -1;
+        }
+
+        if (mutator(o, shard, mut, arg)) {
+            Py_DECREF(mut);
+            return -1;
+        }
+
+        PyObject *new_index = PyObject_CallMethod(mut, "finish", NULL);
+        Py_DECREF(mut);
+        if (new_index == NULL) {
+            return -1;
+        }
+
+        memhive_shard_wrlock(shard);
+
+        int raced = shard->version != base_version;
+        if (!raced) {
+            // See the comment in `memhive_tp_ass_sub()` on why
+            // this is needed.
+            memhive_do_refs(o);
+
+            Py_SETREF(shard->index, new_index);
+            shard->version++;
+        }
+
+        memhive_shard_wrunlock(shard);
+
+        if (!raced) {
+            return 0;
+        }
+        Py_DECREF(new_index);
+    }
+}
+
+static int
+memhive_group_commit_apply(MemHive *o, MemHiveShard *shard,
+                           PyObject *mut, void *arg)
 {
-    if (pthread_rwlock_wrlock(&o->index_rwlock)) {
-        Py_FatalError("Failed to acquire the MemHive index write lock");
+    for (GroupCommitWrite *w = arg; w != NULL; w = w->next) {
+        if (w->shard == shard && PyObject_SetItem(mut, w->key, w->val)) {
+            return -1;
+        }
     }
+    return 0;
+}
 
-    // It's important to do the refs here! When a remote interpreter reads
-    // a value, say another Map, that Map has to keep existing in the main
-    // interpreter. All scheduled increfs while `index_rwlock` *read* lock
-    // was held must be applied before we apply changes while having
-    // the *write* lock.
-    memhive_do_refs(o);
+static int
+memhive_group_commit_apply_one(MemHive *o, MemHiveShard *shard,
+                               PyObject *mut, void *arg)
+{
+    GroupCommitWrite *w = arg;
+    return PyObject_SetItem(mut, w->key, w->val);
+}
 
-    PyObject *new_index = MemHive_MapSetItem(o->mod_state, o->index, key, val);
-    if (new_index != NULL) {
-        Py_SETREF(o->index, new_index);
+static void
+memhive_group_commit_shard(MemHive *o, MemHiveShard *shard,
+                           GroupCommitWrite *batch)
+{
+    // Commit the writes of `batch` that go to `shard`. If the commit
+    // fails, its writes are retried one by one, so that a bad write
+    // fails alone and with its own exception. Writes to other shards
+    // have their own commits and are left alone.
+
+    if (!memhive_index_mutate(o, shard, memhive_group_commit_apply, batch)) {
+        return;
+    }
+    PyErr_Clear();
+    for (GroupCommitWrite *w = batch; w != NULL; w = w->next) {
+        if (w->shard == shard
+            && memhive_index_mutate(o, shard,
+                                    memhive_group_commit_apply_one, w))
+        {
+            w->error = PyErr_GetRaisedException();
+        }
     }
+}
 
-    if (pthread_rwlock_unlock(&o->index_rwlock)) {
-        Py_FatalError("Failed to release the MemHive index write lock");
+static void
+memhive_group_commit_notify(MemHive *o, GroupCommitWrite *batch)
+{
+    // One notification round for all the writes of the batch that
+    // have been committed.
+
+    if (o->watches == NULL) {
+        return;
     }
 
-    if (new_index == NULL) {
-        return -1;
+    Py_ssize_t nkeys = 0;
+    for (GroupCommitWrite *w = batch; w != NULL; w = w->next) {
+        nkeys++;
+    }
+    PyObject **keys = PyMem_Malloc(sizeof(PyObject *) * (size_t)nkeys);
+    if (keys == NULL) {
+        // The writes are published already, only the notification
+        // is lost.
+        PyErr_NoMemory();
+        PyErr_WriteUnraisable((PyObject *)o);
+        return;
+    }
+    nkeys = 0;
+    for (GroupCommitWrite *w = batch; w != NULL; w = w->next) {
+        if (w->error == NULL) {
+            keys[nkeys++] = w->key;
+        }
     }
+    memhive_notify_watchers(o, keys, nkeys);
+    PyMem_Free(keys);
+}
 
-    return 0;
+static void
+memhive_group_commit_finish(MemHive *o, GroupCommitWrite *batch)
+{
+    // Commit `batch`, one commit per shard touched by it, and set
+    // the status of each write in it.
+
+    for (Py_ssize_t i = 0; i < o->nshards; i++) {
+        MemHiveShard *shard = &o->shards[i];
+        for (GroupCommitWrite *w = batch; w != NULL; w = w->next) {
+            if (w->shard == shard) {
+                memhive_group_commit_shard(o, shard, batch);
+                break;
+            }
+        }
+    }
+
+    memhive_group_commit_notify(o, batch);
+
+    pthread_mutex_lock(&o->gc_mut);
+    while (batch != NULL) {
+        GroupCommitWrite *next = batch->next;
+        // Once the status is set the writer can return and
+        // `batch` will be gone with its stack frame.
+        batch->status = batch->error != NULL ? -1 : 1;
+        batch = next;
+    }
+    pthread_cond_broadcast(&o->gc_cond);
+    pthread_mutex_unlock(&o->gc_mut);
 }
 
 static int
-memhive_tp_contains(MemHive *hive, PyObject *key)
+memhive_group_commit_set(MemHive *o, PyObject *key, PyObject *val)
 {
-    return MemHive_MapContains(hive->mod_state, hive->index, key);
-}
+    // Fail early, we don't want the whole batch to fail because
+    // of one bad key.
+    if (PyObject_Hash(key) == -1) {
+        return -1;
+    }
+
+    MemHiveShard *shard = memhive_shard_for(o, key);
+    if (shard == NULL) {
+        return -1;
+    }
+
+    // `key` and `val` are borrowed: the caller keeps them alive
+    // until we return, and we return only after the write is published.
+    GroupCommitWrite me = {key, val, shard, NULL, 0, NULL};
+
+    if (o->gc_last == NULL) {
+        o->gc_first = &me;
+    } else {
+        o->gc_last->next = &me;
+    }
+    o->gc_last = &me;
+
+    if (o->gc_leading) {
+        // Someone else is committing; they'll pick our write up.
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&o->gc_mut);
+        while (me.status == 0) {
+            pthread_cond_wait(&o->gc_cond, &o->gc_mut);
+        }
+        pthread_mutex_unlock(&o->gc_mut);
+        Py_END_ALLOW_THREADS
+
+        if (me.status < 0) {
+            PyErr_SetRaisedException(me.error);
+            return -1;
+        }
+        return 0;
+    }
+
+    o->gc_leading = 1;
+
+    // Let other writers join the batch. They can only do that while
+    // we don't hold the GIL.
+    Py_BEGIN_ALLOW_THREADS
+    if (o->gc_window > 0) {
+        struct timespec ts = {
+            .tv_sec = o->gc_window / 1000000000,
+            .tv_nsec = o->gc_window % 1000000000,
+        };
+        nanosleep(&ts, NULL);
+    }
+    Py_END_ALLOW_THREADS
+
+    // Writes can arrive while we commit (we release the GIL if we
+    // have to wait for the write lock), so keep going until the
+    // list of pending writes is drained. Our own write is always
+    // in the first batch.
+    while (o->gc_first != NULL) {
+        GroupCommitWrite *batch = o->gc_first;
+        o->gc_first = NULL;
+        o->gc_last = NULL;
+        memhive_group_commit_finish(o, batch);
+    }
 
+    o->gc_leading = 0;
+
+    if (me.status < 0) {
+        PyErr_SetRaisedException(me.error);
+        return -1;
+    }
+    return 0;
+}
 
-Py_ssize_t
-MemHive_Len(MemHive *hive)
+static int
+memhive_ttl_forget(MemHive *o, PyObject *key)
 {
-    return memhive_tp_len(hive);
+    if (o->ttl == NULL) {
+        return 0;
+    }
+    return PyDict_Pop(o->ttl, key, NULL) < 0 ? -1 : 0;
 }
 
-MEMHIVE_REMOTE(PyObject *)
-MemHive_Get(module_state *state, MemHive *hive, PyObject *key)
+static int
+memhive_index_pop(MemHive *o, PyObject *key, PyObject **val)
 {
-    if (pthread_rwlock_rdlock(&hive->index_rwlock)) {
-        Py_FatalError("Failed to acquire the MemHive index read lock");
+    // Remove `key` from the index. Returns 1 and a new reference to
+    // the removed value in `*val` if the key was found, 0 if it's missing.
+
+    MemHiveShard *shard = memhive_shard_for(o, key);
+    if (shard == NULL) {
+        return -1;
+    }
+
+    memhive_shard_wrlock(shard);
+
+    // See the comment in `memhive_tp_ass_sub()` on why this is needed.
+    memhive_do_refs(o);
+
+    PyObject *cur;
+    int found = MemHive_MapFind(o->mod_state, shard->index, key, &cur);
+    if (found > 0) {
+        PyObject *new_index = MemHive_MapDelItem(
+            o->mod_state, shard->index, key);
+        if (new_index == NULL) {
+            found = -1;
+        } else {
+            // Grab the value before the old index version is released.
+            *val = Py_NewRef(cur);
+            Py_SETREF(shard->index, new_index);
+            shard->version++;
+        }
+    }
+
+    memhive_shard_wrunlock(shard);
+
+    if (found > 0) {
+        // The removal is committed, don't lose the value over a stale
+        // TTL entry: the sweep skips keys that are gone anyway.
+        if (memhive_ttl_forget(o, key)) {
+            PyErr_WriteUnraisable((PyObject *)o);
+        }
+        memhive_notify_watchers(o, &key, 1);
+    }
+
+    return found;
+}
+
+static int
+memhive_tp_ass_sub(MemHive *o, PyObject *key, PyObject *val)
+{
+    if (val == NULL) {
+        PyObject *old;
+        int found = memhive_index_pop(o, key, &old);
+        if (found < 0) {
+            return -1;
+        }
+        if (!found) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            return -1;
+        }
+        Py_DECREF(old);
+        return 0;
+    }
+
+    // A plain set drops the TTL the key might have had.
+    if (memhive_ttl_forget(o, key)) {
+        return -1;
+    }
+
+    if (o->gc_window >= 0) {
+        return memhive_group_commit_set(o, key, val);
+    }
+
+    MemHiveShard *shard = memhive_shard_for(o, key);
+    if (shard == NULL) {
+        return -1;
+    }
+
+    memhive_shard_wrlock(shard);
+
+    // It's important to do the refs here! When a remote interpreter reads
+    // a value, say another Map, that Map has to keep existing in the main
+    // interpreter. All scheduled increfs while the shard's *read* lock
+    // was held must be applied before we apply changes while having
+    // the *write* lock.
+    memhive_do_refs(o);
+
+    PyObject *new_index = MemHive_MapSetItem(
+        o->mod_state, shard->index, key, val);
+    if (new_index != NULL) {
+        Py_SETREF(shard->index, new_index);
+        shard->version++;
+    }
+
+    memhive_shard_wrunlock(shard);
+
+    if (new_index == NULL) {
+        return -1;
+    }
+
+    memhive_notify_watchers(o, &key, 1);
+    return 0;
+}
+
+static int
+memhive_tp_contains(MemHive *hive, PyObject *key)
+{
+    return MemHive_Contains(hive->mod_state, hive, key);
+}
+
+
+MEMHIVE_REMOTE(Py_ssize_t)
+MemHive_Len(module_state *state, MemHive *hive)
+{
+    Py_ssize_t size = 0;
+
+    for (Py_ssize_t i = 0; i < hive->nshards; i++) {
+        MemHiveShard *shard = &hive->shards[i];
+
+        PyObject *index = memhive_shard_read_begin(state, hive, shard);
+        // Safe to call on a remote Map, it only reads its length field.
+        Py_ssize_t shard_size = PyObject_Length(index);
+        memhive_shard_read_end(state, hive, shard, index);
+
+        if (shard_size < 0) {
+            return -1;
+        }
+        size += shard_size;
+    }
+
+    return size;
+}
+
+MEMHIVE_REMOTE(PyObject *)
+MemHive_Get(module_state *state, MemHive *hive, PyObject *key)
+{
+    MemHiveShard *shard = memhive_shard_for(hive, key);
+    if (shard == NULL) {
+        return NULL;
+    }
+
+    PyObject *index = memhive_shard_read_begin(state, hive, shard);
+    PyObject *val = MemHive_MapGetItem(state, index, key, NULL);
+    memhive_shard_read_end(state, hive, shard, index);
+
+    return val;
+}
+
+MEMHIVE_REMOTE(int)
+MemHive_Contains(module_state *state, MemHive *hive, PyObject *key)
+{
+    MemHiveShard *shard = memhive_shard_for(hive, key);
+    if (shard == NULL) {
+        return -1;
+    }
+
+    PyObject *index = memhive_shard_read_begin(state, hive, shard);
+    int ret = MemHive_MapContains(state, index, key);
+    memhive_shard_read_end(state, hive, shard, index);
+
+    return ret;
+}
+
+MEMHIVE_REMOTE(PyObject *)
+MemHive_Snapshot(module_state *state, MemHive *hive)
+{
+    // Returns a Map with the contents of all shards. With a single
+    // shard that's just the current version of the index (or a proxy
+    // to it); otherwise the shards are merged into a new Map.
+
+    int owner = memhive_is_owner(state, hive);
+    PyObject *mut = NULL;
+
+    for (Py_ssize_t i = 0; i < hive->nshards; i++) {
+        MemHiveShard *shard = &hive->shards[i];
+
+        PyObject *index = memhive_shard_read_begin(state, hive, shard);
+        PyObject *part;
+        if (owner) {
+            part = Py_NewRef(index);
+        } else {
+            part = MemHive_CopyObject(state, (RemoteObject *)index);
+        }
+        memhive_shard_read_end(state, hive, shard, index);
+
+        if (part == NULL) {
+            goto err;
+        }
+
+        if (hive->nshards == 1) {
+            return part;
+        }
+
+        if (!owner) {
+            // Merging copies keys and values into the resulting Map's
+            // nodes, so they have to be local.
+            Py_SETREF(part, MemHive_CopyMapProxy(state, part));
+            if (part == NULL) {
+                goto err;
+            }
+        }
+
+        if (mut == NULL) {
+            mut = PyObject_CallMethod(part, "mutate", NULL);
+            Py_DECREF(part);
+            if (mut == NULL) {
+                goto err;
+            }
+        } else {
+            PyObject *res = PyObject_CallMethod(mut, "update", "O", part);
+            Py_DECREF(part);
+            if (res == NULL) {
+                goto err;
+            }
+            Py_DECREF(res);
+        }
+    }
+
+    PyObject *snapshot = PyObject_CallMethod(mut, "finish", NULL);
+    Py_DECREF(mut);
+    return snapshot;
+
+err:
+    Py_XDECREF(mut);
+    return NULL;
+}
+
+static PyObject *
+memhive_tp_iter(MemHive *o)
+{
+    PyObject *snapshot = MemHive_Snapshot(o->mod_state, o);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    PyObject *it = PyObject_GetIter(snapshot);
+    Py_DECREF(snapshot);
+    return it;
+}
+
+static PyObject *
+memhive_py_snapshot(MemHive *o, PyObject *args)
+{
+    return MemHive_Snapshot(o->mod_state, o);
+}
+
+MEMHIVE_REMOTE(int)
+MemHive_SyncReplica(module_state *state, MemHive *hive, MemHiveSub *sub)
+{
+    // Bring the worker's replica up to date with the index. Only the
+    // shards that have changed since the last sync are processed, and
+    // only their changed parts are copied.
+
+    for (Py_ssize_t i = 0; i < hive->nshards; i++) {
+        MemHiveShard *shard = &hive->shards[i];
+        MemHiveReplica *rep = &sub->replica[i];
+
+        PyObject *index = memhive_shard_read_begin(state, hive, shard);
+
+        if (rep->seen != NULL && rep->version == shard->version) {
+            memhive_shard_read_end(state, hive, shard, index);
+            continue;
+        }
+
+        // Keep this version alive until we diff the next one against it;
+        // the incref will be applied before the index can be swapped.
+        RemoteObject *cur = (RemoteObject *)index;
+        uint64_t version = shard->version;
+        int r = MemHive_RefQueue_Inc(sub->main_refs, cur);
+
+        memhive_shard_read_end(state, hive, shard, index);
+
+        if (r) {
+            return -1;
+        }
+
+        PyObject *copy = MemHive_ReplicateMap(
+            state, (PyObject *)cur, (PyObject *)rep->seen, rep->copy);
+        if (copy == NULL) {
+            MemHive_RefQueue_Dec(sub->main_refs, cur);
+            return -1;
+        }
+
+        if (rep->seen != NULL
+            && MemHive_RefQueue_Dec(sub->main_refs, rep->seen))
+        {
+            Py_DECREF(copy);
+            MemHive_RefQueue_Dec(sub->main_refs, cur);
+            return -1;
+        }
+
+        rep->seen = cur;
+        Py_XSETREF(rep->copy, copy);
+        rep->version = version;
+    }
+
+    return 0;
+}
+
+MEMHIVE_REMOTE(void)
+MemHive_ClearReplica(MemHive *hive, MemHiveSub *sub)
+{
+    if (sub->replica == NULL) {
+        return;
+    }
+
+    for (Py_ssize_t i = 0; i < hive->nshards; i++) {
+        MemHiveReplica *rep = &sub->replica[i];
+        if (rep->seen != NULL) {
+            // Can only fail with NoMemory, and then the index version
+            // just stays around.
+            if (MemHive_RefQueue_Dec(sub->main_refs, rep->seen)) {
+                PyErr_Clear();
+            }
+        }
+        Py_CLEAR(rep->copy);
+    }
+
+    PyMem_RawFree(sub->replica);
+    sub->replica = NULL;
+}
+
+static int
+memhive_index_cas(MemHive *o, PyObject *key,
+                  PyObject *expected, PyObject *new)
+{
+    // Set `key` to `new` if its current value is `expected` (compared
+    // by identity, `NULL` means that the key must be missing).
+    // Returns 1 if the index was updated, 0 if the value didn't match.
+
+    MemHiveShard *shard = memhive_shard_for(o, key);
+    if (shard == NULL) {
+        return -1;
+    }
+
+    memhive_shard_wrlock(shard);
+
+    // See the comment in `memhive_tp_ass_sub()` on why this is needed.
+    memhive_do_refs(o);
+
+    int ret = 0;
+    PyObject *cur;
+    int found = MemHive_MapFind(o->mod_state, shard->index, key, &cur);
+    if (found < 0) {
+        ret = -1;
+        goto done;
+    }
+    if ((found ? cur : NULL) != expected) {
+        goto done;
+    }
+
+    PyObject *new_index = MemHive_MapSetItem(
+        o->mod_state, shard->index, key, new);
+    if (new_index == NULL) {
+        ret = -1;
+        goto done;
+    }
+    Py_SETREF(shard->index, new_index);
+    shard->version++;
+    ret = 1;
+
+done:
+    memhive_shard_wrunlock(shard);
+
+    if (ret == 1) {
+        memhive_notify_watchers(o, &key, 1);
+    }
+    return ret;
+}
+
+static PyObject *
+memhive_index_lookup(MemHive *o, PyObject *key, int *found)
+{
+    // Returns a new reference to the current value of `key`, or NULL
+    // with `*found` set to 0 if it's missing. Owner interpreter only.
+
+    MemHiveShard *shard = memhive_shard_for(o, key);
+    if (shard == NULL) {
+        *found = -1;
+        return NULL;
+    }
+
+    // The root is held for the same reason as in
+    // `memhive_shard_read_begin()`.
+    PyObject *index = Py_NewRef(shard->index);
+    PyObject *val;
+    *found = MemHive_MapFind(o->mod_state, index, key, &val);
+    if (*found <= 0) {
+        Py_DECREF(index);
+        return NULL;
+    }
+    Py_INCREF(val);
+    Py_DECREF(index);
+    return val;
+}
+
+static PyObject *
+memhive_py_cas(MemHive *o, PyObject *args)
+{
+    PyObject *key;
+    PyObject *expected;
+    PyObject *new;
+
+    if (!PyArg_UnpackTuple(args, "cas", 3, 3, &key, &expected, &new)) {
+        return NULL;
+    }
+
+    int ret = memhive_index_cas(o, key, expected, new);
+    if (ret < 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(ret);
+}
+
+static PyObject *
+memhive_py_setdefault(MemHive *o, PyObject *args)
+{
+    PyObject *key;
+    PyObject *val;
+
+    if (!PyArg_UnpackTuple(args, "setdefault", 2, 2, &key, &val)) {
+        return NULL;
+    }
+
+    while (1) {
+        int found;
+        PyObject *cur = memhive_index_lookup(o, key, &found);
+        if (found < 0) {
+            return NULL;
+        }
+        if (found) {
+            return cur;
+        }
+
+        int ret = memhive_index_cas(o, key, NULL, val);
+        if (ret < 0) {
+            return NULL;
+        }
+        if (ret) {
+            return Py_NewRef(val);
+        }
+    }
+}
+
+static PyObject *
+memhive_py_update_key(MemHive *o, PyObject *args)
+{
+    PyObject *key;
+    PyObject *fn;
+    PyObject *def = NULL;
+
+    if (!PyArg_UnpackTuple(args, "update_key", 2, 3, &key, &fn, &def)) {
+        return NULL;
+    }
+
+    // `fn` is arbitrary Python code that can release the GIL, so we
+    // can't call it while holding the index lock. Instead, retry until
+    // the value we've computed the update from is still current.
+    while (1) {
+        int found;
+        PyObject *cur = memhive_index_lookup(o, key, &found);
+        if (found < 0) {
+            return NULL;
+        }
+        if (!found && def == NULL) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            return NULL;
+        }
+
+        PyObject *new = PyObject_CallOneArg(fn, found ? cur : def);
+        if (new == NULL) {
+            Py_XDECREF(cur);
+            return NULL;
+        }
+
+        int ret = memhive_index_cas(o, key, cur, new);
+        Py_XDECREF(cur);
+        if (ret < 0) {
+            Py_DECREF(new);
+            return NULL;
+        }
+        if (ret) {
+            return new;
+        }
+        Py_DECREF(new);
+    }
+}
+
+static PyObject *
+memhive_py_pop(MemHive *o, PyObject *args)
+{
+    PyObject *key;
+    PyObject *def = NULL;
+
+    if (!PyArg_UnpackTuple(args, "pop", 1, 2, &key, &def)) {
+        return NULL;
+    }
+
+    PyObject *val;
+    int found = memhive_index_pop(o, key, &val);
+    if (found < 0) {
+        return NULL;
+    }
+    if (found) {
+        return val;
+    }
+    if (def == NULL) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return Py_NewRef(def);
+}
+
+static PyObject *
+memhive_py_set(MemHive *o, PyObject *args)
+{
+    PyObject *key;
+    PyObject *val;
+    PyObject *ttl = Py_None;
+
+    if (!PyArg_UnpackTuple(args, "set", 2, 3, &key, &val, &ttl)) {
+        return NULL;
+    }
+
+    double ttl_secs = 0;
+    if (ttl != Py_None) {
+        ttl_secs = PyFloat_AsDouble(ttl);
+        if (ttl_secs == -1.0 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (isnan(ttl_secs) || ttl_secs < 0) {
+            PyErr_SetString(PyExc_ValueError, "ttl must be non-negative");
+            return NULL;
+        }
+        if (isinf(ttl_secs)) {
+            // Never expires, same as no TTL.
+            ttl = Py_None;
+        } else if (ttl_secs > MEMHIVE_TIMEOUT_MAX) {
+            ttl_secs = MEMHIVE_TIMEOUT_MAX;
+        }
+    }
+
+    if (memhive_tp_ass_sub(o, key, val)) {
+        return NULL;
+    }
+
+    if (ttl == Py_None) {
+        Py_RETURN_NONE;
+    }
+
+    PyTime_t now;
+    if (PyTime_Monotonic(&now)) {
+        return NULL;
+    }
+
+    if (o->ttl == NULL) {
+        o->ttl = PyDict_New();
+        if (o->ttl == NULL) {
+            return NULL;
+        }
+    }
+
+    PyObject *deadline = PyLong_FromLongLong(now + (PyTime_t)(ttl_secs * 1e9));
+    if (deadline == NULL) {
+        return NULL;
+    }
+    int ret = PyDict_SetItem(o->ttl, key, deadline);
+    Py_DECREF(deadline);
+    if (ret) {
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+typedef struct {
+    PyObject *keys;
+    PyTime_t now;
+    // (key, deadline, removed) for the keys of the shard being swept
+    // that were still expired when the commit was built.
+    PyObject *expired;
+} TTLSweep;
+
+static int
+memhive_ttl_sweep_apply(MemHive *o, MemHiveShard *shard,
+                        PyObject *mut, void *arg)
+{
+    // Called again if the commit races with another write, and the
+    // GIL might have been released since the keys were collected: a
+    // key can have been set again since, with or without a new TTL,
+    // so its deadline is checked once more here.
+
+    TTLSweep *sweep = arg;
+    Py_XSETREF(sweep->expired, PyList_New(0));
+    if (sweep->expired == NULL) {
+        return -1;
+    }
+
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(sweep->keys); i++) {
+        PyObject *key = PyList_GET_ITEM(sweep->keys, i);
+        MemHiveShard *key_shard = memhive_shard_for(o, key);
+        if (key_shard == NULL) {
+            return -1;
+        }
+        if (key_shard != shard) {
+            continue;
+        }
+
+        PyObject *deadline;
+        int r = PyDict_GetItemRef(o->ttl, key, &deadline);
+        if (r <= 0) {
+            if (r < 0) {
+                return -1;
+            }
+            continue;
+        }
+        long long d = PyLong_AsLongLong(deadline);
+        if (d == -1 && PyErr_Occurred()) {
+            Py_DECREF(deadline);
+            return -1;
+        }
+        if (d > sweep->now) {
+            Py_DECREF(deadline);
+            continue;
+        }
+
+        int present = PySequence_Contains(mut, key);
+        if (present > 0 && PyObject_DelItem(mut, key)) {
+            present = -1;
+        }
+        if (present < 0) {
+            Py_DECREF(deadline);
+            return -1;
+        }
+
+        PyObject *entry = Py_BuildValue("(ONi)", key, deadline, present);
+        if (entry == NULL) {
+            return -1;
+        }
+        r = PyList_Append(sweep->expired, entry);
+        Py_DECREF(entry);
+        if (r) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+memhive_ttl_sweep_done(MemHive *o, TTLSweep *sweep, PyObject *removed)
+{
+    // The shard's commit is published: drop the swept keys' TTLs,
+    // unless they have been replaced in the meantime, and add the
+    // keys that were actually deleted to `removed`.
+
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(sweep->expired); i++) {
+        PyObject *key;
+        PyObject *deadline;
+        int present;
+        if (!PyArg_ParseTuple(PyList_GET_ITEM(sweep->expired, i), "OOi",
+                              &key, &deadline, &present))
+        {
+            return -1;
+        }
+
+        PyObject *cur;
+        int r = PyDict_GetItemRef(o->ttl, key, &cur);
+        if (r < 0) {
+            return -1;
+        }
+        Py_XDECREF(cur);
+        if (cur == deadline && PyDict_Pop(o->ttl, key, NULL) < 0) {
+            return -1;
+        }
+
+        if (present && PyList_Append(removed, key)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static PyObject *
+memhive_py_sweep_expired(MemHive *o, PyObject *args)
+{
+    // Remove all keys with expired TTLs in one index commit per shard.
+
+    if (o->ttl == NULL || PyDict_GET_SIZE(o->ttl) == 0) {
+        return PyLong_FromLong(0);
+    }
+
+    TTLSweep sweep = {NULL, 0, NULL};
+    PyObject *removed = NULL;
+
+    if (PyTime_Monotonic(&sweep.now)) {
+        return NULL;
+    }
+
+    sweep.keys = PyList_New(0);
+    if (sweep.keys == NULL) {
+        return NULL;
+    }
+
+    Py_ssize_t pos = 0;
+    PyObject *key;
+    PyObject *deadline;
+    while (PyDict_Next(o->ttl, &pos, &key, &deadline)) {
+        long long d = PyLong_AsLongLong(deadline);
+        if (d == -1 && PyErr_Occurred()) {
+            goto err;
+        }
+        if (d <= sweep.now && PyList_Append(sweep.keys, key)) {
+            goto err;
+        }
+    }
+
+    if (PyList_GET_SIZE(sweep.keys) == 0) {
+        Py_DECREF(sweep.keys);
+        return PyLong_FromLong(0);
+    }
+
+    removed = PyList_New(0);
+    if (removed == NULL) {
+        goto err;
+    }
+
+    for (Py_ssize_t i = 0; i < o->nshards; i++) {
+        MemHiveShard *shard = &o->shards[i];
+
+        int touched = 0;
+        for (Py_ssize_t j = 0; j < PyList_GET_SIZE(sweep.keys); j++) {
+            MemHiveShard *key_shard = memhive_shard_for(
+                o, PyList_GET_ITEM(sweep.keys, j));
+            if (key_shard == NULL) {
+                goto err;
+            }
+            if (key_shard == shard) {
+                touched = 1;
+                break;
+            }
+        }
+        if (!touched) {
+            continue;
+        }
+
+        if (memhive_index_mutate(o, shard, memhive_ttl_sweep_apply, &sweep)
+            || memhive_ttl_sweep_done(o, &sweep, removed))
+        {
+            goto err;
+        }
+    }
+
+    memhive_notify_watchers(o, PySequence_Fast_ITEMS(removed),
+                            PyList_GET_SIZE(removed));
+
+    Py_DECREF(sweep.keys);
+    Py_XDECREF(sweep.expired);
+    Py_ssize_t nremoved = PyList_GET_SIZE(removed);
+    Py_DECREF(removed);
+    return PyLong_FromSsize_t(nremoved);
+
+err:
+    Py_DECREF(sweep.keys);
+    Py_XDECREF(sweep.expired);
+    Py_XDECREF(removed);
+    return NULL;
+}
+
+static PyObject *
+memhive_py_memory_stats(MemHive *o, PyObject *args, PyObject *kwds)
+{
+    // Memory used by the current version of the index, summed over
+    // all shards. Nodes that are also part of `shared_with` (e.g. an
+    // older snapshot of the index) are reported in "shared_nodes".
+
+    static char *kwlist[] = {"deep", "shared_with", NULL};
+    int deep = 0;
+    PyObject *shared_with = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pO:memory_stats", kwlist,
+                                     &deep, &shared_with))
+    {
+        return NULL;
+    }
+    if (shared_with == Py_None) {
+        shared_with = NULL;
+    }
+
+    MapMemoryUsage usage = {0};
+    for (Py_ssize_t i = 0; i < o->nshards; i++) {
+        MemHiveShard *shard = &o->shards[i];
+        PyObject *index = memhive_shard_read_begin(o->mod_state, o, shard);
+        int r = MemHive_MapMemoryUsage(o->mod_state, index, deep,
+                                       shared_with, &usage);
+        memhive_shard_read_end(o->mod_state, o, shard, index);
+        if (r) {
+            return NULL;
+        }
+    }
+
+    PyObject *stats = MemHive_MapMemoryUsageAsDict(
+        &usage, shared_with != NULL);
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    PyObject *nshards = PyLong_FromSsize_t(o->nshards);
+    if (nshards == NULL || PyDict_SetItemString(stats, "shards", nshards)) {
+        Py_XDECREF(nshards);
+        Py_DECREF(stats);
+        return NULL;
+    }
+    Py_DECREF(nshards);
+    return stats;
+}
+
+static PyObject *
+memhive_py_index_version(MemHive *o, PyObject *args)
+{
+    uint64_t version = memhive_index_version(o);
+    return PyLong_FromUnsignedLongLong(version);
+}
+
+static PyObject *
+memhive_py_push(MemHive *o, PyObject *args)
+{
+    // Returns the message id; responses to it carry the same id.
+    // If the queue is bounded and full, waits up to `timeout` seconds
+    // (forever if None) for room and raises QueueFullError. Workers
+    // take messages of a higher `priority` first.
+    PyObject *val;
+    PyObject *timeout = NULL;
+    int priority = 0;
+    if (!PyArg_ParseTuple(args, "O|Oi:push", &val, &timeout, &priority)) {
+        return NULL;
+    }
+    if (MemHive_CheckPriority(priority)) {
+        return NULL;
+    }
+    int block;
+    struct timespec ts;
+    const struct timespec *deadline;
+    if (MemHive_ParseTimeout(timeout, &block, &ts, &deadline)) {
+        return NULL;
+    }
+
+    TRACK(o->mod_state, val);
+    uint64_t id = ++o->push_id_cnt;
+    int r = MemQueue_PutWait(&o->for_subs, o->mod_state, E_HUB_PUSH, 0,
+                             (PyObject*)o, id, val, priority,
+                             block, deadline);
+    if (r < 0) {
+        return NULL;
+    }
+    if (r == 1) {
+        PyErr_SetString(o->mod_state->QueueFullError,
+                        "can't push, the queue is full");
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(id);
+}
+
+static PyObject *
+memhive_py_push_to(MemHive *o, PyObject *args)
+{
+    // Like `push()`, but only the worker `sub_id` gets the message.
+    unsigned long long sub_id;
+    PyObject *val;
+    if (!PyArg_ParseTuple(args, "KO:push_to", &sub_id, &val)) {
+        return NULL;
     }
 
-    PyObject *val = MemHive_MapGetItem(state, hive->index, key, NULL);
+    ssize_t channel = -1;
+    uint64_t generation = 0;
+    pthread_mutex_lock(&o->subs_list_mut);
+    for (SubsList *l = o->subs_list; l != NULL; l = l->next) {
+        if (l->sub->sub_id == sub_id) {
+            channel = l->sub->channel;
+            generation = l->sub->channel_gen;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&o->subs_list_mut);
 
-    if (pthread_rwlock_unlock(&hive->index_rwlock)) {
-        Py_FatalError("Failed to release the MemHive index read lock");
+    if (channel < 0) {
+        PyErr_Format(PyExc_KeyError, "no worker %llu", sub_id);
+        return NULL;
     }
 
-    return val;
+    TRACK(o->mod_state, val);
+    uint64_t id = ++o->push_id_cnt;
+    // The worker might have exited since, and another one might have
+    // got its channel; the generation check keeps the message from
+    // reaching it. A retired worker's channel is closed and would
+    // drop the message, so that's an error too.
+    int r = MemQueue_PutTo(&o->for_subs, o->mod_state, E_HUB_PUSH, channel,
+                           generation, (PyObject*)o, id, val);
+    if (r < 0) {
+        return NULL;
+    }
+    if (r > 0) {
+        PyErr_Format(PyExc_KeyError, "no worker %llu", sub_id);
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(id);
 }
 
-MEMHIVE_REMOTE(int)
-MemHive_Contains(module_state *state, MemHive *hive, PyObject *key)
+static PyObject *
+memhive_py_push_many(MemHive *o, PyObject *args)
 {
-    if (pthread_rwlock_rdlock(&hive->index_rwlock)) {
-        Py_FatalError("Failed to acquire the MemHive index read lock");
+    // Pushes all of `vals` under one lock acquisition and returns
+    // the list of their message ids. `timeout` is like `push()`'s,
+    // for all of them. The messages pushed before it fails stay in
+    // the queue; their ids are in the `pushed` attribute of the
+    // exception.
+    PyObject *vals;
+    PyObject *timeout = NULL;
+    if (!PyArg_ParseTuple(args, "O|O:push_many", &vals, &timeout)) {
+        return NULL;
+    }
+    int block;
+    struct timespec ts;
+    const struct timespec *deadline;
+    if (MemHive_ParseTimeout(timeout, &block, &ts, &deadline)) {
+        return NULL;
     }
 
-    int ret = MemHive_MapContains(state, hive->index, key);
+    PyObject *seq = PySequence_Fast(vals, "push_many() expects an iterable");
+    if (seq == NULL) {
+        return NULL;
+    }
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        TRACK(o->mod_state, items[i]);
+    }
 
-    if (pthread_rwlock_unlock(&hive->index_rwlock)) {
-        Py_FatalError("Failed to release the MemHive index read lock");
+    PyObject *ids = PyList_New(n);
+    if (ids == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+    uint64_t first_id = o->push_id_cnt + 1;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *id = PyLong_FromUnsignedLongLong(first_id + (uint64_t)i);
+        if (id == NULL) {
+            Py_DECREF(ids);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        PyList_SET_ITEM(ids, i, id);
     }
 
-    return ret;
-}
+    o->push_id_cnt += (uint64_t)n;
+    ssize_t nput;
+    int r = MemQueue_PutMany(&o->for_subs, o->mod_state, E_HUB_PUSH, 0,
+                             (PyObject*)o, first_id, items, n,
+                             block, deadline, &nput);
+    Py_DECREF(seq);
+    if (r == 0) {
+        return ids;
+    }
 
-static PyObject *
-memhive_py_push(MemHive *o, PyObject *val)
-{
-    TRACK(o->mod_state, val);
-    if (MemQueue_HubPush(&o->for_subs, o->mod_state, 0, (PyObject*)o,
-                         ++o->push_id_cnt, val))
+    // Give back the ids of the messages that weren't pushed, unless
+    // someone else has pushed while we were waiting for room.
+    if (o->push_id_cnt == first_id + (uint64_t)n - 1) {
+        o->push_id_cnt = first_id + (uint64_t)nput - 1;
+    }
+    if (r == 1) {
+        PyErr_SetString(o->mod_state->QueueFullError,
+                        "can't push, the queue is full");
+    }
+    PyObject *exc = PyErr_GetRaisedException();
+    if (PyList_SetSlice(ids, nput, n, NULL)
+        || PyObject_SetAttrString(exc, "pushed", ids))
     {
-        return NULL;
+        // Still better than losing the original error.
+        PyErr_Clear();
     }
-    Py_RETURN_NONE;
+    PyErr_SetRaisedException(exc);
+    Py_DECREF(ids);
+    return NULL;
 }
 
 static PyObject *
@@ -380,40 +1969,48 @@ memhive_py_listen_subs_health(MemHive *o, PyObject *args)
             return ret;
         }
 
+        case E_HEALTH_LOST: {
+            PyObject *sub_id = PyLong_FromUnsignedLongLong(id);
+            if (sub_id == NULL) {
+                return NULL;
+            }
+
+            PyObject *ret = PyTuple_Pack(
+                2, o->mod_state->str_LOST, sub_id
+            );
+            Py_DECREF(sub_id);
+            return ret;
+        }
+
+        case E_HEALTH_SCALE:
+            // Posted by the main interpreter itself, so the tuple is
+            // ours; take over the reference the queue was holding.
+            assert(sender == (RemoteObject *)o);
+            return (PyObject *)remote_val;
+
         default:
             Py_UNREACHABLE();
     }
 }
 
 static PyObject *
-memhive_py_listen(MemHive *o, PyObject *args)
+memhive_make_message(MemHive *o, MemQueueItem *item)
 {
-    memqueue_event_t event;
-    RemoteObject *sender;
-    RemoteObject *remote_val;
-    uint64_t id;
-
-    if (MemQueue_Listen(&o->for_main, o->mod_state, 0,
-                        &event, &sender, &id, &remote_val))
-    {
-        return NULL;
-    }
-
-
     PyObject *ret = NULL;
 
-    PyObject *payload = MemHive_CopyObject(o->mod_state, remote_val);
+    PyObject *payload = MemHive_CopyObject(o->mod_state, item->val);
     if (payload == NULL) {
         goto err;
     }
 
-    MemHiveSub *sub = (MemHiveSub*)sender;
+    MemHiveSub *sub = (MemHiveSub*)item->sender;
+    uint64_t id = item->id;
 
-    if (MemHive_RefQueue_Dec(sub->subs_refs, remote_val)) {
+    if (MemHive_RefQueue_Dec(sub->subs_refs, item->val)) {
         goto err;
     }
 
-    switch (event) {
+    switch (item->event) {
         case E_HUB_REQUEST:
             ret = MemQueueRequest_New(
                 o->mod_state,
@@ -429,6 +2026,13 @@ memhive_py_listen(MemHive *o, PyObject *args)
             goto done;
 
         case E_HUB_PUSH:
+            // A worker responding to a pushed message.
+            ret = MemQueueResponse_New(o->mod_state, payload, NULL, id);
+            if (ret == NULL) {
+                goto err;
+            }
+            goto done;
+
         case E_HUB_BROADCAST:
             PyErr_SetString(
                 PyExc_RuntimeError,
@@ -450,6 +2054,77 @@ err:
     return NULL;
 }
 
+static PyObject *
+memhive_listen(MemHive *o, int block, const struct timespec *deadline)
+{
+    // Returns None if there's no message and `block` is 0 or
+    // `deadline` has passed.
+
+    MemQueueItem item;
+    ssize_t n = MemQueue_ListenMany(&o->for_main, o->mod_state, 0,
+                                    block, deadline, &item, 1);
+    if (n < 0) {
+        return NULL;
+    }
+    if (n == 0) {
+        Py_RETURN_NONE;
+    }
+    return memhive_make_message(o, &item);
+}
+
+static PyObject *
+memhive_py_listen(MemHive *o, PyObject *args)
+{
+    PyObject *timeout = NULL;
+    if (!PyArg_ParseTuple(args, "|O:listen", &timeout)) {
+        return NULL;
+    }
+    int block;
+    struct timespec ts;
+    const struct timespec *deadline;
+    if (MemHive_ParseTimeout(timeout, &block, &ts, &deadline)) {
+        return NULL;
+    }
+    return memhive_listen(o, block, deadline);
+}
+
+static PyObject *
+memhive_py_try_listen(MemHive *o, PyObject *args)
+{
+    return memhive_listen(o, 0, NULL);
+}
+
+static PyObject *
+memhive_py_listen_many(MemHive *o, PyObject *args)
+{
+    // Up to `max_items` messages; waits for the first one for up to
+    // `timeout` seconds (forever if None). Can return an empty list.
+    Py_ssize_t max_items;
+    PyObject *timeout = NULL;
+    if (!PyArg_ParseTuple(args, "n|O:listen_many", &max_items, &timeout)) {
+        return NULL;
+    }
+    int block;
+    struct timespec ts;
+    const struct timespec *deadline;
+    if (MemHive_ParseTimeout(timeout, &block, &ts, &deadline)) {
+        return NULL;
+    }
+    return MemHive_ListenMany(o->mod_state, (PyObject *)o, &o->for_main, 0,
+                              max_items, block, deadline,
+                              (MemHive_MessageFunc)memhive_make_message);
+}
+
+static PyObject *
+memhive_py_readiness_fd(MemHive *o, PyObject *args)
+{
+    int fd = MemQueue_ReadinessFd(&o->for_main, o->mod_state, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    return PyLong_FromLong(fd);
+}
+
 static PyObject *
 memhive_py_close_subs_health_queue(MemHive *o, PyObject *args)
 {
@@ -487,11 +2162,339 @@ memhive_py_do_refs(MemHive *o, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *
+memhive_py_report_scaling(MemHive *o, PyObject *args)
+{
+    PyObject *action, *sub_id, *depth, *load;
+    if (!PyArg_UnpackTuple(args, "report_scaling", 4, 4,
+                           &action, &sub_id, &depth, &load))
+    {
+        return NULL;
+    }
+    PyObject *event = PyTuple_Pack(
+        5, o->mod_state->str_SCALE, action, sub_id, depth, load);
+    if (event == NULL) {
+        return NULL;
+    }
+    int ret = MemQueue_Put(&o->subs_health, o->mod_state, E_HEALTH_SCALE,
+                           0, (PyObject *)o, 0, event);
+    Py_DECREF(event);
+    if (ret) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_py_queue_stats(MemHive *o, PyObject *args)
+{
+    // Depth, capacity and how many times pushing found the queue full.
+    MemQueueStats stats;
+    if (MemQueue_Stats(&o->for_subs, o->mod_state, 0, &stats)) {
+        return NULL;
+    }
+    return Py_BuildValue("{s:n,s:n,s:K}",
+                         "depth", stats.depth,
+                         "capacity", stats.capacity,
+                         "full", (unsigned long long)stats.nfull);
+}
+
+static PyObject *
+memhive_py_subs_queue_depth(MemHive *o, PyObject *args)
+{
+    // Number of pushed messages no worker has picked up yet.
+    ssize_t depth = MemQueue_Depth(&o->for_subs, o->mod_state, 0);
+    if (depth < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(depth);
+}
+
+static PyObject *
+memhive_py_intake_depths(MemHive *o, PyObject *args)
+{
+    // {sub_id: number of its requests and responses main hasn't
+    // listened to yet}.
+    //
+    // The channels are copied out first: MemQueue_Depth() takes the
+    // queue lock, which might be held by a thread waiting for
+    // `subs_list_mut`, and allocating can run a GC whose finalizers
+    // might need `subs_list_mut` themselves.
+    uint64_t sub_ids[MEMHIVE_MAX_WORKERS];
+    ssize_t channels[MEMHIVE_MAX_WORKERS];
+    ssize_t n = 0;
+
+    pthread_mutex_lock(&o->subs_list_mut);
+    for (SubsList *l = o->subs_list; l != NULL; l = l->next) {
+        assert(n < MEMHIVE_MAX_WORKERS);
+        sub_ids[n] = l->sub->sub_id;
+        channels[n] = l->sub->main_channel;
+        n++;
+    }
+    pthread_mutex_unlock(&o->subs_list_mut);
+
+    PyObject *ret = PyDict_New();
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+        ssize_t depth = MemQueue_Depth(&o->for_main, o->mod_state,
+                                       channels[i]);
+        if (depth < 0) {
+            goto err;
+        }
+        PyObject *key = PyLong_FromUnsignedLongLong(sub_ids[i]);
+        if (key == NULL) {
+            goto err;
+        }
+        PyObject *val = PyLong_FromSsize_t(depth);
+        if (val == NULL) {
+            Py_DECREF(key);
+            goto err;
+        }
+        int r = PyDict_SetItem(ret, key, val);
+        Py_DECREF(key);
+        Py_DECREF(val);
+        if (r) {
+            goto err;
+        }
+    }
+    return ret;
+
+err:
+    Py_DECREF(ret);
+    return NULL;
+}
+
+static PyObject *
+memhive_py_retire_worker(MemHive *o, PyObject *args)
+{
+    // The worker gets ClosedQueueError from `listen()` once it has
+    // consumed the messages sent to it directly.
+    unsigned long long sub_id;
+    if (!PyArg_ParseTuple(args, "K:retire_worker", &sub_id)) {
+        return NULL;
+    }
+
+    ssize_t channel = -1;
+    pthread_mutex_lock(&o->subs_list_mut);
+    for (SubsList *l = o->subs_list; l != NULL; l = l->next) {
+        if (l->sub->sub_id == sub_id) {
+            channel = l->sub->channel;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&o->subs_list_mut);
+
+    if (channel < 0) {
+        PyErr_Format(PyExc_KeyError, "no worker %llu", sub_id);
+        return NULL;
+    }
+    if (MemQueue_CloseChannel(&o->for_subs, o->mod_state, channel)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_py_worker_load(MemHive *o, PyObject *args)
+{
+    // {sub_id: (lifetime, time spent waiting for messages)}, both
+    // in nanoseconds.
+    PyTime_t now;
+    if (PyTime_MonotonicRaw(&now)) {
+        return NULL;
+    }
+
+    // Like in `intake_depths()`, nothing is allocated under
+    // `subs_list_mut`.
+    uint64_t sub_ids[MEMHIVE_MAX_WORKERS];
+    int64_t lifetimes[MEMHIVE_MAX_WORKERS];
+    int64_t idles[MEMHIVE_MAX_WORKERS];
+    ssize_t n = 0;
+
+    pthread_mutex_lock(&o->subs_list_mut);
+    for (SubsList *l = o->subs_list; l != NULL; l = l->next) {
+        MemHiveSub *sub = l->sub;
+        PyTime_t since = atomic_load_explicit(&sub->listening_since,
+                                              memory_order_relaxed);
+        int64_t idle = atomic_load_explicit(&sub->idle_ns,
+                                            memory_order_relaxed);
+        if (since > 0) {
+            idle += now - since;
+        }
+        assert(n < MEMHIVE_MAX_WORKERS);
+        sub_ids[n] = sub->sub_id;
+        lifetimes[n] = now - sub->created;
+        idles[n] = idle;
+        n++;
+    }
+    pthread_mutex_unlock(&o->subs_list_mut);
+
+    PyObject *ret = PyDict_New();
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+        PyObject *key = PyLong_FromUnsignedLongLong(sub_ids[i]);
+        PyObject *val = Py_BuildValue("(LL)", lifetimes[i], idles[i]);
+        if (key == NULL || val == NULL || PyDict_SetItem(ret, key, val)) {
+            Py_XDECREF(key);
+            Py_XDECREF(val);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        Py_DECREF(key);
+        Py_DECREF(val);
+    }
+
+    return ret;
+}
+
+static PyObject *
+memhive_py_init_workers(MemHive *o, PyObject *args)
+{
+    Py_ssize_t size;
+    Py_ssize_t dispatch_threads;
+    Py_buffer bootstrap;
+    Py_buffer env;
+
+    if (!PyArg_ParseTuple(args, "nny*y*:init_workers",
+                          &size, &dispatch_threads, &bootstrap, &env))
+    {
+        return NULL;
+    }
+
+    int ret = MemHivePool_Configure(
+        &o->pool, size, dispatch_threads,
+        bootstrap.buf, bootstrap.len, env.buf, env.len);
+    PyBuffer_Release(&bootstrap);
+    PyBuffer_Release(&env);
+    if (ret) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_py_fill_pool(MemHive *o, PyObject *args)
+{
+    if (MemHivePool_Fill(&o->pool)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_py_acquire_worker(MemHive *o, PyObject *args)
+{
+    int64_t sub_id = MemHivePool_Acquire(&o->pool);
+    if (sub_id < 0) {
+        return NULL;
+    }
+    return PyLong_FromLongLong(sub_id);
+}
+
+static PyObject *
+memhive_py_run_worker(MemHive *o, PyObject *args)
+{
+    unsigned long long sub_id;
+    Py_buffer payload;
+    int cpu = -1;
+
+    if (!PyArg_ParseTuple(args, "Ky*|i:run_worker",
+                          &sub_id, &payload, &cpu))
+    {
+        return NULL;
+    }
+
+    int ret = MemHivePool_Run(
+        &o->pool, sub_id, payload.buf, payload.len, cpu);
+    PyBuffer_Release(&payload);
+    if (ret) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_py_acquire_handler(MemHive *o, PyObject *args)
+{
+    int64_t sub_id = MemHivePool_AcquireHandler(&o->pool);
+    if (sub_id < 0) {
+        return NULL;
+    }
+    return PyLong_FromLongLong(sub_id);
+}
+
+static PyObject *
+memhive_py_run_handler(MemHive *o, PyObject *args)
+{
+    // An `exclusive` worker only gets messages sent to it, see
+    // MemQueue_AddChannel().
+    unsigned long long sub_id;
+    Py_buffer payload;
+    int exclusive = 0;
+
+    if (!PyArg_ParseTuple(args, "Ky*|p:run_handler",
+                          &sub_id, &payload, &exclusive))
+    {
+        return NULL;
+    }
+
+    int ret = MemHivePool_RunHandler(
+        &o->pool, sub_id, payload.buf, payload.len, exclusive);
+    PyBuffer_Release(&payload);
+    if (ret) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_py_pool_stats(MemHive *o, PyObject *args)
+{
+    MemHivePoolStats stats;
+    MemHivePool_Stats(&o->pool, &stats);
+    return Py_BuildValue(
+        "{snsnsnsn}",
+        "threads", stats.nthreads,
+        "idle", stats.nidle,
+        "dispatch_threads", stats.ndispatchers,
+        "handlers", stats.nhandlers);
+}
+
+static PyObject *
+memhive_py_close_pool(MemHive *o, PyObject *args)
+{
+    Py_BEGIN_ALLOW_THREADS
+    MemHivePool_Close(&o->pool);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_py_join_worker_threads(MemHive *o, PyObject *args)
+{
+    Py_BEGIN_ALLOW_THREADS
+    MemHivePool_Join(&o->pool);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
 
 static PyMethodDef MemHive_methods[] = {
     {"broadcast", (PyCFunction)memhive_py_broadcast, METH_O, NULL},
-    {"push", (PyCFunction)memhive_py_push, METH_O, NULL},
-    {"listen", (PyCFunction)memhive_py_listen, METH_NOARGS, NULL},
+    {"push", (PyCFunction)memhive_py_push, METH_VARARGS, NULL},
+    {"push_to", (PyCFunction)memhive_py_push_to, METH_VARARGS, NULL},
+    {"push_many", (PyCFunction)memhive_py_push_many, METH_VARARGS, NULL},
+    {"listen", (PyCFunction)memhive_py_listen, METH_VARARGS, NULL},
+    {"try_listen", (PyCFunction)memhive_py_try_listen, METH_NOARGS, NULL},
+    {"listen_many", (PyCFunction)memhive_py_listen_many, METH_VARARGS, NULL},
+    {"readiness_fd", (PyCFunction)memhive_py_readiness_fd,
+        METH_NOARGS, NULL},
     {"listen_subs_health", (PyCFunction)memhive_py_listen_subs_health,
         METH_NOARGS, NULL},
     {"close_subs_queue", (PyCFunction)memhive_py_close_subs_queue,
@@ -500,6 +2503,41 @@ static PyMethodDef MemHive_methods[] = {
         METH_NOARGS, NULL},
     {"close", (PyCFunction)memhive_py_close, METH_NOARGS, NULL},
     {"process_refs", (PyCFunction)memhive_py_do_refs, METH_NOARGS, NULL},
+    {"index_version", (PyCFunction)memhive_py_index_version,
+        METH_NOARGS, NULL},
+    {"cas", (PyCFunction)memhive_py_cas, METH_VARARGS, NULL},
+    {"setdefault", (PyCFunction)memhive_py_setdefault, METH_VARARGS, NULL},
+    {"update_key", (PyCFunction)memhive_py_update_key, METH_VARARGS, NULL},
+    {"pop", (PyCFunction)memhive_py_pop, METH_VARARGS, NULL},
+    {"set", (PyCFunction)memhive_py_set, METH_VARARGS, NULL},
+    {"sweep_expired", (PyCFunction)memhive_py_sweep_expired,
+        METH_NOARGS, NULL},
+    {"snapshot", (PyCFunction)memhive_py_snapshot, METH_NOARGS, NULL},
+    {"memory_stats", (PyCFunction)memhive_py_memory_stats,
+        METH_VARARGS | METH_KEYWORDS, NULL},
+    {"init_workers", (PyCFunction)memhive_py_init_workers,
+        METH_VARARGS, NULL},
+    {"fill_pool", (PyCFunction)memhive_py_fill_pool, METH_NOARGS, NULL},
+    {"acquire_worker", (PyCFunction)memhive_py_acquire_worker,
+        METH_NOARGS, NULL},
+    {"run_worker", (PyCFunction)memhive_py_run_worker, METH_VARARGS, NULL},
+    {"acquire_handler", (PyCFunction)memhive_py_acquire_handler,
+        METH_NOARGS, NULL},
+    {"run_handler", (PyCFunction)memhive_py_run_handler, METH_VARARGS, NULL},
+    {"pool_stats", (PyCFunction)memhive_py_pool_stats, METH_NOARGS, NULL},
+    {"close_pool", (PyCFunction)memhive_py_close_pool, METH_NOARGS, NULL},
+    {"report_scaling", (PyCFunction)memhive_py_report_scaling,
+        METH_VARARGS, NULL},
+    {"queue_stats", (PyCFunction)memhive_py_queue_stats, METH_NOARGS, NULL},
+    {"subs_queue_depth", (PyCFunction)memhive_py_subs_queue_depth,
+        METH_NOARGS, NULL},
+    {"intake_depths", (PyCFunction)memhive_py_intake_depths,
+        METH_NOARGS, NULL},
+    {"retire_worker", (PyCFunction)memhive_py_retire_worker,
+        METH_VARARGS, NULL},
+    {"worker_load", (PyCFunction)memhive_py_worker_load, METH_NOARGS, NULL},
+    {"join_worker_threads", (PyCFunction)memhive_py_join_worker_threads,
+        METH_NOARGS, NULL},
     {NULL, NULL}
 };
 
@@ -510,6 +2548,7 @@ PyType_Slot MemHive_TypeSlots[] = {
     {Py_mp_subscript, (binaryfunc)memhive_tp_subscript},
     {Py_mp_ass_subscript, (objobjargproc)memhive_tp_ass_sub},
     {Py_sq_contains, (objobjproc)memhive_tp_contains},
+    {Py_tp_iter, (getiterfunc)memhive_tp_iter},
     {Py_tp_init, (initproc)memhive_tp_init},
     {Py_tp_dealloc, (destructor)memhive_tp_dealloc},
     {0, NULL},
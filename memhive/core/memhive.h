@@ -6,6 +6,7 @@
 #error "This header file requires C11"
 #endif
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <pthread.h>
 
@@ -17,6 +18,7 @@
 #include "utils.h"
 #include "queue.h"
 #include "refqueue.h"
+#include "pool.h"
 #include "debug.h"
 
 
@@ -41,18 +43,43 @@
 #define MEMHIVE_IS_VALID_KEY(op)    PyUnicode_Check(op)
 
 
+// A worker's local copy of one shard of the index.
+typedef struct {
+    // The version of the shard's index the copy was made from; we
+    // hold a (remote) reference to it to diff the next version against.
+    RemoteObject *seen;
+    PyObject *copy;
+    uint64_t version;
+} MemHiveReplica;
+
+
 typedef struct {
     PyObject_HEAD
 
     RemoteObject *hive;
     uint64_t sub_id;
     ssize_t channel;
+    uint64_t channel_gen;   // see MemQueue_ChannelGeneration()
+    ssize_t main_channel;   // its intake channel in `for_main`
+    uint8_t exclusive;      // gets no push() messages
+
+    // Local replica of the index, one per shard; NULL unless enabled.
+    MemHiveReplica *replica;
+    int64_t replica_staleness;      // in nanoseconds
+    PyTime_t replica_synced;
 
     RefQueue *main_refs;
     RefQueue *subs_refs;
 
     uint64_t req_id_cnt;
 
+    // Time spent blocked in `listen()`, read by the main interpreter
+    // (with relaxed atomics, so only approximately) to tell how busy
+    // the worker is.
+    PyTime_t created;
+    _Atomic PyTime_t listening_since;   // 0 if not listening
+    _Atomic int64_t idle_ns;
+
     uint8_t closed;
 } MemHiveSub;
 
@@ -63,14 +90,67 @@ typedef struct sl {
 } SubsList;
 
 
+// A key (or a key prefix) a worker watches for changes. Stored UTF-8
+// encoded in raw memory, as watches are registered by workers and
+// matched by the main interpreter.
+typedef struct watch {
+    ssize_t channel;
+    uint64_t generation;    // the watching sub's `channel_gen`
+    uint8_t is_prefix;
+    struct watch *next;
+    Py_ssize_t len;
+    char key[];
+} MemHiveWatch;
+
+
+// Upper limit on the number of independently locked parts of the index.
+#define MEMHIVE_MAX_SHARDS 256
+
+
+// One independently locked part of the index. Keys are assigned to
+// shards by their hash; with a single shard this is the whole index.
+typedef struct {
+    pthread_rwlock_t rwlock;
+    PyObject *index;
+
+    // Incremented every time `index` is swapped (under the write lock).
+    uint64_t version;
+} MemHiveShard;
+
+
+// A pending write waiting for a group commit. Writers allocate these
+// on their own stacks and park until the commit leader publishes them.
+typedef struct gcw {
+    PyObject *key;
+    PyObject *val;
+    MemHiveShard *shard;
+    struct gcw *next;
+    int status;     // 0 - pending, 1 - committed, -1 - failed
+    PyObject *error;    // the write's own exception if it failed
+} GroupCommitWrite;
+
+
 typedef struct {
     PyObject_HEAD
 
     module_state *mod_state;
 
-    pthread_rwlock_t index_rwlock;
+    MemHiveShard *shards;
+    Py_ssize_t nshards;
 
-    PyObject *index;
+    // A dict of {key: deadline} for keys set with a TTL, deadlines
+    // are in monotonic clock nanoseconds. Main interpreter only.
+    PyObject *ttl;
+
+    // Group commit state. Only main interpreter threads write to
+    // the index, so the list of pending writes is guarded by the GIL;
+    // `gc_mut` and `gc_cond` are only used to park the writers.
+    int64_t gc_window;      // in nanoseconds; -1 if disabled
+    GroupCommitWrite *gc_first;
+    GroupCommitWrite *gc_last;
+    uint8_t gc_leading;
+    pthread_mutex_t gc_mut;
+    pthread_cond_t gc_cond;
 
     MemQueue subs_health;
     MemQueue for_subs;
@@ -79,7 +159,13 @@ typedef struct {
     SubsList *subs_list;
     pthread_mutex_t subs_list_mut;
 
+    MemHiveWatch *watches;
+    pthread_mutex_t watches_mut;
+
     uint64_t push_id_cnt;
+
+    // Native threads hosting the worker interpreters.
+    MemHivePool pool;
 } MemHive;
 
 extern PyType_Spec MemHive_TypeSpec;
@@ -94,11 +180,11 @@ _map_node_bitmap_new(module_state *state, Py_ssize_t size, uint64_t mutid);
 // MemHive objects API, every method is safe to call from
 // subinterpeters.
 
-Py_ssize_t MemHive_Len(
-    MemHive *hive);
+Py_ssize_t MemHive_Len(module_state *state, MemHive *hive);
 
 PyObject * MemHive_Get(module_state *state, MemHive *hive, PyObject *key);
 int MemHive_Contains(module_state *state, MemHive *hive, PyObject *key);
+PyObject * MemHive_Snapshot(module_state *state, MemHive *hive);
 
 ssize_t
 MemHive_RegisterSub(MemHive *hive, MemHiveSub *sub, module_state *state);
@@ -106,4 +192,16 @@ MemHive_RegisterSub(MemHive *hive, MemHiveSub *sub, module_state *state);
 void
 MemHive_UnregisterSub(MemHive *hive, MemHiveSub *sub);
 
+int
+MemHive_Watch(MemHive *hive, MemHiveSub *sub,
+              const char *key, Py_ssize_t len, int is_prefix);
+
+Py_ssize_t MemHive_ShardIndex(MemHive *hive, PyObject *key);
+
+int
+MemHive_SyncReplica(module_state *state, MemHive *hive, MemHiveSub *sub);
+
+void
+MemHive_ClearReplica(MemHive *hive, MemHiveSub *sub);
+
 #endif
@@ -91,6 +91,7 @@ module_clear(PyObject *mod)
     module_state *state = PyModule_GetState(mod);
 
     Py_CLEAR(state->ClosedQueueError);
+    Py_CLEAR(state->QueueFullError);
 
     Py_CLEAR(state->MemHive_Type);
     Py_CLEAR(state->MemHiveSub_Type);
@@ -113,6 +114,7 @@ module_clear(PyObject *mod)
     Py_CLEAR(state->MemQueueRequestType);
     Py_CLEAR(state->MemQueueResponseType);
     Py_CLEAR(state->MemQueueBroadcastType);
+    Py_CLEAR(state->MemQueueWatchType);
 
     Py_CLEAR(state->sub);
 
@@ -123,6 +125,8 @@ module_clear(PyObject *mod)
     Py_CLEAR(state->str_ERROR);
     Py_CLEAR(state->str_START);
     Py_CLEAR(state->str_CLOSE);
+    Py_CLEAR(state->str_SCALE);
+    Py_CLEAR(state->str_LOST);
 
     #ifdef DEBUG
     Py_CLEAR(state->debug_objects_ids);
@@ -147,6 +151,7 @@ module_traverse(PyObject *mod, visitproc visit, void *arg)
     module_state *state = MemHive_GetModuleState(mod);
 
     Py_VISIT(state->ClosedQueueError);
+    Py_VISIT(state->QueueFullError);
 
     Py_VISIT(state->MemHive_Type);
     Py_VISIT(state->MemHiveSub_Type);
@@ -169,6 +174,7 @@ module_traverse(PyObject *mod, visitproc visit, void *arg)
     Py_VISIT(state->MemQueueRequestType);
     Py_VISIT(state->MemQueueResponseType);
     Py_VISIT(state->MemQueueBroadcastType);
+    Py_VISIT(state->MemQueueWatchType);
 
     Py_VISIT(state->sub);
 
@@ -179,6 +185,8 @@ module_traverse(PyObject *mod, visitproc visit, void *arg)
     Py_VISIT(state->str_ERROR);
     Py_VISIT(state->str_START);
     Py_VISIT(state->str_CLOSE);
+    Py_VISIT(state->str_SCALE);
+    Py_VISIT(state->str_LOST);
 
     #ifdef DEBUG
     Py_VISIT(state->debug_objects_ids);
@@ -256,6 +264,7 @@ module_exec(PyObject *m)
     } while (0)
 
     CREATE_EXC(m, state->ClosedQueueError, "ClosedQueueError", PyExc_Exception, 1);
+    CREATE_EXC(m, state->QueueFullError, "QueueFullError", PyExc_Exception, 1);
 
     CREATE_TYPE(m, state->MemHive_Type, &MemHive_TypeSpec, NULL, 1);
     CREATE_TYPE(m, state->MemHiveSub_Type, &MemHiveSub_TypeSpec, NULL, 1);
@@ -276,11 +285,13 @@ module_exec(PyObject *m)
     CREATE_TYPE(m, state->MapItemsIterType, &MapItemsIter_TypeSpec, NULL, 0);
 
     CREATE_TYPE(m, state->MemQueueRequestType,
-                &MemQueueRequest_TypeSpec, NULL, 0);
+                &MemQueueRequest_TypeSpec, NULL, 1);
     CREATE_TYPE(m, state->MemQueueResponseType,
-                &MemQueueResponse_TypeSpec, NULL, 0);
+                &MemQueueResponse_TypeSpec, NULL, 1);
     CREATE_TYPE(m, state->MemQueueBroadcastType,
-                &MemQueueBroadcast_TypeSpec, NULL, 0);
+                &MemQueueBroadcast_TypeSpec, NULL, 1);
+    CREATE_TYPE(m, state->MemQueueWatchType,
+                &MemQueueWatch_TypeSpec, NULL, 0);
 
     state->str_ERROR = PyUnicode_FromString("ERROR");
     if (state->str_ERROR == NULL) {
@@ -294,6 +305,14 @@ module_exec(PyObject *m)
     if (state->str_CLOSE == NULL) {
         return -1;
     }
+    state->str_SCALE = PyUnicode_FromString("SCALE");
+    if (state->str_SCALE == NULL) {
+        return -1;
+    }
+    state->str_LOST = PyUnicode_FromString("LOST");
+    if (state->str_LOST == NULL) {
+        return -1;
+    }
 
     PyInterpreterState *interp = PyInterpreterState_Get();
     assert(interp != NULL);
@@ -16,6 +16,7 @@ typedef struct {
     int64_t interpreter_id;
 
     PyObject *ClosedQueueError;
+    PyObject *QueueFullError;
 
     PyTypeObject *MapType;
     PyTypeObject *MapMutationType;
@@ -37,6 +38,7 @@ typedef struct {
     PyTypeObject *MemQueueRequestType;
     PyTypeObject *MemQueueResponseType;
     PyTypeObject *MemQueueBroadcastType;
+    PyTypeObject *MemQueueWatchType;
 
     PyObject *exc_frames_cache;
     PyObject *exc_types_cache;
@@ -45,6 +47,8 @@ typedef struct {
     PyObject *str_START;
     PyObject *str_ERROR;
     PyObject *str_CLOSE;
+    PyObject *str_SCALE;
+    PyObject *str_LOST;
 
     struct ProxyDescriptor *proxy_desc_template;
 
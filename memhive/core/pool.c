@@ -0,0 +1,1069 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1   // for pthread_setaffinity_np()
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "memhive.h"
+#include "pool.h"
+
+
+// Messages a handler worker gets to take in a row before the other
+// workers of its dispatch thread get their turn.
+#define POOL_DISPATCH_BATCH 16
+
+struct pool_thread {
+    pthread_t thread;
+    MemHivePool *pool;
+
+    // Signaled when the thread is given a `main()` or asked to stop.
+    pthread_cond_t cond;
+
+    uint64_t sub_id;
+
+    char *payload;
+    Py_ssize_t payload_len;
+    int cpu;
+
+#ifdef __linux__
+    // The affinity the thread started with, restored for unpinned
+    // workers as threads are reused.
+    cpu_set_t default_cpus;
+    int pinned;
+#endif
+
+    // The thread is counted in `pool->nstarting` until it's idle.
+    uint8_t pooled;
+    uint8_t has_job;
+    uint8_t stop;
+    // Exited without getting to a `main()` it was acquired for.
+    uint8_t dead;
+
+    MemHivePoolThread *next;
+    MemHivePoolThread *next_idle;
+};
+
+// A worker with a `handler()`, hosted by a dispatch thread.
+typedef struct pool_handler {
+    uint64_t sub_id;
+    char *payload;
+    Py_ssize_t payload_len;
+    uint8_t exclusive;
+
+    PyThreadState *tstate;
+    PyThreadState *work_tstate;
+    PyObject *dispatch_fn;
+    ssize_t channel;
+
+    struct pool_handler *next;
+} PoolHandler;
+
+struct pool_dispatcher {
+    pthread_t thread;
+    MemHivePool *pool;
+
+    MemQueueWaiter waiter;
+
+    // Guarded by `pool->mut`: the handlers given to the thread and not
+    // started yet, and how many it has, started or not.
+    PoolHandler *starting;
+    Py_ssize_t nhandlers;
+    uint8_t exited;
+
+    // Owned by the thread: the running handlers, and their channels
+    // for MemQueue_WaitAny(). A hive can't have more.
+    PoolHandler *handlers[MEMHIVE_MAX_WORKERS];
+    ssize_t channels[MEMHIVE_MAX_WORKERS];
+    ssize_t nrunning;
+
+    MemHivePoolDispatcher *next;
+};
+
+
+static char *
+pool_copy(const char *buf, Py_ssize_t len)
+{
+    char *copy = PyMem_RawMalloc((size_t)len + 1);
+    if (copy == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memcpy(copy, buf, (size_t)len);
+    return copy;
+}
+
+static void
+pool_print_error(MemHivePool *pool)
+{
+    // The hive might have been closed while the thread was getting
+    // ready for the next worker; that's not an error.
+    if (pool->closing || PyErr_ExceptionMatches(PyExc_SystemExit)) {
+        PyErr_Clear();
+        return;
+    }
+    PyErr_Print();
+}
+
+static int
+pool_set_bytes(PyObject *globals, const char *name,
+               const char *buf, Py_ssize_t len)
+{
+    PyObject *val = PyBytes_FromStringAndSize(buf, len);
+    if (val == NULL) {
+        return -1;
+    }
+    int ret = PyDict_SetItemString(globals, name, val);
+    Py_DECREF(val);
+    return ret;
+}
+
+static PyObject *
+pool_get_func(PyObject *globals, const char *name)
+{
+    PyObject *func = PyDict_GetItemString(globals, name);
+    if (func == NULL) {
+        PyErr_Format(PyExc_RuntimeError,
+                     "worker bootstrap didn't define %s()", name);
+        return NULL;
+    }
+    return Py_NewRef(func);
+}
+
+static void
+pool_thread_set_affinity(MemHivePoolThread *t, int cpu)
+{
+#ifdef __linux__
+    int err = 0;
+
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET((size_t)cpu, &cpus);
+        err = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+        if (!err) {
+            t->pinned = 1;
+        }
+    } else if (t->pinned) {
+        err = pthread_setaffinity_np(
+            pthread_self(), sizeof t->default_cpus, &t->default_cpus);
+        if (!err) {
+            t->pinned = 0;
+        }
+    }
+
+    if (err) {
+        // Not fatal; the worker just runs wherever the OS puts it.
+        errno = err;
+        PyErr_SetFromErrno(PyExc_OSError);
+        PyErr_WriteUnraisable(NULL);
+    }
+#else
+    (void)t;
+    (void)cpu;
+#endif
+}
+
+// Returns 1 if the thread got a `main()` to run, 0 if it has to stop.
+static int
+pool_thread_wait(MemHivePoolThread *t, char **payload, Py_ssize_t *len)
+{
+    MemHivePool *pool = t->pool;
+    int ret;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&pool->mut);
+
+    if (t->pooled) {
+        t->pooled = 0;
+        pool->nstarting--;
+        if (pool->closing) {
+            t->stop = 1;
+        } else {
+            t->next_idle = pool->idle;
+            pool->idle = t;
+            pool->nidle++;
+        }
+    }
+
+    while (!t->has_job && !t->stop) {
+        pthread_cond_wait(&t->cond, &pool->mut);
+    }
+
+    if (t->has_job) {
+        *payload = t->payload;
+        *len = t->payload_len;
+        t->payload = NULL;
+        t->has_job = 0;
+        ret = 1;
+    } else {
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&pool->mut);
+    Py_END_ALLOW_THREADS
+
+    return ret;
+}
+
+// Returns 1 if the thread should stay around for another worker.
+static int
+pool_thread_recycle(MemHivePoolThread *t)
+{
+    MemHivePool *pool = t->pool;
+    int ret = 0;
+
+    pthread_mutex_lock(&pool->mut);
+    if (!pool->closing && pool->nidle + pool->nstarting < pool->size) {
+        pool->nstarting++;
+        t->pooled = 1;
+        t->sub_id = ++pool->sub_id_cnt;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&pool->mut);
+
+    return ret;
+}
+
+// The thread is exiting without serving another worker. Returns the
+// id of the worker lost with it, 0 if none: `lost`, which it took and
+// couldn't start, or the one it was acquired for if it already has
+// its `main()`; if not, MemHivePool_Run() reports it.
+static uint64_t
+pool_thread_forget(MemHivePoolThread *t, uint64_t lost)
+{
+    MemHivePool *pool = t->pool;
+
+    pthread_mutex_lock(&pool->mut);
+    if (t->pooled) {
+        t->pooled = 0;
+        pool->nstarting--;
+    } else if (lost == 0 && t->has_job) {
+        lost = t->sub_id;
+        PyMem_RawFree(t->payload);
+        t->payload = NULL;
+        t->has_job = 0;
+    }
+    t->dead = 1;
+    pthread_mutex_unlock(&pool->mut);
+
+    return lost;
+}
+
+// Must be called with the main interpreter's GIL held.
+static void
+pool_report_lost(MemHivePool *pool, uint64_t sub_id)
+{
+    if (sub_id != 0 && pool->lost != NULL) {
+        pool->lost(pool->lost_arg, sub_id);
+    }
+}
+
+// Called with `main_tstate` attached. Leaves a thread state of the new
+// interpreter other than `*tstate` attached, or `main_tstate` if it
+// fails.
+static int
+pool_new_interp(PyThreadState *main_tstate,
+                PyThreadState **tstate, PyThreadState **work_tstate)
+{
+    PyInterpreterConfig config = {
+        .use_main_obmalloc = 0,
+        .allow_fork = 0,
+        .allow_exec = 0,
+        .allow_threads = 1,
+        .allow_daemon_threads = 0,
+        .check_multi_interp_extensions = 1,
+        .gil = PyInterpreterConfig_OWN_GIL,
+    };
+
+    *tstate = NULL;
+    PyStatus status = Py_NewInterpreterFromConfig(tstate, &config);
+    if (PyStatus_Exception(status)) {
+        PyThreadState_Swap(main_tstate);
+        fprintf(stderr, "memhive: could not create a subinterpreter: %s\n",
+                status.err_msg != NULL ? status.err_msg : "unknown error");
+        return -1;
+    }
+
+    // Workers run on a thread state of their own, cleared before the
+    // interpreter is finalized: thread-locals (like the `_DummyThread`
+    // that `threading` makes for this thread, e.g. for asyncio) go
+    // away with it and must do that while their modules still work.
+    *work_tstate = PyThreadState_New((*tstate)->interp);
+    if (*work_tstate == NULL) {
+        fprintf(stderr, "memhive: could not create a thread state\n");
+        Py_EndInterpreter(*tstate);
+        PyThreadState_Swap(main_tstate);
+        return -1;
+    }
+    PyThreadState_Swap(*work_tstate);
+    return 0;
+}
+
+// Called with `work_tstate` attached, leaves `main_tstate` attached.
+static void
+pool_end_interp(PyThreadState *main_tstate,
+                PyThreadState *tstate, PyThreadState *work_tstate)
+{
+    PyThreadState_Swap(tstate);
+    PyThreadState_Clear(work_tstate);
+    PyThreadState_Delete(work_tstate);
+    Py_EndInterpreter(tstate);
+    PyThreadState_Swap(main_tstate);
+}
+
+// Runs the bootstrap in the current interpreter and returns its
+// `__main__` globals (borrowed).
+static PyObject *
+pool_bootstrap(MemHivePool *pool)
+{
+    PyObject *main_mod = PyImport_AddModule("__main__");
+    if (main_mod == NULL) {
+        return NULL;
+    }
+    PyObject *globals = PyModule_GetDict(main_mod);
+
+    if (pool_set_bytes(globals, "__bootstrap",
+                       pool->bootstrap, pool->bootstrap_len) < 0 ||
+        pool_set_bytes(globals, "__env", pool->env, pool->env_len) < 0)
+    {
+        return NULL;
+    }
+
+    PyObject *res = PyRun_String(
+        "import marshal; exec(marshal.loads(__bootstrap))",
+        Py_file_input, globals, globals);
+    if (res == NULL) {
+        return NULL;
+    }
+    Py_DECREF(res);
+    return globals;
+}
+
+// Runs inside of the thread's own interpreter. Returns the id of the
+// worker lost with the thread, see pool_thread_forget().
+static uint64_t
+pool_thread_serve(MemHivePoolThread *t)
+{
+    MemHivePool *pool = t->pool;
+    PyObject *register_fn = NULL;
+    PyObject *run_fn = NULL;
+    PyObject *res;
+    uint64_t lost = 0;
+
+    PyObject *globals = pool_bootstrap(pool);
+    if (globals == NULL) {
+        goto err;
+    }
+
+    register_fn = pool_get_func(globals, "__register");
+    if (register_fn == NULL) {
+        goto err;
+    }
+    run_fn = pool_get_func(globals, "__run");
+    if (run_fn == NULL) {
+        goto err;
+    }
+
+    while (1) {
+        char *payload;
+        Py_ssize_t len;
+        if (!pool_thread_wait(t, &payload, &len)) {
+            break;
+        }
+
+        // The sub is registered only now that there's a worker for it:
+        // an idle thread's channels would count as broadcast readers
+        // and work-stealing targets that never listen.
+        lost = t->sub_id;
+        res = PyObject_CallFunction(
+            register_fn, "KK", pool->hive_id, t->sub_id);
+        if (res == NULL) {
+            PyMem_RawFree(payload);
+            goto err;
+        }
+        Py_DECREF(res);
+        // From now on the worker reports for itself.
+        lost = 0;
+
+        pool_thread_set_affinity(t, t->cpu);
+
+        PyObject *arg = PyBytes_FromStringAndSize(payload, len);
+        PyMem_RawFree(payload);
+        if (arg == NULL) {
+            goto err;
+        }
+        res = PyObject_CallOneArg(run_fn, arg);
+        Py_DECREF(arg);
+        if (res == NULL) {
+            goto err;
+        }
+        Py_DECREF(res);
+
+        if (!pool_thread_recycle(t)) {
+            break;
+        }
+    }
+
+    Py_DECREF(register_fn);
+    Py_DECREF(run_fn);
+    return 0;
+
+err:
+    pool_print_error(pool);
+    Py_XDECREF(register_fn);
+    Py_XDECREF(run_fn);
+    return pool_thread_forget(t, lost);
+}
+
+static void *
+pool_thread_main(void *arg)
+{
+    MemHivePoolThread *t = (MemHivePoolThread *)arg;
+    MemHivePool *pool = t->pool;
+
+#ifdef __linux__
+    if (pthread_getaffinity_np(
+            pthread_self(), sizeof t->default_cpus, &t->default_cpus))
+    {
+        CPU_ZERO(&t->default_cpus);
+    }
+#endif
+
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyThreadState *main_tstate = PyThreadState_Get();
+
+    PyThreadState *tstate;
+    PyThreadState *work_tstate;
+    uint64_t lost;
+    if (pool_new_interp(main_tstate, &tstate, &work_tstate)) {
+        lost = pool_thread_forget(t, 0);
+    } else {
+        lost = pool_thread_serve(t);
+        pool_end_interp(main_tstate, tstate, work_tstate);
+    }
+    pool_report_lost(pool, lost);
+
+    pthread_mutex_lock(&pool->mut);
+    pool->nthreads--;
+    pthread_mutex_unlock(&pool->mut);
+
+    PyGILState_Release(gil);
+    return NULL;
+}
+
+// Creates the handler's interpreter and starts its worker. Called and
+// returns without a thread state; returns -1 if the worker didn't
+// start (it has reported why, or it's reported lost).
+static int
+pool_handler_start(MemHivePoolDispatcher *d, PoolHandler *h,
+                   PyThreadState *main_tstate)
+{
+    MemHivePool *pool = d->pool;
+    PyObject *register_fn = NULL;
+    PyObject *start_fn = NULL;
+    PyObject *res;
+
+    PyEval_RestoreThread(main_tstate);
+    if (pool_new_interp(main_tstate, &h->tstate, &h->work_tstate)) {
+        goto lost;
+    }
+
+    PyObject *globals = pool_bootstrap(pool);
+    if (globals == NULL) {
+        goto err;
+    }
+    register_fn = pool_get_func(globals, "__register");
+    if (register_fn == NULL) {
+        goto err;
+    }
+    start_fn = pool_get_func(globals, "__start");
+    if (start_fn == NULL) {
+        goto err;
+    }
+    h->dispatch_fn = pool_get_func(globals, "__dispatch");
+    if (h->dispatch_fn == NULL) {
+        goto err;
+    }
+
+    res = PyObject_CallFunction(register_fn, "KKi",
+                                pool->hive_id, h->sub_id, h->exclusive);
+    if (res == NULL) {
+        goto err;
+    }
+    h->channel = ((MemHiveSub *)res)->channel;
+    Py_DECREF(res);
+
+    PyObject *arg = PyBytes_FromStringAndSize(h->payload, h->payload_len);
+    PyMem_RawFree(h->payload);
+    h->payload = NULL;
+    if (arg == NULL) {
+        goto err;
+    }
+    res = PyObject_CallOneArg(start_fn, arg);
+    Py_DECREF(arg);
+    if (res == NULL) {
+        goto err;
+    }
+    int started = PyObject_IsTrue(res);
+    Py_DECREF(res);
+    Py_CLEAR(register_fn);
+    Py_CLEAR(start_fn);
+    if (started <= 0) {
+        if (started < 0) {
+            pool_print_error(pool);
+        }
+        // The worker has reported why.
+        Py_CLEAR(h->dispatch_fn);
+        pool_end_interp(main_tstate, h->tstate, h->work_tstate);
+        PyEval_SaveThread();
+        return -1;
+    }
+    PyEval_SaveThread();
+
+    MemQueue_AttachChannel(pool->queue, h->channel, &d->waiter);
+    return 0;
+
+err:
+    pool_print_error(pool);
+    Py_CLEAR(h->dispatch_fn);
+    Py_XDECREF(register_fn);
+    Py_XDECREF(start_fn);
+    pool_end_interp(main_tstate, h->tstate, h->work_tstate);
+lost:
+    pool_report_lost(pool, h->sub_id);
+    PyEval_SaveThread();
+    return -1;
+}
+
+// Has the handler take the messages waiting for it, up to a batch.
+// Called and returns without a thread state; returns 0 once the
+// worker is done.
+static int
+pool_handler_dispatch(MemHivePool *pool, PoolHandler *h)
+{
+    PyEval_RestoreThread(h->work_tstate);
+
+    int running = -1;
+    PyObject *res = PyObject_CallFunction(
+        h->dispatch_fn, "n", (Py_ssize_t)POOL_DISPATCH_BATCH);
+    if (res != NULL) {
+        running = PyObject_IsTrue(res);
+        Py_DECREF(res);
+    }
+    if (running < 0) {
+        pool_print_error(pool);
+        running = 0;
+    }
+
+    PyEval_SaveThread();
+    return running;
+}
+
+// Ends the `i`-th running handler, whose worker is done. Called and
+// returns without a thread state.
+static void
+pool_dispatcher_remove(MemHivePoolDispatcher *d, ssize_t i,
+                       PyThreadState *main_tstate)
+{
+    MemHivePool *pool = d->pool;
+    PoolHandler *h = d->handlers[i];
+
+    // The worker has closed its sub, so the channel might already be
+    // attached to another dispatch thread's waiter.
+    MemQueue_DetachChannel(pool->queue, h->channel, &d->waiter);
+
+    PyEval_RestoreThread(h->work_tstate);
+    Py_CLEAR(h->dispatch_fn);
+    pool_end_interp(main_tstate, h->tstate, h->work_tstate);
+    PyEval_SaveThread();
+
+    d->nrunning--;
+    d->handlers[i] = d->handlers[d->nrunning];
+    d->channels[i] = d->channels[d->nrunning];
+
+    pthread_mutex_lock(&pool->mut);
+    d->nhandlers--;
+    pthread_mutex_unlock(&pool->mut);
+
+    PyMem_RawFree(h);
+}
+
+static void *
+pool_dispatcher_main(void *arg)
+{
+    MemHivePoolDispatcher *d = (MemHivePoolDispatcher *)arg;
+    MemHivePool *pool = d->pool;
+
+    // Interpreters are only entered to start, dispatch to or end
+    // a worker; the thread waits with no thread state at all.
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyThreadState *main_tstate = PyEval_SaveThread();
+
+    int closed = 0;
+    ssize_t next = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->mut);
+        PoolHandler *starting = d->starting;
+        d->starting = NULL;
+        if (starting == NULL && d->nhandlers == 0
+            && (pool->closing || closed))
+        {
+            d->exited = 1;
+            pool->ndispatchers--;
+            pthread_mutex_unlock(&pool->mut);
+            break;
+        }
+        pthread_mutex_unlock(&pool->mut);
+
+        while (starting != NULL) {
+            PoolHandler *h = starting;
+            starting = h->next;
+            if (pool_handler_start(d, h, main_tstate)) {
+                pthread_mutex_lock(&pool->mut);
+                d->nhandlers--;
+                pthread_mutex_unlock(&pool->mut);
+                PyMem_RawFree(h->payload);
+                PyMem_RawFree(h);
+                continue;
+            }
+            d->handlers[d->nrunning] = h;
+            d->channels[d->nrunning] = h->channel;
+            d->nrunning++;
+        }
+
+        if (closed) {
+            // Their listen_many() raises ClosedQueueError now, which
+            // is how workers find out.
+            while (d->nrunning > 0) {
+                pool_handler_dispatch(pool, d->handlers[d->nrunning - 1]);
+                pool_dispatcher_remove(d, d->nrunning - 1, main_tstate);
+            }
+            continue;
+        }
+
+        ssize_t i = MemQueue_WaitAny(
+            pool->queue, &d->waiter, d->channels, d->nrunning, next);
+        if (i == -1) {
+            closed = 1;
+        } else if (i >= 0) {
+            next = i + 1;
+            if (!pool_handler_dispatch(pool, d->handlers[i])) {
+                pool_dispatcher_remove(d, i, main_tstate);
+                next = i;
+            }
+        }
+    }
+
+    PyEval_RestoreThread(main_tstate);
+    PyGILState_Release(gil);
+    return NULL;
+}
+
+// Must be called with `pool->mut` held.
+static MemHivePoolDispatcher *
+pool_dispatcher_start(MemHivePool *pool)
+{
+    MemHivePoolDispatcher *d = PyMem_RawCalloc(1, sizeof *d);
+    if (d == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    d->pool = pool;
+    if (pthread_cond_init(&d->waiter.cond, NULL)) {
+        PyMem_RawFree(d);
+        PyErr_SetString(PyExc_RuntimeError, "failed to initialize a condition");
+        return NULL;
+    }
+
+    if (pthread_create(&d->thread, NULL, pool_dispatcher_main, d)) {
+        pthread_cond_destroy(&d->waiter.cond);
+        PyMem_RawFree(d);
+        PyErr_SetString(PyExc_RuntimeError, "can't start a dispatch thread");
+        return NULL;
+    }
+
+    d->next = pool->dispatchers;
+    pool->dispatchers = d;
+    pool->ndispatchers++;
+    return d;
+}
+
+// Must be called with `pool->mut` held.
+static MemHivePoolThread *
+pool_thread_start(MemHivePool *pool, int pooled)
+{
+    MemHivePoolThread *t = PyMem_RawCalloc(1, sizeof *t);
+    if (t == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    t->pool = pool;
+    t->pooled = (uint8_t)pooled;
+    t->sub_id = ++pool->sub_id_cnt;
+    if (pthread_cond_init(&t->cond, NULL)) {
+        PyMem_RawFree(t);
+        PyErr_SetString(PyExc_RuntimeError, "failed to initialize a condition");
+        return NULL;
+    }
+
+    if (pthread_create(&t->thread, NULL, pool_thread_main, t)) {
+        pthread_cond_destroy(&t->cond);
+        PyMem_RawFree(t);
+        PyErr_SetString(PyExc_RuntimeError, "can't start a worker thread");
+        return NULL;
+    }
+
+    t->next = pool->threads;
+    pool->threads = t;
+    pool->nthreads++;
+    if (pooled) {
+        pool->nstarting++;
+    }
+    return t;
+}
+
+int
+MemHivePool_Init(MemHivePool *pool, uint64_t hive_id, MemQueue *queue,
+                 MemHivePoolLostFunc lost, void *lost_arg)
+{
+    memset(pool, 0, sizeof *pool);
+    pool->hive_id = hive_id;
+    pool->queue = queue;
+    pool->lost = lost;
+    pool->lost_arg = lost_arg;
+
+    // We don't want sub ids to start at 0 (that's reserved for the
+    // main interpreter and I'd like to avoid any possible confusion)
+    // and we don't want them to appear to be mapped to real
+    // subinterpreter IDs (they can be out of sync anyway),
+    // hence a random offset.
+    pool->sub_id_cnt = 41;
+
+    if (pthread_mutex_init(&pool->mut, NULL)) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+MemHivePool_Configure(MemHivePool *pool, Py_ssize_t size,
+                      Py_ssize_t dispatch_threads,
+                      const char *bootstrap, Py_ssize_t bootstrap_len,
+                      const char *env, Py_ssize_t env_len)
+{
+    if (size < 0) {
+        PyErr_SetString(PyExc_ValueError, "pool size must not be negative");
+        return -1;
+    }
+    if (dispatch_threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "dispatch_threads must be >= 1");
+        return -1;
+    }
+
+    char *bootstrap_copy = pool_copy(bootstrap, bootstrap_len);
+    if (bootstrap_copy == NULL) {
+        return -1;
+    }
+    char *env_copy = pool_copy(env, env_len);
+    if (env_copy == NULL) {
+        PyMem_RawFree(bootstrap_copy);
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->mut);
+    if (pool->configured) {
+        pthread_mutex_unlock(&pool->mut);
+        PyMem_RawFree(bootstrap_copy);
+        PyMem_RawFree(env_copy);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "the worker pool is already configured");
+        return -1;
+    }
+    pool->size = size;
+    pool->dispatch_threads = dispatch_threads;
+    pool->bootstrap = bootstrap_copy;
+    pool->bootstrap_len = bootstrap_len;
+    pool->env = env_copy;
+    pool->env_len = env_len;
+    pool->configured = 1;
+    pthread_mutex_unlock(&pool->mut);
+
+    return 0;
+}
+
+static int
+pool_ensure_usable(MemHivePool *pool)
+{
+    if (!pool->configured) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "the worker pool isn't configured");
+        return -1;
+    }
+    if (pool->closing) {
+        PyErr_SetString(PyExc_RuntimeError, "the worker pool is closed");
+        return -1;
+    }
+    return 0;
+}
+
+int
+MemHivePool_Fill(MemHivePool *pool)
+{
+    pthread_mutex_lock(&pool->mut);
+    if (pool_ensure_usable(pool)) {
+        goto err;
+    }
+    while (pool->nidle + pool->nstarting < pool->size) {
+        if (pool_thread_start(pool, 1) == NULL) {
+            goto err;
+        }
+    }
+    pthread_mutex_unlock(&pool->mut);
+    return 0;
+
+err:
+    pthread_mutex_unlock(&pool->mut);
+    return -1;
+}
+
+int64_t
+MemHivePool_Acquire(MemHivePool *pool)
+{
+    MemHivePoolThread *t;
+
+    pthread_mutex_lock(&pool->mut);
+    if (pool_ensure_usable(pool)) {
+        goto err;
+    }
+
+    if (pool->idle != NULL) {
+        t = pool->idle;
+        pool->idle = t->next_idle;
+        t->next_idle = NULL;
+        pool->nidle--;
+    } else {
+        t = pool_thread_start(pool, 0);
+        if (t == NULL) {
+            goto err;
+        }
+    }
+
+    int64_t sub_id = (int64_t)t->sub_id;
+    pthread_mutex_unlock(&pool->mut);
+    return sub_id;
+
+err:
+    pthread_mutex_unlock(&pool->mut);
+    return -1;
+}
+
+int
+MemHivePool_Run(MemHivePool *pool, uint64_t sub_id,
+                const char *payload, Py_ssize_t len, int cpu)
+{
+#ifndef __linux__
+    if (cpu >= 0) {
+        PyErr_SetString(PyExc_NotImplementedError,
+                        "CPU affinity is not supported on this platform");
+        return -1;
+    }
+#endif
+
+    char *copy = pool_copy(payload, len);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->mut);
+
+    MemHivePoolThread *t = pool->threads;
+    while (t != NULL) {
+        // Threads keep their sub id until they are given a `main()`.
+        if (t->sub_id == sub_id && !t->pooled && !t->has_job) {
+            break;
+        }
+        t = t->next;
+    }
+    if (t == NULL) {
+        pthread_mutex_unlock(&pool->mut);
+        PyMem_RawFree(copy);
+        PyErr_Format(PyExc_ValueError,
+                     "no worker thread was acquired for sub %llu",
+                     (unsigned long long)sub_id);
+        return -1;
+    }
+
+    if (t->dead) {
+        // Its interpreter couldn't be set up.
+        pthread_mutex_unlock(&pool->mut);
+        PyMem_RawFree(copy);
+        pool_report_lost(pool, sub_id);
+        return 0;
+    }
+
+    t->payload = copy;
+    t->payload_len = len;
+    t->cpu = cpu;
+    t->has_job = 1;
+    pthread_cond_signal(&t->cond);
+
+    pthread_mutex_unlock(&pool->mut);
+    return 0;
+}
+
+int64_t
+MemHivePool_AcquireHandler(MemHivePool *pool)
+{
+    pthread_mutex_lock(&pool->mut);
+    if (pool_ensure_usable(pool)) {
+        pthread_mutex_unlock(&pool->mut);
+        return -1;
+    }
+    int64_t sub_id = (int64_t)++pool->sub_id_cnt;
+    pthread_mutex_unlock(&pool->mut);
+    return sub_id;
+}
+
+int
+MemHivePool_RunHandler(MemHivePool *pool, uint64_t sub_id,
+                       const char *payload, Py_ssize_t len, int exclusive)
+{
+    PoolHandler *h = PyMem_RawCalloc(1, sizeof *h);
+    if (h == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    h->payload = pool_copy(payload, len);
+    if (h->payload == NULL) {
+        PyMem_RawFree(h);
+        return -1;
+    }
+    h->payload_len = len;
+    h->exclusive = exclusive ? 1 : 0;
+
+    pthread_mutex_lock(&pool->mut);
+    if (pool_ensure_usable(pool)) {
+        goto err;
+    }
+
+    MemHivePoolDispatcher *d = NULL;
+    for (MemHivePoolDispatcher *x = pool->dispatchers; x; x = x->next) {
+        if (!x->exited && (d == NULL || x->nhandlers < d->nhandlers)) {
+            d = x;
+        }
+    }
+    if (d == NULL
+        || (d->nhandlers > 0 && pool->ndispatchers < pool->dispatch_threads))
+    {
+        d = pool_dispatcher_start(pool);
+        if (d == NULL) {
+            goto err;
+        }
+    }
+
+    h->sub_id = sub_id;
+    h->next = d->starting;
+    d->starting = h;
+    d->nhandlers++;
+    pthread_mutex_unlock(&pool->mut);
+
+    // Doesn't exit while it has handlers. Whoever holds the queue lock
+    // might be waiting for our GIL.
+    Py_BEGIN_ALLOW_THREADS
+    MemQueue_Interrupt(pool->queue, &d->waiter);
+    Py_END_ALLOW_THREADS
+    return 0;
+
+err:
+    pthread_mutex_unlock(&pool->mut);
+    PyMem_RawFree(h->payload);
+    PyMem_RawFree(h);
+    return -1;
+}
+
+void
+MemHivePool_Stats(MemHivePool *pool, MemHivePoolStats *stats)
+{
+    pthread_mutex_lock(&pool->mut);
+    stats->nthreads = pool->nthreads;
+    stats->nidle = pool->nidle;
+    stats->ndispatchers = pool->ndispatchers;
+    stats->nhandlers = 0;
+    for (MemHivePoolDispatcher *d = pool->dispatchers; d; d = d->next) {
+        stats->nhandlers += d->nhandlers;
+    }
+    pthread_mutex_unlock(&pool->mut);
+}
+
+void
+MemHivePool_Close(MemHivePool *pool)
+{
+    // Must be called without the GIL: see MemHivePool_RunHandler().
+    pthread_mutex_lock(&pool->mut);
+    pool->closing = 1;
+    while (pool->idle != NULL) {
+        MemHivePoolThread *t = pool->idle;
+        pool->idle = t->next_idle;
+        t->next_idle = NULL;
+        t->stop = 1;
+        pthread_cond_signal(&t->cond);
+    }
+    pool->nidle = 0;
+    // Dispatch threads with no workers left exit now, the others once
+    // they have none.
+    for (MemHivePoolDispatcher *d = pool->dispatchers; d; d = d->next) {
+        if (!d->exited) {
+            MemQueue_Interrupt(pool->queue, &d->waiter);
+        }
+    }
+    pthread_mutex_unlock(&pool->mut);
+}
+
+void
+MemHivePool_Join(MemHivePool *pool)
+{
+    MemHivePool_Close(pool);
+
+    pthread_mutex_lock(&pool->mut);
+    MemHivePoolThread *t = pool->threads;
+    pool->threads = NULL;
+    MemHivePoolDispatcher *d = pool->dispatchers;
+    pool->dispatchers = NULL;
+    pthread_mutex_unlock(&pool->mut);
+
+    while (d != NULL) {
+        MemHivePoolDispatcher *next = d->next;
+        pthread_join(d->thread, NULL);
+        assert(d->starting == NULL && d->nrunning == 0);
+        pthread_cond_destroy(&d->waiter.cond);
+        PyMem_RawFree(d);
+        d = next;
+    }
+
+    while (t != NULL) {
+        MemHivePoolThread *next = t->next;
+        pthread_join(t->thread, NULL);
+        pthread_cond_destroy(&t->cond);
+        PyMem_RawFree(t->payload);
+        PyMem_RawFree(t);
+        t = next;
+    }
+}
+
+void
+MemHivePool_Destroy(MemHivePool *pool)
+{
+    assert(pool->threads == NULL && pool->dispatchers == NULL);
+    PyMem_RawFree(pool->bootstrap);
+    pool->bootstrap = NULL;
+    PyMem_RawFree(pool->env);
+    pool->env = NULL;
+    pthread_mutex_destroy(&pool->mut);
+}
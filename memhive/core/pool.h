@@ -0,0 +1,135 @@
+#ifndef MEMHIVE_POOL_H
+#define MEMHIVE_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "Python.h"
+
+#include "queue.h"
+
+// A pool of native threads, each hosting one worker subinterpreter.
+//
+// A thread creates its interpreter and runs the worker bootstrap in
+// it; then it parks on its own condition variable with the
+// interpreter's GIL released until it's given a `main()` to run, and
+// registers a MemHiveSub for it. Once the worker is done the thread
+// either goes back to the idle list (if the pool isn't full) or
+// destroys its interpreter and exits.
+//
+// This only hosts the interpreters: a running worker has its thread
+// to itself, and blocks it in `listen()` like any other thread would.
+//
+// Workers that are given a `handler()` instead of a `main()` don't
+// get a thread of their own. Up to `dispatch_threads` dispatch threads
+// are shared by all of them: a dispatch thread creates (and in the end
+// destroys) the interpreters of the workers it's given, attaches their
+// channels of the workers' queue to its MemQueueWaiter, and sleeps in
+// MemQueue_WaitAny() with no GIL held. When one of the channels has
+// something to take it switches to that worker's interpreter and has
+// it handle a few messages, then goes back to waiting.
+//
+// A worker that can't be started (its interpreter can't be created,
+// the bootstrap fails, ...) is reported lost: `lost(lost_arg, sub_id)`
+// is called with the main interpreter's GIL held.
+//
+// Everything the threads need from the main interpreter (the bootstrap
+// code, `sys.path`, the worker payloads) is copied into raw memory,
+// no Python objects are shared.
+
+typedef struct pool_thread MemHivePoolThread;
+typedef struct pool_dispatcher MemHivePoolDispatcher;
+
+typedef void (*MemHivePoolLostFunc)(void *arg, uint64_t sub_id);
+
+typedef struct {
+    Py_ssize_t nthreads;        // worker threads still running
+    Py_ssize_t nidle;
+    Py_ssize_t ndispatchers;    // dispatch threads still running
+    Py_ssize_t nhandlers;       // workers hosted by dispatch threads
+} MemHivePoolStats;
+
+typedef struct {
+    pthread_mutex_t mut;
+
+    uint64_t hive_id;
+    // The queue the workers listen on, for the dispatch threads.
+    MemQueue *queue;
+    MemHivePoolLostFunc lost;
+    void *lost_arg;
+
+    char *bootstrap;
+    Py_ssize_t bootstrap_len;
+    char *env;
+    Py_ssize_t env_len;
+
+    // All threads ever started, joined and freed by MemHivePool_Join().
+    MemHivePoolThread *threads;
+    // Threads waiting for a `main()`.
+    MemHivePoolThread *idle;
+
+    // All dispatch threads ever started, likewise.
+    MemHivePoolDispatcher *dispatchers;
+
+    Py_ssize_t size;
+    Py_ssize_t nidle;
+    Py_ssize_t nstarting;
+    Py_ssize_t nthreads;
+
+    Py_ssize_t dispatch_threads;
+    Py_ssize_t ndispatchers;
+
+    uint64_t sub_id_cnt;
+
+    uint8_t configured;
+    uint8_t closing;
+} MemHivePool;
+
+int MemHivePool_Init(MemHivePool *pool, uint64_t hive_id, MemQueue *queue,
+                     MemHivePoolLostFunc lost, void *lost_arg);
+
+// `bootstrap` is a marshalled code object that has to define
+// `__register(hive_id, sub_id)` (returning the MemHiveSub it
+// registers), `__run(payload)`, `__start(payload)` (returning whether
+// the handler could be started) and `__dispatch(max_items)`
+// (returning whether the handler worker is still running) in
+// `__main__`; it can read the marshalled `env` from the `__env` global.
+int MemHivePool_Configure(MemHivePool *pool, Py_ssize_t size,
+                          Py_ssize_t dispatch_threads,
+                          const char *bootstrap, Py_ssize_t bootstrap_len,
+                          const char *env, Py_ssize_t env_len);
+
+int MemHivePool_Fill(MemHivePool *pool);
+
+// Reserves a thread for the next worker (starting a new one if no
+// thread is idle) and returns the id of its sub, or -1 on error.
+int64_t MemHivePool_Acquire(MemHivePool *pool);
+
+// With `cpu` >= 0 the thread is pinned to that CPU while it runs
+// the worker; otherwise it can run on any CPU the process can.
+int MemHivePool_Run(MemHivePool *pool, uint64_t sub_id,
+                    const char *payload, Py_ssize_t len, int cpu);
+
+// Returns the id of the sub of the next `handler()` worker, or -1 on
+// error.
+int64_t MemHivePool_AcquireHandler(MemHivePool *pool);
+
+// Gives a `handler()` worker to the dispatch thread with the fewest,
+// starting a new one if there are less than `dispatch_threads`. An
+// `exclusive` one gets no push() messages, see MemQueue_AddChannel().
+int MemHivePool_RunHandler(MemHivePool *pool, uint64_t sub_id,
+                           const char *payload, Py_ssize_t len,
+                           int exclusive);
+
+void MemHivePool_Stats(MemHivePool *pool, MemHivePoolStats *stats);
+
+// Stops the idle threads; busy threads exit after their workers
+// are done, and so do dispatch threads.
+void MemHivePool_Close(MemHivePool *pool);
+
+// Must be called without the GIL.
+void MemHivePool_Join(MemHivePool *pool);
+
+void MemHivePool_Destroy(MemHivePool *pool);
+
+#endif
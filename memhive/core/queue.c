@@ -1,23 +1,84 @@
 #include "memhive.h"
 #include "queue.h"
+#include "ring.h"
 #include "utils.h"
 #include "track.h"
 
+#include "structmember.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 #define MAX_REUSE 100
+// Messages a channel gets taken in a row at most when intake is fair,
+// see queue_fair_next().
+#define FAIR_QUANTUM 4
+#define QUEUE_REQUEST_TYPENAME "memhive.core.QueueRequest"
 #define QUEUE_RESPONSE_TYPENAME "memhive.core.QueueResponse"
+#define QUEUE_BROADCAST_TYPENAME "memhive.core.QueueBroadcast"
+#define QUEUE_WATCH_TYPENAME "memhive.core.QueueWatch"
 
 struct item {
     PyObject *val;
     PyObject *sender;
     uint64_t id;
     struct item *next;
+    struct item *prev;  // only kept up to date in task deques
     memqueue_event_t kind;
+    int priority;
+};
+
+struct bcast {
+    PyObject *val;
+    PyObject *sender;
+    uint64_t seq;
+    // Listeners that haven't taken it yet or are still copying it.
+    _Atomic ssize_t pending;
+    struct bcast *next;
 };
 
 struct queue {
+    // Sorted by priority, highest first, FIFO within a priority.
     struct item *first;
     struct item *last;
-    ssize_t length;
+    // The last item of each priority, NULL if there are none.
+    struct item *prio_last[MEMQUEUE_PRIORITIES];
+    _Atomic ssize_t length;     // read without the lock by ring_get()
+    // Listeners of this channel wait here; a listener of a side channel
+    // waits for channel 0 messages too, but on its own channel's cond.
+    pthread_cond_t cond;
+    _Atomic ssize_t nwaiting;
+    // Waiters signalled but not yet awake, so that a burst of puts
+    // doesn't spend all its signals on the same waiter.
+    ssize_t nsignaled;
+    // Woken instead of `cond` when set, see MemQueue_AttachChannel().
+    MemQueueWaiter *waiter;
+    int efd;        // readiness eventfd, -1 until asked for
+    ssize_t capacity;   // 0 for unbounded
+    uint64_t nfull;     // puts that found the channel full
+    uint64_t bcast_cursor;  // the next broadcast to take
+    uint64_t bcast_end;     // the first one sent after it was closed
+    MemRing *ring;  // channel 0 of a ring queue, NULL otherwise
+    // Pushed messages dealt to this channel in work-stealing mode;
+    // the listener takes from the front, others steal from the back.
+    struct item *task_first;
+    struct item *task_last;
+    ssize_t ntasks;
+    ssize_t deficit;    // what's left of its turn, see queue_fair_next()
+    _Atomic uint8_t closed;
+    _Atomic uint8_t released;
+    // Released by its owner while tasks were still dealt to it; it's
+    // released for good once the last of them is stolen.
+    uint8_t orphaned;
+    // Bumped every time MemQueue_AddChannel() hands the channel out,
+    // see MemQueue_PutTo().
+    uint64_t generation;
+    // Its listener takes no shared work, see MemQueue_AddChannel().
+    uint8_t exclusive;
 };
 
 static void
@@ -50,9 +111,153 @@ queue_lock(MemQueue *queue, module_state *state)
     return 0;
 }
 
+static void
+queue_notify_fd(int efd)
+{
+    if (efd < 0) {
+        return;
+    }
+    uint64_t one = 1;
+    // EAGAIN means the counter is saturated, it's readable anyway.
+    while (write(efd, &one, sizeof one) < 0 && errno == EINTR) {
+    }
+}
+
+static void
+queue_notify(MemQueue *queue, struct queue *q)
+{
+    // The lock must be held for this operation
+
+    if (queue->nfds == 0) {
+        return;
+    }
+    if (q == &queue->queues[0]) {
+        // Everyone listening on a side channel takes from channel 0.
+        for (ssize_t i = 0; i < queue->nqueues; i++) {
+            if (!queue->queues[i].exclusive) {
+                queue_notify_fd(queue->queues[i].efd);
+            }
+        }
+    } else {
+        queue_notify_fd(q->efd);
+    }
+}
+
 static int
-queue_put(MemQueue *queue, struct queue *q,
-          PyObject *sender, memqueue_event_t kind, uint64_t id, PyObject *val)
+queue_wake(struct queue *q)
+{
+    // The lock must be held for this operation
+
+    if (q->nwaiting > q->nsignaled) {
+        q->nsignaled++;
+        pthread_cond_signal(&q->cond);
+        return 1;
+    }
+    MemQueueWaiter *w = q->waiter;
+    if (w != NULL && w->waiting && !w->signaled) {
+        w->signaled = 1;
+        pthread_cond_signal(&w->cond);
+        return 1;
+    }
+    return 0;
+}
+
+static void
+queue_wake_all(struct queue *q)
+{
+    // The lock must be held for this operation
+
+    pthread_cond_broadcast(&q->cond);
+    MemQueueWaiter *w = q->waiter;
+    if (w != NULL && w->waiting) {
+        w->signaled = 1;
+        pthread_cond_signal(&w->cond);
+    }
+}
+
+static void
+queue_wake_push_listener(MemQueue *queue)
+{
+    // The lock must be held for this operation
+    //
+    // Wakes one listener that can take a message from channel 0,
+    // going round-robin over the side channels.
+
+    if (queue_wake(&queue->queues[0])) {
+        return;
+    }
+    ssize_t nside = queue->nqueues - 1;
+    for (ssize_t k = 0; k < nside; k++) {
+        ssize_t channel = 1 + (queue->wake_next + k) % nside;
+        struct queue *q = &queue->queues[channel];
+        // Listeners of a closed channel don't take shared work.
+        if (!q->closed && !q->exclusive && queue_wake(q)) {
+            queue->wake_next = channel;
+            return;
+        }
+    }
+}
+
+static int
+queue_init_channel(MemQueue *queue, struct queue *q, ssize_t capacity)
+{
+    q->capacity = capacity;
+    q->nfull = 0;
+    q->bcast_cursor = queue->bcast_next;
+    q->bcast_end = UINT64_MAX;
+    q->ring = NULL;
+    if (queue->ring_capacity > 0 && q == &queue->queues[0]) {
+        q->ring = aligned_alloc(MEMHIVE_CACHE_LINE, sizeof(MemRing));
+        if (q->ring == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        if (MemRing_Init(q->ring, queue->ring_capacity)) {
+            free(q->ring);
+            q->ring = NULL;
+            return -1;
+        }
+        q->capacity = (ssize_t)q->ring->mask + 1;
+    }
+
+    q->first = NULL;
+    q->last = NULL;
+    for (int p = 0; p < MEMQUEUE_PRIORITIES; p++) {
+        q->prio_last[p] = NULL;
+    }
+    q->length = 0;
+    q->task_first = NULL;
+    q->task_last = NULL;
+    q->ntasks = 0;
+    q->deficit = 0;
+    if (pthread_cond_init(&q->cond, NULL)) {
+        Py_FatalError("Failed to initialize a condition");
+    }
+    q->nwaiting = 0;
+    q->nsignaled = 0;
+    q->waiter = NULL;
+    q->efd = -1;
+    q->closed = 0;
+    q->released = 0;
+    q->orphaned = 0;
+    q->generation = 1;
+    q->exclusive = 0;
+    return 0;
+}
+
+static ssize_t
+queue_length(struct queue *q)
+{
+    if (q->ring != NULL) {
+        return (ssize_t)MemRing_Length(q->ring);
+    }
+    return q->length;
+}
+
+static struct item *
+queue_new_item(MemQueue *queue,
+               PyObject *sender, memqueue_event_t kind, uint64_t id,
+               PyObject *val)
 {
     // The lock must be held for this operation
 
@@ -66,7 +271,7 @@ queue_put(MemQueue *queue, struct queue *q,
         i = PyMem_RawMalloc(sizeof *i);
         if (i == NULL) {
             PyErr_NoMemory();
-            return -1;
+            return NULL;
         }
     }
 
@@ -75,107 +280,1034 @@ queue_put(MemQueue *queue, struct queue *q,
     i->kind = kind;
     i->id = id;
 
-    i->sender = sender;     // borrow; we don't care, the lifetime of sender is
-                            // greater than of this queue
+    i->sender = sender;     // borrow; we don't care, the lifetime of sender is
+                            // greater than of this queue
+
+    i->next = NULL;
+    i->prev = NULL;
+    i->priority = 0;
+    return i;
+}
+
+static void
+queue_free_item(MemQueue *queue, struct item *i)
+{
+    // The lock must be held for this operation
+
+    if (queue->reuse_num < MAX_REUSE) {
+        i->sender = NULL;
+        i->val = NULL;
+        i->next = queue->reuse;
+        queue->reuse = i;
+        queue->reuse_num++;
+    } else {
+        PyMem_RawFree(i);
+    }
+}
+
+static int
+queue_put(MemQueue *queue, struct queue *q,
+          PyObject *sender, memqueue_event_t kind, uint64_t id, PyObject *val,
+          int priority)
+{
+    // The lock must be held for this operation
+
+    if (q->closed) {
+        // The listener is going away, there's no one to deliver to.
+        return 0;
+    }
+
+    struct item *i = queue_new_item(queue, sender, kind, id, val);
+    if (i == NULL) {
+        return -1;
+    }
+    i->priority = priority;
+
+    // Goes after the last item of the same or a higher priority.
+    struct item *after = NULL;
+    for (int p = priority; p < MEMQUEUE_PRIORITIES && after == NULL; p++) {
+        after = q->prio_last[p];
+    }
+    if (after == NULL) {
+        i->next = q->first;
+        q->first = i;
+    } else {
+        i->next = after->next;
+        after->next = i;
+    }
+    if (i->next == NULL) {
+        q->last = i;
+    }
+    q->prio_last[priority] = i;
+
+    if (q == &queue->queues[0]) {
+        queue_wake_push_listener(queue);
+    } else if (queue->fair) {
+        // Side channels are intakes, all drained by channel 0's
+        // listener.
+        queue_wake(&queue->queues[0]);
+        queue->fair_length++;
+    } else {
+        queue_wake(q);
+    }
+
+    if (q->length == 0) {
+        queue_notify(queue, queue->fair ? &queue->queues[0] : q);
+    }
+
+    q->length++;
+
+    return 0;
+}
+
+static void
+queue_pop(MemQueue *queue, struct queue *q,
+          memqueue_event_t *event, RemoteObject **sender,
+          uint64_t *id, RemoteObject **val)
+{
+    // The lock must be held for this operation
+
+    assert(q->first != NULL);
+
+    struct item *prev_first = q->first;
+    *event = prev_first->kind;
+    *val = (RemoteObject*)prev_first->val;
+    *sender = (RemoteObject*)prev_first->sender;
+    *id = prev_first->id;
+
+    q->first = prev_first->next;
+    q->length--;
+    if (queue->fair && q != &queue->queues[0]) {
+        queue->fair_length--;
+    }
+    if (q->prio_last[prev_first->priority] == prev_first) {
+        q->prio_last[prev_first->priority] = NULL;
+    }
+
+    if (q->first == NULL) {
+        q->last = NULL;
+        q->length = 0;
+    }
+
+    queue_free_item(queue, prev_first);
+}
+
+static int
+queue_put_task(MemQueue *queue,
+               PyObject *sender, memqueue_event_t kind, uint64_t id,
+               PyObject *val)
+{
+    // The lock must be held for this operation
+    //
+    // Deals a pushed message to the next open side channel that takes
+    // shared work, or leaves it in channel 0 if there are none yet. Channels are only open
+    // while their worker runs, so nothing is dealt to a thread that
+    // doesn't listen.
+
+    ssize_t nside = queue->nqueues - 1;
+    struct queue *q = NULL;
+    for (ssize_t k = 0; k < nside; k++) {
+        ssize_t channel = 1 + (queue->deal_next + k) % nside;
+        if (!queue->queues[channel].closed
+            && !queue->queues[channel].exclusive)
+        {
+            q = &queue->queues[channel];
+            queue->deal_next = channel;
+            break;
+        }
+    }
+    if (q == NULL) {
+        return queue_put(queue, &queue->queues[0], sender, kind, id, val, 0);
+    }
+
+    struct item *i = queue_new_item(queue, sender, kind, id, val);
+    if (i == NULL) {
+        return -1;
+    }
+    i->prev = q->task_last;
+    if (q->task_last == NULL) {
+        q->task_first = i;
+    } else {
+        q->task_last->next = i;
+    }
+    q->task_last = i;
+    q->ntasks++;
+
+    // Whoever is asleep can steal it, if its owner isn't.
+    if (!queue_wake(q)) {
+        queue_wake_push_listener(queue);
+    }
+    if (queue->ntasks == 0) {
+        queue_notify(queue, &queue->queues[0]);
+    }
+    queue->ntasks++;
+
+    return 0;
+}
+
+static void
+queue_pop_task(MemQueue *queue, struct queue *q, int steal, MemQueueItem *it)
+{
+    // The lock must be held for this operation
+
+    assert(q->task_first != NULL);
+
+    struct item *i = steal ? q->task_last : q->task_first;
+    if (i->prev != NULL) {
+        i->prev->next = i->next;
+    } else {
+        q->task_first = i->next;
+    }
+    if (i->next != NULL) {
+        i->next->prev = i->prev;
+    } else {
+        q->task_last = i->prev;
+    }
+    q->ntasks--;
+    queue->ntasks--;
+    if (q->orphaned && q->ntasks == 0 && q->first == NULL) {
+        // See MemQueue_ReleaseChannel().
+        q->orphaned = 0;
+        q->released = 1;
+    }
+
+    it->event = i->kind;
+    it->sender = (RemoteObject *)i->sender;
+    it->id = i->id;
+    it->val = (RemoteObject *)i->val;
+    it->bcast = NULL;
+
+    queue_free_item(queue, i);
+}
+
+static struct queue *
+queue_steal_victim(MemQueue *queue)
+{
+    // The lock must be held for this operation
+    //
+    // The side channel with the most tasks; closed ones included, as
+    // their listeners won't take them.
+
+    struct queue *victim = NULL;
+    for (ssize_t i = 1; i < queue->nqueues; i++) {
+        struct queue *q = &queue->queues[i];
+        if (q->ntasks > 0 && (victim == NULL || q->ntasks > victim->ntasks)) {
+            victim = q;
+        }
+    }
+    return victim;
+}
+
+static int
+queue_has_work(MemQueue *queue)
+{
+    // The lock must be held for this operation
+    //
+    // Whether there are pushed messages anyone can take.
+
+    return queue->queues[0].first != NULL || queue->ntasks > 0
+        || queue->fair_length > 0;
+}
+
+static struct queue *
+queue_fair_next(MemQueue *queue)
+{
+    // The lock must be held for this operation
+    //
+    // Deficit round-robin over all channels of a fair intake queue,
+    // every message costing 1: a channel's turn gets it up to
+    // FAIR_QUANTUM messages taken before the next non-empty channel's.
+    // Only channels whose first message has the highest priority
+    // waiting take turns. NULL if all are empty.
+
+    int top = -1;
+    for (ssize_t i = 0; i < queue->nqueues; i++) {
+        struct item *first = queue->queues[i].first;
+        if (first != NULL && first->priority > top) {
+            top = first->priority;
+        }
+    }
+    if (top < 0) {
+        return NULL;
+    }
+
+    for (;;) {
+        struct queue *q = &queue->queues[queue->fair_next];
+        if (q->first != NULL && q->first->priority == top) {
+            if (q->deficit == 0) {
+                q->deficit = FAIR_QUANTUM;
+            }
+            q->deficit--;
+            if (q->length == 1) {
+                // Empty channels don't save up for later.
+                q->deficit = 0;
+            }
+            if (q->deficit == 0) {
+                queue->fair_next = (queue->fair_next + 1) % queue->nqueues;
+            }
+            return q;
+        }
+        if (q->first == NULL) {
+            q->deficit = 0;
+        }
+        queue->fair_next = (queue->fair_next + 1) % queue->nqueues;
+    }
+}
+
+static void
+queue_close_channel(MemQueue *queue, struct queue *q)
+{
+    // The lock must be held for this operation
+
+    if (!q->closed) {
+        q->closed = 1;
+        // Broadcasts sent from now on don't count on this channel.
+        q->bcast_end = queue->bcast_next;
+        queue->nreaders--;
+    }
+}
+
+static int
+queue_has_broadcast(MemQueue *queue, struct queue *q)
+{
+    uint64_t end = queue->bcast_next;
+    if (q->bcast_end < end) {
+        end = q->bcast_end;
+    }
+    return q->bcast_cursor < end;
+}
+
+static void
+queue_take_broadcast(MemQueue *queue, struct queue *q, MemQueueItem *it)
+{
+    // The lock must be held for this operation
+
+    assert(queue_has_broadcast(queue, q));
+
+    // Entries before the cursor aren't released until this channel
+    // is done with them, so it's somewhere after the first one.
+    struct bcast *b = queue->bcast_first;
+    while (b->seq < q->bcast_cursor) {
+        b = b->next;
+    }
+    q->bcast_cursor = b->seq + 1;
+
+    it->event = E_HUB_BROADCAST;
+    it->sender = (RemoteObject *)b->sender;
+    it->id = 0;
+    it->val = (RemoteObject *)b->val;
+    it->bcast = b;
+}
+
+static int
+queue_wait(pthread_cond_t *cond, pthread_mutex_t *mut,
+           const struct timespec *deadline)
+{
+    // The lock must be held for this operation
+    //
+    // Returns 1 if `deadline` has passed; waits forever if it's NULL.
+
+    int r;
+    Py_BEGIN_ALLOW_THREADS
+    if (deadline == NULL) {
+        r = pthread_cond_wait(cond, mut);
+    } else {
+        r = pthread_cond_timedwait(cond, mut, deadline);
+    }
+    Py_END_ALLOW_THREADS
+    return r == ETIMEDOUT;
+}
+
+static int
+queue_wait_space(MemQueue *queue, module_state *state, struct queue *q,
+                 int block, const struct timespec *deadline)
+{
+    // The lock must be held for this operation
+    //
+    // Waits for room in a bounded list channel. Returns 1 if it's
+    // still full when we give up.
+
+    if (q->capacity == 0 || q->length < q->capacity) {
+        return 0;
+    }
+    q->nfull++;
+
+    int timed_out = 0;
+    while (q->length >= q->capacity && !q->closed) {
+        if (!block || timed_out) {
+            return 1;
+        }
+        queue->nfull_waiting++;
+        timed_out = queue_wait(&queue->space, &queue->mut, deadline);
+        queue->nfull_waiting--;
+        if (queue->closed) {
+            PyErr_SetString(state->ClosedQueueError,
+                            "can't put, the queue is closed");
+            return -1;
+        }
+        if (PyErr_CheckSignals()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+ring_wake(MemQueue *queue, module_state *state)
+{
+    // Called after a push. Listeners announce themselves (and look at
+    // the ring again) before they wait, and we look for them after
+    // pushing, so either they see the message or we see them.
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (queue->nwaiting_total == 0 && queue->nfds == 0) {
+        return;
+    }
+    if (queue_lock(queue, state)) {
+        // Closed; everyone has been woken up already.
+        PyErr_Clear();
+        return;
+    }
+    queue_wake_push_listener(queue);
+    queue_notify(queue, &queue->queues[0]);
+    queue_unlock(queue);
+}
+
+static int
+ring_put(MemQueue *queue, module_state *state,
+         PyObject *sender, memqueue_event_t kind, uint64_t id, PyObject *val,
+         int block, const struct timespec *deadline)
+{
+    // Returns 1 if the ring is still full when we give up.
+
+    struct queue *q = &queue->queues[0];
+
+    if (queue->closed) {
+        PyErr_SetString(state->ClosedQueueError,
+                        "can't put, the queue is closed");
+        return -1;
+    }
+
+    Py_XINCREF(val);
+
+    if (MemRing_Push(q->ring, (int)kind, sender, id, val)) {
+        // Full, wait for a listener to make room.
+        if (queue_lock(queue, state)) {
+            Py_XDECREF(val);
+            return -1;
+        }
+        q->nfull++;
+        queue->nfull_waiting++;
+        atomic_thread_fence(memory_order_seq_cst);
+        int timed_out = 0;
+        while (MemRing_Push(q->ring, (int)kind, sender, id, val)) {
+            if (queue->closed) {
+                queue->nfull_waiting--;
+                queue_unlock(queue);
+                Py_XDECREF(val);
+                PyErr_SetString(state->ClosedQueueError,
+                                "can't put, the queue is closed");
+                return -1;
+            }
+            if (!block || timed_out) {
+                queue->nfull_waiting--;
+                queue_unlock(queue);
+                Py_XDECREF(val);
+                return 1;
+            }
+            timed_out = queue_wait(&queue->space, &queue->mut, deadline);
+            if (PyErr_CheckSignals()) {
+                queue->nfull_waiting--;
+                queue_unlock(queue);
+                Py_XDECREF(val);
+                return -1;
+            }
+        }
+        queue->nfull_waiting--;
+        queue_unlock(queue);
+    }
+
+    ring_wake(queue, state);
+    return 0;
+}
+
+static int
+ring_get(MemQueue *queue, module_state *state, ssize_t channel, int block,
+         const struct timespec *deadline, MemQueueItem *it)
+{
+    struct queue *q_push = &queue->queues[0];
+    struct queue *q_mine = NULL;
+    if (channel != 0) {
+        assert(channel >= 1 && channel < queue->nqueues);
+        q_mine = &queue->queues[channel];
+    }
+    int shared = q_mine == NULL || !q_mine->exclusive;
+
+    int timed_out = 0;
+    for (;;) {
+        if (queue->closed) {
+            PyErr_SetString(state->ClosedQueueError,
+                            "can't get, the queue is closed");
+            return -1;
+        }
+        if (q_mine != NULL && (q_mine->length > 0 || q_mine->closed
+                               || queue_has_broadcast(queue, q_mine)))
+        {
+            // Side channels are lists, they need the lock.
+            if (queue_lock(queue, state)) {
+                return -1;
+            }
+            if (q_mine->first != NULL || queue_has_broadcast(queue, q_mine)) {
+                if (q_mine->first != NULL) {
+                    queue_pop(queue, q_mine, &it->event, &it->sender,
+                              &it->id, &it->val);
+                    it->bcast = NULL;
+                } else {
+                    queue_take_broadcast(queue, q_mine, it);
+                }
+                // We could have been woken for a channel 0 message.
+                if (queue_length(q_push) > 0) {
+                    queue_wake_push_listener(queue);
+                }
+                queue_unlock(queue);
+                return 0;
+            }
+            queue_unlock(queue);
+            // Don't take more shared work once the channel is closed.
+            PyErr_SetString(state->ClosedQueueError,
+                            "can't get, the channel is closed");
+            return -1;
+        }
+        int kind;
+        if (shared
+            && !MemRing_Pop(q_push->ring, &kind, (PyObject **)&it->sender,
+                            &it->id, (PyObject **)&it->val))
+        {
+            it->event = (memqueue_event_t)kind;
+            it->bcast = NULL;
+            break;
+        }
+        if (!block || timed_out) {
+            return 1;
+        }
+
+        if (queue_lock(queue, state)) {
+            return -1;
+        }
+        struct queue *q_wait = q_mine != NULL ? q_mine : q_push;
+        q_wait->nwaiting++;
+        queue->nwaiting_total++;
+        atomic_thread_fence(memory_order_seq_cst);
+        int waited = 0;
+        if ((!shared || queue_length(q_push) == 0)
+            && (q_mine == NULL || (q_mine->first == NULL && !q_mine->closed
+                                   && !queue_has_broadcast(queue, q_mine))))
+        {
+            waited = 1;
+            timed_out = queue_wait(&q_wait->cond, &queue->mut, deadline);
+        }
+        q_wait->nwaiting--;
+        queue->nwaiting_total--;
+        if (waited && q_wait->nsignaled > 0) {
+            q_wait->nsignaled--;
+        }
+        queue_unlock(queue);
+
+        if (PyErr_CheckSignals()) {
+            return -1;
+        }
+    }
+
+    // Pairs with the fence in ring_put(): a producer waiting for room
+    // either sees the slot we've just freed or we see it waiting.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (queue->nfull_waiting > 0 || queue->nwaiting_total > 0) {
+        if (queue_lock(queue, state)) {
+            // We've got the message; the next call will raise.
+            PyErr_Clear();
+            return 0;
+        }
+        pthread_cond_broadcast(&queue->space);
+        // A burst could have arrived while we were waking up: pass the
+        // wakeup on.
+        if (queue_length(q_push) > 0) {
+            queue_wake_push_listener(queue);
+        }
+        queue_unlock(queue);
+    }
+    return 0;
+}
+
+static ssize_t
+ring_get_many(MemQueue *queue, module_state *state, ssize_t channel,
+              int block, const struct timespec *deadline,
+              MemQueueItem *items, ssize_t max)
+{
+    // No lock to amortize here, the ring is popped one slot at a time.
+    ssize_t n = 0;
+    while (n < max) {
+        int r = ring_get(queue, state, channel, n == 0 ? block : 0,
+                         deadline, &items[n]);
+        if (r < 0) {
+            if (n > 0 && PyErr_ExceptionMatches(state->ClosedQueueError)) {
+                // Return what we've got, the next call will raise.
+                PyErr_Clear();
+                break;
+            }
+            return -1;
+        }
+        if (r == 1) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+static int
+queue_init(MemQueue *o, ssize_t max_side_channels, ssize_t capacity,
+           size_t ring_capacity, int stealing, int fair)
+{
+    if (pthread_mutex_init(&o->mut, NULL)) {
+        Py_FatalError("Failed to initialize a mutex");
+    }
+    if (pthread_cond_init(&o->space, NULL)) {
+        Py_FatalError("Failed to initialize a condition");
+    }
+
+    o->ring_capacity = ring_capacity;
+    o->nfull_waiting = 0;
+    o->nwaiting_total = 0;
+
+    o->stealing = stealing;
+    o->ntasks = 0;
+    o->deal_next = 0;
+
+    o->fair = fair;
+    o->fair_next = 0;
+    o->fair_length = 0;
+
+    o->bcast_first = NULL;
+    o->bcast_last = NULL;
+    o->bcast_next = 0;
+    o->nreaders = 0;
+
+    o->queues = PyMem_RawMalloc(
+        ((uint64_t)max_side_channels + 1) * (sizeof (struct queue))
+    );
+    if (o->queues == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (queue_init_channel(o, &o->queues[0], capacity)) {
+        return -1;
+    }
+
+    o->nqueues = 1;
+    o->max_queues = max_side_channels;
+
+    o->reuse = NULL;
+    o->reuse_num = 0;
+
+    o->nfds = 0;
+    o->wake_next = 0;
+
+    o->closed = 0;
+    o->destroyed = 0;
+    return 0;
+}
+
+int
+MemQueue_Init(MemQueue *o, ssize_t max_side_channels, ssize_t capacity)
+{
+    return queue_init(o, max_side_channels, capacity, 0, 0, 0);
+}
+
+int
+MemQueue_InitRing(MemQueue *o, ssize_t max_side_channels, size_t capacity)
+{
+    return queue_init(o, max_side_channels, 0, capacity, 0, 0);
+}
+
+int
+MemQueue_InitStealing(MemQueue *o, ssize_t max_side_channels)
+{
+    return queue_init(o, max_side_channels, 0, 0, 1, 0);
+}
+
+int
+MemQueue_InitFair(MemQueue *o, ssize_t max_side_channels)
+{
+    return queue_init(o, max_side_channels, 0, 0, 0, 1);
+}
+
+ssize_t
+MemQueue_AddChannel(MemQueue *queue, module_state *state, ssize_t capacity,
+                    int exclusive)
+{
+    ssize_t channel;
+
+    if (queue_lock(queue, state)) {
+        return -1;
+    }
+
+    struct queue *qq = queue->queues;
+
+    for (channel = 1; channel < queue->nqueues; channel++) {
+        if (qq[channel].released) {
+            assert(queue_length(&qq[channel]) == 0);
+            assert(qq[channel].nwaiting == 0);
+            qq[channel].nsignaled = 0;
+            qq[channel].capacity = capacity;
+            qq[channel].nfull = 0;
+            qq[channel].deficit = 0;
+            qq[channel].bcast_cursor = queue->bcast_next;
+            qq[channel].bcast_end = UINT64_MAX;
+            qq[channel].closed = 0;
+            qq[channel].released = 0;
+            qq[channel].orphaned = 0;
+            qq[channel].generation++;
+            qq[channel].exclusive = exclusive ? 1 : 0;
+            queue->nreaders++;
+            queue_unlock(queue);
+            return channel;
+        }
+    }
+
+    if ((queue->nqueues + 1) >= queue->max_queues) {
+        queue_unlock(queue);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "max number of worker queues reached");
+        return -1;
+    }
+
+    channel = queue->nqueues;
+    if (queue_init_channel(queue, &qq[channel], capacity)) {
+        queue_unlock(queue);
+        return -1;
+    }
+    qq[channel].exclusive = exclusive ? 1 : 0;
+
+    queue->nqueues++;
+    queue->nreaders++;
+
+    queue_unlock(queue);
+    return channel;
+}
+
+int
+MemQueue_CloseChannel(MemQueue *queue, module_state *state, ssize_t channel)
+{
+    if (queue_lock(queue, state)) {
+        return -1;
+    }
+    if (channel < 1 || channel >= queue->nqueues
+        || queue->queues[channel].released)
+    {
+        queue_unlock(queue);
+        PyErr_Format(PyExc_ValueError, "no channel %zd", channel);
+        return -1;
+    }
+    queue_close_channel(queue, &queue->queues[channel]);
+    queue_wake_all(&queue->queues[channel]);
+    queue_notify_fd(queue->queues[channel].efd);
+    queue_unlock(queue);
+    return 0;
+}
+
+MEMHIVE_REMOTE(void)
+MemQueue_ReleaseChannel(MemQueue *queue, ssize_t channel)
+{
+    // Can be called after the queue is closed, so not `queue_lock()`.
+    if (pthread_mutex_lock(&queue->mut)) {
+        Py_FatalError("can't acquire the queue lock");
+    }
+    struct queue *q = &queue->queues[channel];
+    queue_close_channel(queue, q);
+    // Let go of the broadcasts it hasn't taken.
+    for (struct bcast *b = queue->bcast_first; b != NULL; b = b->next) {
+        if (b->seq >= q->bcast_cursor && b->seq < q->bcast_end) {
+            b->pending--;
+        }
+    }
+    q->bcast_cursor = q->bcast_end;
+    q->waiter = NULL;
+    if (q->efd >= 0) {
+        close(q->efd);
+        q->efd = -1;
+        queue->nfds--;
+    }
+    // Undelivered messages hold references owned by their senders,
+    // so a channel with any left is never reused. Tasks dealt to it
+    // are still there for others to steal; the channel is released
+    // when the last of them is, see queue_pop_task().
+    if (queue_length(q) == 0 && q->ntasks == 0) {
+        q->released = 1;
+    } else if (queue_length(q) == 0) {
+        q->orphaned = 1;
+    }
+    queue_unlock(queue);
+}
+
+uint64_t
+MemQueue_ChannelGeneration(MemQueue *queue, ssize_t channel)
+{
+    return queue->queues[channel].generation;
+}
+
+static void
+queue_raw_lock(MemQueue *queue)
+{
+    // For callers without a thread state, who can't have queue_lock()
+    // release the GIL.
+    if (pthread_mutex_lock(&queue->mut)) {
+        Py_FatalError("can't acquire the queue lock");
+    }
+}
+
+void
+MemQueue_AttachChannel(MemQueue *queue, ssize_t channel,
+                       MemQueueWaiter *waiter)
+{
+    queue_raw_lock(queue);
+    struct queue *q = &queue->queues[channel];
+    assert(!q->released);
+    q->waiter = waiter;
+    queue_unlock(queue);
+}
+
+void
+MemQueue_DetachChannel(MemQueue *queue, ssize_t channel,
+                       MemQueueWaiter *waiter)
+{
+    queue_raw_lock(queue);
+    struct queue *q = &queue->queues[channel];
+    if (q->waiter == waiter) {
+        q->waiter = NULL;
+    }
+    queue_unlock(queue);
+}
+
+static int
+queue_channel_ready(MemQueue *queue, struct queue *q)
+{
+    // The lock must be held for this operation
+    //
+    // Whether MemQueue_ListenMany() on `q` would return right away.
 
-    i->next = NULL;
-    if (q->last == NULL) {
-        q->last = i;
-        q->first = i;
-    } else {
-        q->last->next = i;
-        q->last = i;
+    if (q->first != NULL || q->closed || queue_has_broadcast(queue, q)) {
+        return 1;
+    }
+    if (q->exclusive) {
+        return 0;
     }
+    return q->task_first != NULL || queue_has_work(queue)
+        || queue_length(&queue->queues[0]) > 0;
+}
 
-    if (q->length == 0) {
-        pthread_cond_broadcast(&queue->cond);
+ssize_t
+MemQueue_WaitAny(MemQueue *queue, MemQueueWaiter *waiter,
+                 const ssize_t *channels, ssize_t n, ssize_t start)
+{
+    ssize_t ret = -1;
+
+    queue_raw_lock(queue);
+
+    // Announce ourselves before looking, like ring_get() does: ring
+    // producers only take the lock to wake someone up if they see us.
+    waiter->waiting = 1;
+    queue->nwaiting_total++;
+    for (;;) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (queue->closed) {
+            ret = -1;
+            break;
+        }
+        if (waiter->interrupted) {
+            waiter->interrupted = 0;
+            ret = -2;
+            break;
+        }
+        for (ssize_t k = 0; k < n; k++) {
+            ssize_t i = (start + k) % n;
+            if (queue_channel_ready(queue, &queue->queues[channels[i]])) {
+                ret = i;
+                break;
+            }
+        }
+        if (ret >= 0) {
+            break;
+        }
+        pthread_cond_wait(&waiter->cond, &queue->mut);
+        waiter->signaled = 0;
     }
+    waiter->waiting = 0;
+    waiter->signaled = 0;
+    queue->nwaiting_total--;
 
-    q->length++;
+    queue_unlock(queue);
+    return ret;
+}
 
-    return 0;
+void
+MemQueue_Interrupt(MemQueue *queue, MemQueueWaiter *waiter)
+{
+    queue_raw_lock(queue);
+    waiter->interrupted = 1;
+    pthread_cond_signal(&waiter->cond);
+    queue_unlock(queue);
 }
 
-int
-MemQueue_Init(MemQueue *o, ssize_t max_side_channels)
+ssize_t
+MemQueue_Depth(MemQueue *queue, module_state *state, ssize_t channel)
 {
-    if (pthread_mutex_init(&o->mut, NULL)) {
-        Py_FatalError("Failed to initialize a mutex");
+    if (queue_lock(queue, state)) {
+        return -1;
     }
-
-    if (pthread_cond_init(&o->cond, NULL)) {
-        Py_FatalError("Failed to initialize a condition");
+    ssize_t length = queue_length(&queue->queues[channel]);
+    if (channel == 0) {
+        length += queue->ntasks;
     }
+    queue_unlock(queue);
+    return length;
+}
 
-    o->queues = PyMem_RawMalloc(
-        ((uint64_t)max_side_channels + 1) * (sizeof (struct queue))
-    );
-    if (o->queues == NULL) {
-        PyErr_NoMemory();
+int
+MemQueue_Stats(MemQueue *queue, module_state *state, ssize_t channel,
+               MemQueueStats *stats)
+{
+    if (queue_lock(queue, state)) {
         return -1;
     }
-    o->queues[0].first = NULL;
-    o->queues[0].last = NULL;
-    o->queues[0].length = 0;
-
-    o->nqueues = 1;
-    o->max_queues = max_side_channels;
-
-    o->reuse = NULL;
-    o->reuse_num = 0;
-
-    o->closed = 0;
-    o->destroyed = 0;
+    struct queue *q = &queue->queues[channel];
+    stats->depth = queue_length(q);
+    if (channel == 0) {
+        stats->depth += queue->ntasks;
+    }
+    stats->capacity = q->capacity;
+    stats->nfull = q->nfull;
+    queue_unlock(queue);
     return 0;
 }
 
-ssize_t
-MemQueue_AddChannel(MemQueue *queue, module_state *state)
+int
+MemQueue_ReadinessFd(MemQueue *queue, module_state *state, ssize_t channel)
 {
-    ssize_t channel;
-
+#ifdef __linux__
     if (queue_lock(queue, state)) {
         return -1;
     }
-
-    if ((queue->nqueues + 1) >= queue->max_queues) {
+    if (channel < 0 || channel >= queue->nqueues
+        || queue->queues[channel].released)
+    {
         queue_unlock(queue);
-        PyErr_SetString(PyExc_RuntimeError,
-                        "max number of worker queues reached");
+        PyErr_Format(PyExc_ValueError, "no channel %zd", channel);
         return -1;
     }
-
-    struct queue *qq = queue->queues;
-    channel = queue->nqueues;
-    qq[channel].first = NULL;
-    qq[channel].last = NULL;
-    qq[channel].length = 0;
-
-    queue->nqueues++;
-
+    struct queue *q = &queue->queues[channel];
+    if (q->efd < 0) {
+        q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (q->efd < 0) {
+            queue_unlock(queue);
+            PyErr_SetFromErrno(PyExc_OSError);
+            return -1;
+        }
+        queue->nfds++;
+        // Don't make the listener wait for what's already there.
+        if (queue_length(q) > 0 || queue_length(&queue->queues[0]) > 0
+            || queue->ntasks > 0 || queue->fair_length > 0
+            || (channel > 0 && queue_has_broadcast(queue, q)))
+        {
+            queue_notify_fd(q->efd);
+        }
+    }
+    int efd = q->efd;
     queue_unlock(queue);
-    return channel;
+    return efd;
+#else
+    PyErr_SetString(PyExc_NotImplementedError,
+                    "readiness fds are only supported on Linux");
+    return -1;
+#endif
 }
 
 int
 MemQueue_HubBroadcast(MemQueue *queue,  module_state *state,
                       PyObject *sender, PyObject *msg)
 {
+    struct bcast *done = NULL;
+    int ret = 0;
+
     if (queue_lock(queue, state)) {
         return -1;
     }
 
-    for (ssize_t i = 1; i < queue->nqueues; i++) {
-        if (queue_put(queue, &queue->queues[i],
-                      sender, E_HUB_BROADCAST, 0, msg))
-        {
+    // Unlink what every listener is done with; the references are
+    // dropped after unlocking.
+    while (queue->bcast_first != NULL && queue->bcast_first->pending == 0) {
+        struct bcast *first = queue->bcast_first;
+        queue->bcast_first = first->next;
+        first->next = done;
+        done = first;
+    }
+    if (queue->bcast_first == NULL) {
+        queue->bcast_last = NULL;
+    }
+
+    if (queue->nreaders > 0) {
+        struct bcast *b = PyMem_RawMalloc(sizeof *b);
+        if (b == NULL) {
             queue_unlock(queue);
-            return -1;
+            PyErr_NoMemory();
+            ret = -1;
+            goto done;
+        }
+        Py_XINCREF(msg);
+        b->val = msg;
+        b->sender = sender;     // borrow, like in queue_put()
+        b->seq = queue->bcast_next;
+        b->pending = queue->nreaders;
+        b->next = NULL;
+        if (queue->bcast_last == NULL) {
+            queue->bcast_first = b;
+        } else {
+            queue->bcast_last->next = b;
+        }
+        queue->bcast_last = b;
+        queue->bcast_next++;
+
+        // Only waking listeners up is still O(channels).
+        if (queue->nwaiting_total > 0 || queue->nfds > 0) {
+            for (ssize_t i = 1; i < queue->nqueues; i++) {
+                struct queue *q = &queue->queues[i];
+                if (q->closed) {
+                    continue;
+                }
+                queue_wake(q);
+                queue_notify_fd(q->efd);
+            }
         }
     }
 
     queue_unlock(queue);
-    return 0;
+
+done:
+    while (done != NULL) {
+        struct bcast *next = done->next;
+        Py_XDECREF(done->val);
+        PyMem_RawFree(done);
+        done = next;
+    }
+    return ret;
+}
+
+MEMHIVE_REMOTE(void)
+MemQueue_BroadcastDone(MemQueueItem *item)
+{
+    if (item->event == E_HUB_BROADCAST && item->bcast != NULL) {
+        item->bcast->pending--;
+        item->bcast = NULL;
+    }
 }
 
 MEMHIVE_REMOTE(int)
@@ -202,20 +1334,147 @@ MemQueue_Put(MemQueue *queue,
              uint64_t id,
              PyObject *val)
 {
+    return MemQueue_PutWait(queue, state, kind, channel, sender, id, val,
+                            0, 1, NULL);
+}
+
+MEMHIVE_REMOTE(int)
+MemQueue_PutWait(MemQueue *queue,
+                 module_state *state,
+                 memqueue_event_t kind,
+                 ssize_t channel,
+                 PyObject *sender,
+                 uint64_t id,
+                 PyObject *val,
+                 int priority,
+                 int block,
+                 const struct timespec *deadline)
+{
+    assert(priority >= 0 && priority < MEMQUEUE_PRIORITIES);
+
+    struct queue *q = &queue->queues[channel];
+    if (q->ring != NULL) {
+        if (priority > 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "the ring buffer has no priorities");
+            return -1;
+        }
+        return ring_put(queue, state, sender, kind, id, val,
+                        block, deadline);
+    }
+
     if (queue_lock(queue, state)) {
         return -1;
     }
-    int ret = queue_put(queue, &queue->queues[channel], sender, kind, id, val);
+    int ret = queue_wait_space(queue, state, q, block, deadline);
+    if (ret == 0) {
+        // Prioritized messages skip the deques, everyone checks
+        // channel 0 for them first.
+        ret = queue->stealing && channel == 0 && priority == 0
+            ? queue_put_task(queue, sender, kind, id, val)
+            : queue_put(queue, q, sender, kind, id, val, priority);
+    }
     queue_unlock(queue);
     return ret;
 }
 
 MEMHIVE_REMOTE(int)
-MemQueue_Listen(MemQueue *queue, module_state *state,
-                ssize_t channel,
-                memqueue_event_t *event, RemoteObject **sender,
-                uint64_t *id, RemoteObject **val)
+MemQueue_PutTo(MemQueue *queue,
+               module_state *state,
+               memqueue_event_t kind,
+               ssize_t channel,
+               uint64_t generation,
+               PyObject *sender,
+               uint64_t id,
+               PyObject *val)
+{
+    assert(channel > 0);
+
+    if (queue_lock(queue, state)) {
+        return -1;
+    }
+    struct queue *q = &queue->queues[channel];
+    int ret = 1;
+    // Waiting for room lets go of the lock, so check again after it.
+    if (!q->closed && !q->released && q->generation == generation) {
+        ret = queue_wait_space(queue, state, q, 1, NULL);
+        if (ret == 0) {
+            ret = q->closed || q->released || q->generation != generation
+                ? 1
+                : queue_put(queue, q, sender, kind, id, val, 0);
+        }
+    }
+    queue_unlock(queue);
+    return ret;
+}
+
+MEMHIVE_REMOTE(int)
+MemQueue_PutMany(MemQueue *queue,
+                 module_state *state,
+                 memqueue_event_t kind,
+                 ssize_t channel,
+                 PyObject *sender,
+                 uint64_t first_id,
+                 PyObject *const *vals,
+                 ssize_t n,
+                 int block,
+                 const struct timespec *deadline,
+                 ssize_t *nput)
+{
+    int ret = 0;
+    ssize_t i = 0;
+
+    struct queue *q = &queue->queues[channel];
+    if (q->ring != NULL) {
+        for (; i < n; i++) {
+            ret = ring_put(queue, state, sender, kind,
+                           first_id + (uint64_t)i, vals[i], block, deadline);
+            if (ret) {
+                break;
+            }
+        }
+        goto done;
+    }
+
+    if (queue_lock(queue, state)) {
+        ret = -1;
+        goto done;
+    }
+    for (; i < n; i++) {
+        uint64_t id = first_id + (uint64_t)i;
+        ret = queue_wait_space(queue, state, q, block, deadline);
+        if (ret == 0) {
+            ret = queue->stealing && channel == 0
+                ? queue_put_task(queue, sender, kind, id, vals[i])
+                : queue_put(queue, q, sender, kind, id, vals[i], 0);
+        }
+        if (ret) {
+            break;
+        }
+    }
+    queue_unlock(queue);
+
+done:
+    if (nput != NULL) {
+        *nput = i;
+    }
+    return ret;
+}
+
+static ssize_t
+queue_get_many(MemQueue *queue, module_state *state, ssize_t channel,
+               int block, const struct timespec *deadline,
+               MemQueueItem *items, ssize_t max)
 {
+    // Takes up to `max` messages under one lock acquisition, waiting
+    // for the first one unless `block` is 0 (until `deadline` unless
+    // it's NULL). Returns how many were taken; 0 if none came.
+
+    if (queue->ring_capacity > 0) {
+        return ring_get_many(queue, state, channel, block, deadline,
+                             items, max);
+    }
+
     if (queue_lock(queue, state)) {
         return -1;
     }
@@ -226,16 +1485,34 @@ MemQueue_Listen(MemQueue *queue, module_state *state,
         assert(channel >= 1 && channel < queue->nqueues);
         q_mine = &queue->queues[channel];
     }
+    int shared = q_mine == NULL || !q_mine->exclusive;
 
+    int timed_out = 0;
     while (
         queue->closed == 0
-        && q_push->first == NULL
-        && (q_mine == NULL || q_mine->first == NULL)
+        && !(shared && queue_has_work(queue))
+        && (q_mine == NULL || (q_mine->first == NULL && !q_mine->closed
+                               && !queue_has_broadcast(queue, q_mine)))
     ) {
-        Py_BEGIN_ALLOW_THREADS
-        pthread_cond_wait(&queue->cond, &queue->mut);
-        Py_END_ALLOW_THREADS
+        if (!block || timed_out) {
+            queue_unlock(queue);
+            return 0;
+        }
+        struct queue *q_wait = q_mine != NULL ? q_mine : q_push;
+        q_wait->nwaiting++;
+        queue->nwaiting_total++;
+        timed_out = queue_wait(&q_wait->cond, &queue->mut, deadline);
+        queue->nwaiting_total--;
+        q_wait->nwaiting--;
+        if (q_wait->nsignaled > 0) {
+            q_wait->nsignaled--;
+        }
         if (PyErr_CheckSignals()) {
+            // We could have been woken for a message; let someone
+            // else have it.
+            if (queue_has_work(queue)) {
+                queue_wake_push_listener(queue);
+            }
             queue_unlock(queue);
             return -1;
         }
@@ -248,41 +1525,131 @@ MemQueue_Listen(MemQueue *queue, module_state *state,
         return -1;
     }
 
-    struct queue *q = q_push;
-    if (q_mine != NULL && q_mine->first != NULL) {
-        q = q_mine;
+    if (q_mine != NULL && q_mine->first == NULL && q_mine->closed
+        && !queue_has_broadcast(queue, q_mine))
+    {
+        // Don't take more shared work once the channel is closed.
+        if (queue_has_work(queue)) {
+            queue_wake_push_listener(queue);
+        }
+        queue_unlock(queue);
+        PyErr_SetString(state->ClosedQueueError,
+                        "can't get, the channel is closed");
+        return -1;
     }
-    assert(q->first != NULL);
-
-    struct item *prev_first = q->first;
-    *event = prev_first->kind;
-    *val = (RemoteObject*)prev_first->val;
-    *sender = (RemoteObject*)prev_first->sender;
-    *id = prev_first->id;
-
-    q->first = prev_first->next;
-    q->length--;
 
-    if (q->first == NULL) {
-        q->last = NULL;
-        q->length = 0;
+    ssize_t n = 0;
+    while (n < max) {
+        struct queue *q;
+        if (q_mine == NULL && queue->fair) {
+            q = queue_fair_next(queue);
+            if (q == NULL) {
+                break;
+            }
+        } else if (shared && (q_mine == NULL || !q_mine->closed)
+            && q_push->first != NULL && q_push->first->priority > 0
+            && (q_mine == NULL || q_mine->first == NULL
+                || q_push->first->priority > q_mine->first->priority))
+        {
+            // Prioritized shared work goes before lower priority
+            // messages of our own, broadcasts and deques.
+            q = q_push;
+        } else if (q_mine != NULL && q_mine->first != NULL) {
+            q = q_mine;
+        } else if (q_mine != NULL && queue_has_broadcast(queue, q_mine)) {
+            queue_take_broadcast(queue, q_mine, &items[n++]);
+            continue;
+        } else if (q_mine != NULL && q_mine->closed) {
+            break;
+        } else if (q_mine != NULL && q_mine->task_first != NULL) {
+            queue_pop_task(queue, q_mine, 0, &items[n++]);
+            continue;
+        } else if (shared && q_push->first != NULL) {
+            q = q_push;
+        } else if (shared && queue->ntasks > 0) {
+            queue_pop_task(queue, queue_steal_victim(queue), 1, &items[n++]);
+            continue;
+        } else {
+            break;
+        }
+        MemQueueItem *it = &items[n++];
+        queue_pop(queue, q, &it->event, &it->sender, &it->id, &it->val);
+        it->bcast = NULL;
+        if (queue->fair && q->closed && q->first == NULL) {
+            // Its sender left before we got to the rest, see
+            // MemQueue_ReleaseChannel().
+            q->released = 1;
+        }
     }
 
-    if (queue->reuse_num < MAX_REUSE) {
-        prev_first->sender = NULL;
-        prev_first->val = NULL;
-        prev_first->next = queue->reuse;
-        queue->reuse = prev_first;
-        queue->reuse_num++;
-    } else {
-        PyMem_RawFree(prev_first);
+    // We could have been woken for a channel 0 message and taken one
+    // of our own instead, or a burst could have arrived while we were
+    // waking up: pass the wakeup on.
+    if (queue_has_work(queue)) {
+        queue_wake_push_listener(queue);
+    }
+    if (q_mine != NULL
+        && (q_mine->first != NULL || queue_has_broadcast(queue, q_mine)))
+    {
+        queue_wake(q_mine);
+    }
+    if (queue->nfull_waiting > 0) {
+        pthread_cond_broadcast(&queue->space);
     }
 
     queue_unlock(queue);
 
+    return n;
+}
+
+static int
+queue_get(MemQueue *queue, module_state *state, ssize_t channel, int block,
+          memqueue_event_t *event, RemoteObject **sender,
+          uint64_t *id, RemoteObject **val)
+{
+    // Returns 1 if `block` is 0 and there's nothing to get.
+
+    MemQueueItem item;
+    ssize_t n = queue_get_many(queue, state, channel, block, NULL,
+                               &item, 1);
+    if (n <= 0) {
+        return n < 0 ? -1 : 1;
+    }
+    *event = item.event;
+    *sender = item.sender;
+    *id = item.id;
+    *val = item.val;
     return 0;
 }
 
+MEMHIVE_REMOTE(int)
+MemQueue_Listen(MemQueue *queue, module_state *state,
+                ssize_t channel,
+                memqueue_event_t *event, RemoteObject **sender,
+                uint64_t *id, RemoteObject **val)
+{
+    return queue_get(queue, state, channel, 1, event, sender, id, val);
+}
+
+MEMHIVE_REMOTE(int)
+MemQueue_TryListen(MemQueue *queue, module_state *state,
+                   ssize_t channel,
+                   memqueue_event_t *event, RemoteObject **sender,
+                   uint64_t *id, RemoteObject **val)
+{
+    return queue_get(queue, state, channel, 0, event, sender, id, val);
+}
+
+MEMHIVE_REMOTE(ssize_t)
+MemQueue_ListenMany(MemQueue *queue, module_state *state,
+                    ssize_t channel, int block,
+                    const struct timespec *deadline,
+                    MemQueueItem *items, ssize_t max)
+{
+    return queue_get_many(queue, state, channel, block, deadline,
+                          items, max);
+}
+
 int
 MemQueue_Close(MemQueue *queue, module_state *state)
 {
@@ -293,7 +1660,11 @@ MemQueue_Close(MemQueue *queue, module_state *state)
         return -1;
     }
     queue->closed = 1;
-    pthread_cond_broadcast(&queue->cond);
+    pthread_cond_broadcast(&queue->space);
+    for (ssize_t i = 0; i < queue->nqueues; i++) {
+        queue_wake_all(&queue->queues[i]);
+        queue_notify_fd(queue->queues[i].efd);
+    }
     queue_unlock(queue);
     return 0;
 }
@@ -312,10 +1683,16 @@ MemQueue_Destroy(MemQueue *queue)
         Py_FatalError("lock is held by something in MemQueue_Destroy");
     }
     pthread_mutex_unlock(&queue->mut);
-    if (pthread_cond_destroy(&queue->cond)) {
+    if (pthread_cond_destroy(&queue->space)) {
         Py_FatalError(
             "clould not destroy the conditional var in MemQueue_Destroy");
     }
+    for (ssize_t i = 0; i < queue->nqueues; i++) {
+        if (pthread_cond_destroy(&queue->queues[i].cond)) {
+            Py_FatalError(
+                "clould not destroy the conditional var in MemQueue_Destroy");
+        }
+    }
     if (pthread_mutex_destroy(&queue->mut)) {
         Py_FatalError("clould not destroy the lock in MemQueue_Destroy");
     }
@@ -329,15 +1706,38 @@ MemQueue_Destroy(MemQueue *queue)
 
     for (ssize_t i = 0; i < queue->nqueues; i++) {
         struct queue *q = &queue->queues[i];
+        if (q->efd >= 0) {
+            close(q->efd);
+            q->efd = -1;
+        }
+        if (q->ring != NULL) {
+            MemRing_Destroy(q->ring);
+            free(q->ring);
+            q->ring = NULL;
+        }
         while (q->first != NULL) {
             struct item *next = q->first->next;
             PyMem_RawFree(q->first);
             q->first = next;
         }
+        while (q->task_first != NULL) {
+            struct item *next = q->task_first->next;
+            PyMem_RawFree(q->task_first);
+            q->task_first = next;
+        }
     }
     PyMem_RawFree(queue->queues);
     queue->queues = NULL;
     queue->nqueues = 0;
+
+    // Called by the owner of the broadcasts, see MemQueue_HubBroadcast().
+    while (queue->bcast_first != NULL) {
+        struct bcast *next = queue->bcast_first->next;
+        Py_XDECREF(queue->bcast_first->val);
+        PyMem_RawFree(queue->bcast_first);
+        queue->bcast_first = next;
+    }
+    queue->bcast_last = NULL;
 }
 
 
@@ -457,16 +1857,23 @@ mq_req_tp_dealloc(MemQueueRequest *self)
     Py_DecRef((PyObject*)tp);
 }
 
+static PyMemberDef MemQueueRequest_members[] = {
+    {"arg", T_OBJECT_EX, offsetof(MemQueueRequest, r_arg), READONLY},
+    {"id", T_ULONGLONG, offsetof(MemQueueRequest, r_id), READONLY},
+    {NULL}
+};
+
 PyType_Slot MemQueueRequestMembers_TypeSlots[] = {
     {Py_tp_dealloc, (destructor)mq_req_tp_dealloc},
     {Py_tp_traverse, (traverseproc)mq_req_tp_traverse},
     {Py_tp_clear, (inquiry)mq_req_tp_clear},
     {Py_tp_call, mq_req_tp_call},
+    {Py_tp_members, MemQueueRequest_members},
     {0, NULL},
 };
 
 PyType_Spec MemQueueRequest_TypeSpec = {
-    .name = QUEUE_RESPONSE_TYPENAME,
+    .name = QUEUE_REQUEST_TYPENAME,
     .basicsize = sizeof(MemQueueRequest),
     .itemsize = 0,
     .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
@@ -525,10 +1932,18 @@ mq_resp_tp_dealloc(MemQueueResponse *self)
     Py_DecRef((PyObject*)tp);
 }
 
+static PyMemberDef MemQueueResponse_members[] = {
+    {"data", T_OBJECT, offsetof(MemQueueResponse, x_data), READONLY},
+    // The id of the message this is a response to.
+    {"id", T_ULONGLONG, offsetof(MemQueueResponse, x_id), READONLY},
+    {NULL}
+};
+
 PyType_Slot MemQueueResponseMembers_TypeSlots[] = {
     {Py_tp_dealloc, (destructor)mq_resp_tp_dealloc},
     {Py_tp_traverse, (traverseproc)mq_resp_tp_traverse},
     {Py_tp_clear, (inquiry)mq_resp_tp_clear},
+    {Py_tp_members, MemQueueResponse_members},
     {0, NULL},
 };
 
@@ -585,17 +2000,91 @@ mq_broad_tp_dealloc(MemQueueBroadcast *self)
     Py_DecRef((PyObject*)tp);
 }
 
+static PyMemberDef MemQueueBroadcast_members[] = {
+    {"arg", T_OBJECT_EX, offsetof(MemQueueBroadcast, b_arg), READONLY},
+    {NULL}
+};
+
 PyType_Slot MemQueueBroadcastMembers_TypeSlots[] = {
     {Py_tp_dealloc, (destructor)mq_broad_tp_dealloc},
     {Py_tp_traverse, (traverseproc)mq_broad_tp_traverse},
     {Py_tp_clear, (inquiry)mq_broad_tp_clear},
+    {Py_tp_members, MemQueueBroadcast_members},
     {0, NULL},
 };
 
 PyType_Spec MemQueueBroadcast_TypeSpec = {
-    .name = QUEUE_RESPONSE_TYPENAME,
+    .name = QUEUE_BROADCAST_TYPENAME,
     .basicsize = sizeof(MemQueueBroadcast),
     .itemsize = 0,
     .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
     .slots = MemQueueBroadcastMembers_TypeSlots,
 };
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+PyObject *
+MemQueueWatch_New(module_state *state, PyObject *keys, uint64_t version)
+{
+    MemQueueWatch *o = PyObject_GC_New(
+        MemQueueWatch, state->MemQueueWatchType);
+    if (o == NULL) {
+        return NULL;
+    }
+
+    o->w_keys = Py_NewRef(keys);
+    o->w_version = version;
+
+    PyObject_GC_Track(o);
+    return (PyObject *)o;
+}
+
+
+static int
+mq_watch_tp_traverse(MemQueueWatch *self, visitproc visit, void *arg)
+{
+    Py_VISIT(Py_TYPE(self));
+    Py_VISIT(self->w_keys);
+    return 0;
+}
+
+static int
+mq_watch_tp_clear(MemQueueWatch *self)
+{
+    Py_CLEAR(self->w_keys);
+    return 0;
+}
+
+static void
+mq_watch_tp_dealloc(MemQueueWatch *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+    PyObject_GC_UnTrack(self);
+    (void)mq_watch_tp_clear(self);
+    Py_TYPE(self)->tp_free(self);
+    Py_DecRef((PyObject*)tp);
+}
+
+static PyMemberDef MemQueueWatch_members[] = {
+    {"keys", T_OBJECT_EX, offsetof(MemQueueWatch, w_keys), READONLY},
+    {"version", T_ULONGLONG, offsetof(MemQueueWatch, w_version), READONLY},
+    {NULL},
+};
+
+PyType_Slot MemQueueWatchMembers_TypeSlots[] = {
+    {Py_tp_dealloc, (destructor)mq_watch_tp_dealloc},
+    {Py_tp_traverse, (traverseproc)mq_watch_tp_traverse},
+    {Py_tp_clear, (inquiry)mq_watch_tp_clear},
+    {Py_tp_members, MemQueueWatch_members},
+    {0, NULL},
+};
+
+PyType_Spec MemQueueWatch_TypeSpec = {
+    .name = QUEUE_WATCH_TYPENAME,
+    .basicsize = sizeof(MemQueueWatch),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .slots = MemQueueWatchMembers_TypeSlots,
+};
@@ -1,16 +1,53 @@
 #ifndef MEMHIVE_QUEUE_H
 #define MEMHIVE_QUEUE_H
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "Python.h"
 
 #include "module.h"
 
+// Messages of a higher priority are taken out first; FIFO otherwise.
+#define MEMQUEUE_PRIORITIES 3
+
 typedef struct {
     pthread_mutex_t mut;
-    pthread_cond_t cond;
+
+    // With `ring_capacity` > 0 channel 0 is a lock-free ring buffer of
+    // that many messages (see ring.h) and `mut` is only taken to wait
+    // for messages or for room. Side channels are always unbounded
+    // linked lists guarded by `mut`: their listeners might not be
+    // listening at all (idle pool threads), so broadcasting to them
+    // must never block.
+    size_t ring_capacity;
+    // Producers waiting for room in the full ring or in a full bounded
+    // channel.
+    pthread_cond_t space;
+    _Atomic ssize_t nfull_waiting;
+    // Listeners waiting on any channel.
+    _Atomic ssize_t nwaiting_total;
+
+    // In work-stealing mode (see MemQueue_InitStealing()) messages put
+    // in channel 0 are dealt round-robin to the side channels instead.
+    int stealing;
+    ssize_t ntasks;     // dealt and not taken yet, over all channels
+    ssize_t deal_next;  // the side channel that got the last one
+
+    // In fair intake mode (see MemQueue_InitFair()) side channels are
+    // read by channel 0's listener.
+    int fair;
+    ssize_t fair_next;      // the channel whose turn it is
+    ssize_t fair_length;    // messages in the side channels
+
+    // Broadcasts are kept once, in a log shared by all side channels;
+    // each channel has a cursor into it (see MemQueue_HubBroadcast()).
+    struct bcast *bcast_first;
+    struct bcast *bcast_last;
+    _Atomic uint64_t bcast_next;    // sequence number of the next one
+    ssize_t nreaders;               // open side channels (running workers)
 
     struct queue *queues;
     ssize_t nqueues;
@@ -19,19 +56,56 @@ typedef struct {
     struct item *reuse;
     ssize_t reuse_num;
 
-    uint8_t closed;
+    // Number of channels with a readiness fd.
+    _Atomic ssize_t nfds;
+
+    // The side channel whose listener was last woken for a channel 0
+    // message.
+    ssize_t wake_next;
+
+    _Atomic uint8_t closed;
     uint8_t destroyed;
 } MemQueue;
 
+// A thread waiting for messages on several side channels at once,
+// see MemQueue_WaitAny(). Its fields are guarded by the queue lock.
+typedef struct {
+    pthread_cond_t cond;
+    uint8_t waiting;
+    // Signalled but not awake yet, like `nsignaled` of a channel.
+    uint8_t signaled;
+    uint8_t interrupted;
+} MemQueueWaiter;
+
 typedef enum {
     E_HUB_BROADCAST,
     E_HUB_REQUEST,
     E_HUB_PUSH,
+    E_HUB_WATCH,
     E_HEALTH_ERROR,
     E_HEALTH_START,
     E_HEALTH_CLOSE,
+    E_HEALTH_SCALE,
+    E_HEALTH_LOST,
 } memqueue_event_t;
 
+typedef struct {
+    ssize_t depth;
+    ssize_t capacity;   // 0 for unbounded
+    uint64_t nfull;     // puts that found the channel full
+} MemQueueStats;
+
+// A message taken out by MemQueue_ListenMany().
+typedef struct {
+    memqueue_event_t event;
+    RemoteObject *sender;
+    uint64_t id;
+    RemoteObject *val;
+    // The broadcast log entry for E_HUB_BROADCAST, see
+    // MemQueue_BroadcastDone().
+    struct bcast *bcast;
+} MemQueueItem;
+
 typedef enum {D_FROM_MAIN, D_FROM_SUB} memqueue_direction_t;
 
 typedef struct {
@@ -56,12 +130,84 @@ typedef struct {
     PyObject *b_arg;
 } MemQueueBroadcast;
 
+typedef struct {
+    PyObject_HEAD
+    PyObject *w_keys;
+    uint64_t w_version;
+} MemQueueWatch;
+
 extern PyType_Spec MemQueueResponse_TypeSpec;
 extern PyType_Spec MemQueueRequest_TypeSpec;
 extern PyType_Spec MemQueueBroadcast_TypeSpec;
+extern PyType_Spec MemQueueWatch_TypeSpec;
 
+// `capacity` bounds the channel (0 for unbounded), see
+// MemQueue_PutWait(). The listener of an `exclusive` channel only gets
+// what's put in it and broadcasts: it takes no channel 0 messages,
+// dealt or not.
 ssize_t
-MemQueue_AddChannel(MemQueue *queue, module_state *state);
+MemQueue_AddChannel(MemQueue *queue, module_state *state, ssize_t capacity,
+                    int exclusive);
+
+// Listening on a closed channel fails with ClosedQueueError once
+// the messages already in it are consumed; new messages are dropped.
+int
+MemQueue_CloseChannel(MemQueue *queue, module_state *state, ssize_t channel);
+
+// Closes the channel and lets MemQueue_AddChannel() reuse it.
+void
+MemQueue_ReleaseChannel(MemQueue *queue, ssize_t channel);
+
+// Has `waiter` woken up instead of the channel's listeners when there's
+// something for the channel (which must be open) to take. Nothing
+// listens on the channel then: whoever waits in MemQueue_WaitAny()
+// takes the messages with MemQueue_ListenMany() without blocking.
+// Releasing the channel detaches it.
+void
+MemQueue_AttachChannel(MemQueue *queue, ssize_t channel,
+                       MemQueueWaiter *waiter);
+
+// Detaches `channel` unless it has been released and attached to
+// another waiter already.
+void
+MemQueue_DetachChannel(MemQueue *queue, ssize_t channel,
+                       MemQueueWaiter *waiter);
+
+// Waits until one of the `n` `channels` attached to `waiter` has
+// something to take (a message, a broadcast, shared work or the news
+// that it's closed) and returns its index, looking at them
+// round-robin from `start`. Returns -1 once the queue is closed and
+// -2 if interrupted by MemQueue_Interrupt(). Takes no thread state
+// and must be called without one.
+ssize_t
+MemQueue_WaitAny(MemQueue *queue, MemQueueWaiter *waiter,
+                 const ssize_t *channels, ssize_t n, ssize_t start);
+
+// Makes the current or the next MemQueue_WaitAny() call on `waiter`
+// return -2.
+void
+MemQueue_Interrupt(MemQueue *queue, MemQueueWaiter *waiter);
+
+// Tells apart the listeners MemQueue_AddChannel() has handed the
+// channel to over time, see MemQueue_PutTo().
+uint64_t
+MemQueue_ChannelGeneration(MemQueue *queue, ssize_t channel);
+
+ssize_t
+MemQueue_Depth(MemQueue *queue, module_state *state, ssize_t channel);
+
+int
+MemQueue_Stats(MemQueue *queue, module_state *state, ssize_t channel,
+               MemQueueStats *stats);
+
+// Returns an eventfd that becomes readable when the channel (or,
+// for side channels, channel 0) gets a message while empty, or when
+// it's closed. Listeners have to read the fd before getting messages
+// with MemQueue_TryListen() until there are none left, otherwise
+// they can miss a wakeup. The fd is owned by the queue and is closed
+// when the channel is released. Linux only.
+int
+MemQueue_ReadinessFd(MemQueue *queue, module_state *state, ssize_t channel);
 
 int
 MemQueue_Put(MemQueue *queue,
@@ -72,10 +218,79 @@ MemQueue_Put(MemQueue *queue,
              uint64_t id,
              PyObject *val);
 
+// Like MemQueue_Put(), but when a bounded channel is full it only
+// waits (with the GIL released) if `block` is set, until `deadline`
+// (CLOCK_REALTIME) unless it's NULL, and returns 1 if it's still full
+// then. MemQueue_Put() waits for as long as it takes. Broadcasts
+// ignore the capacity.
+//
+// `priority` (below MEMQUEUE_PRIORITIES) puts the message ahead of
+// those of lower priorities; MemQueue_Put() uses 0, the lowest.
+// Channel 0 messages of a priority above 0 are also taken before
+// lower priority messages of a listener's own channel. The ring
+// buffer only has priority 0.
+int
+MemQueue_PutWait(MemQueue *queue,
+                 module_state *state,
+                 memqueue_event_t kind,
+                 ssize_t channel,
+                 PyObject *sender,
+                 uint64_t id,
+                 PyObject *val,
+                 int priority,
+                 int block,
+                 const struct timespec *deadline);
+
+// Puts `n` messages with ids `first_id`, `first_id + 1`, ... under one
+// lock acquisition.
+// Like MemQueue_Put() to a side channel, but only while the listener
+// that got it with `generation` still has it open: returns 1 without
+// putting the message once the channel is closed, released or reused.
+// The check and the put are one step, so the message can't reach
+// whoever gets the channel next.
+int
+MemQueue_PutTo(MemQueue *queue,
+               module_state *state,
+               memqueue_event_t kind,
+               ssize_t channel,
+               uint64_t generation,
+               PyObject *sender,
+               uint64_t id,
+               PyObject *val);
+
+// Puts the `n` `vals` in order, with ids from `first_id` on. Waits for
+// room like MemQueue_PutWait() does, with one `deadline` for all of
+// them, and returns 1 if the channel is still full then. However it
+// ends, `*nput` (unless NULL) is set to how many were put; those stay
+// in the channel.
+int
+MemQueue_PutMany(MemQueue *queue,
+                 module_state *state,
+                 memqueue_event_t kind,
+                 ssize_t channel,
+                 PyObject *sender,
+                 uint64_t first_id,
+                 PyObject *const *vals,
+                 ssize_t n,
+                 int block,
+                 const struct timespec *deadline,
+                 ssize_t *nput);
+
+// Appends `msg` to the broadcast log: one entry and one reference no
+// matter how many side channels there are. Must be called by the
+// owner of `msg`, who also drops the references to entries every
+// listener is done with, on the next broadcast or in
+// MemQueue_Destroy().
 int
 MemQueue_HubBroadcast(MemQueue *queue,  module_state *state,
                       PyObject *sender, PyObject *msg);
 
+// A listener is done with a message taken out by MemQueue_ListenMany():
+// instead of releasing the sender's reference to a broadcast's value
+// it tells the log. Does nothing for other messages.
+void
+MemQueue_BroadcastDone(MemQueueItem *item);
+
 int
 MemQueue_HubPush(MemQueue *queue, module_state *state,
                  ssize_t channel, PyObject *sender, uint64_t id, PyObject *val);
@@ -90,8 +305,47 @@ MemQueue_Listen(MemQueue *queue, module_state *state,
                 memqueue_event_t *event, RemoteObject **sender,
                 uint64_t *id, RemoteObject **val);
 
+// Like MemQueue_Listen(), but returns 1 instead of waiting when
+// there's nothing to get.
+int
+MemQueue_TryListen(MemQueue *queue, module_state *state,
+                   ssize_t channel,
+                   memqueue_event_t *event, RemoteObject **sender,
+                   uint64_t *id, RemoteObject **val);
+
+// Takes up to `max` messages under one lock acquisition. Waits for
+// the first one unless `block` is 0, until `deadline` (CLOCK_REALTIME)
+// unless it's NULL. Returns the number of messages taken, 0 if none
+// came in time.
+ssize_t
+MemQueue_ListenMany(MemQueue *queue, module_state *state,
+                    ssize_t channel, int block,
+                    const struct timespec *deadline,
+                    MemQueueItem *items, ssize_t max);
+
+// `capacity` bounds channel 0 (0 for unbounded), see MemQueue_PutWait().
+int
+MemQueue_Init(MemQueue *queue, ssize_t max_side_channels, ssize_t capacity);
+
+// A queue whose channel 0 is a bounded lock-free ring: pushing into
+// it when it's full waits (with the GIL released) until there's room.
+int
+MemQueue_InitRing(MemQueue *queue, ssize_t max_side_channels,
+                  size_t capacity);
+
+// A queue whose channel 0 messages are dealt round-robin to per-side-
+// channel deques. A listener takes from the front of its own deque,
+// then from channel 0 (where messages wait while there are no side
+// channels), then steals from the back of the fullest other deque.
 int
-MemQueue_Init(MemQueue *queue, ssize_t max_side_channels);
+MemQueue_InitStealing(MemQueue *queue, ssize_t max_side_channels);
+
+// A queue with one intake channel per sender and a single listener
+// on channel 0, which takes from all channels (0 included) in deficit
+// round-robin order, so a sender flooding its channel only delays
+// the others by a few messages. Priorities still come first.
+int
+MemQueue_InitFair(MemQueue *queue, ssize_t max_side_channels);
 
 int
 MemQueue_Close(MemQueue *queue, module_state *state);
@@ -116,4 +370,7 @@ MemQueueResponse_New(module_state *state,
 PyObject *
 MemQueueBroadcast_New(module_state *state, PyObject *arg);
 
+PyObject *
+MemQueueWatch_New(module_state *state, PyObject *keys, uint64_t version);
+
 #endif
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+
+#include "ring.h"
+
+
+int
+MemRing_Init(MemRing *ring, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->slots = aligned_alloc(MEMHIVE_CACHE_LINE, size * sizeof(MemRingSlot));
+    if (ring->slots == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&ring->slots[i].seq, i);
+        ring->slots[i].sender = NULL;
+        ring->slots[i].val = NULL;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+void
+MemRing_Destroy(MemRing *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int
+MemRing_Push(MemRing *ring, int kind, PyObject *sender,
+             uint64_t id, PyObject *val)
+{
+    MemRingSlot *slot;
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            // The slot is free for this lap; claim it.
+            if (atomic_compare_exchange_weak_explicit(
+                    &ring->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        } else if (dif < 0) {
+            // Still holds a message from the previous lap.
+            return 1;
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+
+    slot->kind = kind;
+    slot->id = id;
+    slot->sender = sender;
+    slot->val = val;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+int
+MemRing_Pop(MemRing *ring, int *kind, PyObject **sender,
+            uint64_t *id, PyObject **val)
+{
+    MemRingSlot *slot;
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &ring->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        } else if (dif < 0) {
+            return 1;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    *kind = slot->kind;
+    *id = slot->id;
+    *sender = slot->sender;
+    *val = slot->val;
+    slot->sender = NULL;
+    slot->val = NULL;
+    // Free the slot for the producer one lap ahead.
+    atomic_store_explicit(&slot->seq, pos + ring->mask + 1,
+                          memory_order_release);
+    return 0;
+}
+
+size_t
+MemRing_Length(MemRing *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return tail > head ? tail - head : 0;
+}
@@ -0,0 +1,50 @@
+#ifndef MEMHIVE_RING_H
+#define MEMHIVE_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "Python.h"
+
+#define MEMHIVE_CACHE_LINE 64
+
+// A bounded multi-producer multi-consumer FIFO (Dmitry Vyukov's
+// algorithm): every slot carries a sequence number telling producers
+// and consumers whose turn it is, so both sides only race on their
+// own index with a CAS and never take a lock. Slots and the two
+// indices each get a cache line to avoid false sharing.
+//
+// It's just storage; waiting for a slot or for a message is up to
+// the caller (see queue.c).
+
+typedef struct {
+    _Alignas(MEMHIVE_CACHE_LINE) _Atomic size_t seq;
+    int kind;
+    uint64_t id;
+    PyObject *sender;
+    PyObject *val;
+} MemRingSlot;
+
+typedef struct {
+    _Alignas(MEMHIVE_CACHE_LINE) _Atomic size_t head;
+    _Alignas(MEMHIVE_CACHE_LINE) _Atomic size_t tail;
+    _Alignas(MEMHIVE_CACHE_LINE) size_t mask;
+    MemRingSlot *slots;
+} MemRing;
+
+// `capacity` is rounded up to a power of two.
+int MemRing_Init(MemRing *ring, size_t capacity);
+
+void MemRing_Destroy(MemRing *ring);
+
+// Both return 1 when the ring is full/empty.
+int MemRing_Push(MemRing *ring, int kind, PyObject *sender,
+                 uint64_t id, PyObject *val);
+
+int MemRing_Pop(MemRing *ring, int *kind, PyObject **sender,
+                uint64_t *id, PyObject **val);
+
+// Approximate when there are concurrent pushes or pops.
+size_t MemRing_Length(MemRing *ring);
+
+#endif
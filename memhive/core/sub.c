@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdint.h>
 
 #include "memhive.h"
@@ -6,6 +7,7 @@
 #include "track.h"
 #include "queue.h"
 #include "debug.h"
+#include "utils.h"
 
 
 static int
@@ -13,8 +15,9 @@ memhive_sub_tp_init(MemHiveSub *o, PyObject *args, PyObject *kwds)
 {
     uintptr_t hive_ptr;
     uint64_t sub_id;
+    int exclusive = 0;
 
-    if (!PyArg_ParseTuple(args, "KK", &hive_ptr, &sub_id)) {
+    if (!PyArg_ParseTuple(args, "KK|p", &hive_ptr, &sub_id, &exclusive)) {
         return -1;
     }
 
@@ -29,6 +32,7 @@ memhive_sub_tp_init(MemHiveSub *o, PyObject *args, PyObject *kwds)
     }
 
     o->sub_id = sub_id;
+    o->exclusive = exclusive ? 1 : 0;
 
     o->hive = (RemoteObject*)hive_ptr;
     module_state *state = MemHive_GetModuleStateByPythonType(Py_TYPE(o));
@@ -52,6 +56,16 @@ memhive_sub_tp_init(MemHiveSub *o, PyObject *args, PyObject *kwds)
     o->closed = 0;
     o->req_id_cnt = 0;
 
+    o->replica = NULL;
+    o->replica_staleness = 0;
+    o->replica_synced = 0;
+
+    atomic_init(&o->listening_since, 0);
+    atomic_init(&o->idle_ns, 0);
+    if (PyTime_MonotonicRaw(&o->created)) {
+        o->created = 0;
+    }
+
     TRACK(state, o);
 
     return 0;
@@ -69,14 +83,60 @@ memhive_ensure_open(MemHiveSub *o)
 }
 
 
+static int
+memhive_sub_replica_sync(MemHiveSub *o, module_state *state)
+{
+    // Reads from the replica can be up to `replica_staleness` behind
+    // the index.
+    PyTime_t now;
+    if (PyTime_Monotonic(&now)) {
+        return -1;
+    }
+    if (now - o->replica_synced < o->replica_staleness) {
+        return 0;
+    }
+    if (MemHive_SyncReplica(state, (MemHive *)o->hive, o)) {
+        return -1;
+    }
+    o->replica_synced = now;
+    return 0;
+}
+
+static PyObject *
+memhive_sub_replica_for(MemHiveSub *o, module_state *state, PyObject *key)
+{
+    // Borrowed reference to the replica of the key's shard.
+    if (memhive_sub_replica_sync(o, state)) {
+        return NULL;
+    }
+    Py_ssize_t idx = MemHive_ShardIndex((MemHive *)o->hive, key);
+    if (idx < 0) {
+        return NULL;
+    }
+    return o->replica[idx].copy;
+}
+
+
 static Py_ssize_t
 memhive_sub_tp_len(MemHiveSub *o)
 {
-    // It's safe to do this because MemHive's tp_len is protected by a mutex.
     if (memhive_ensure_open(o)) {
         return -1;
     }
-    return PyObject_Length((PyObject *)(o->hive));
+    module_state *state = PyType_GetModuleState(Py_TYPE(o));
+
+    if (o->replica != NULL) {
+        if (memhive_sub_replica_sync(o, state)) {
+            return -1;
+        }
+        Py_ssize_t size = 0;
+        for (Py_ssize_t i = 0; i < ((MemHive *)o->hive)->nshards; i++) {
+            size += PyObject_Length(o->replica[i].copy);
+        }
+        return size;
+    }
+
+    return MemHive_Len(state, (MemHive *)o->hive);
 }
 
 
@@ -95,6 +155,15 @@ memhive_sub_tp_subscript(MemHiveSub *o, PyObject *key)
         return NULL;
     }
     module_state *state = PyType_GetModuleState(Py_TYPE(o));
+
+    if (o->replica != NULL) {
+        PyObject *replica = memhive_sub_replica_for(o, state, key);
+        if (replica == NULL) {
+            return NULL;
+        }
+        return MemHive_MapGetItem(state, replica, key, NULL);
+    }
+
     return MemHive_Get(state, (MemHive *)o->hive, key);
 }
 
@@ -105,38 +174,161 @@ memhive_sub_tp_contains(MemHiveSub *o, PyObject *key)
         return -1;
     }
     module_state *state = PyType_GetModuleState(Py_TYPE(o));
+
+    if (o->replica != NULL) {
+        PyObject *replica = memhive_sub_replica_for(o, state, key);
+        if (replica == NULL) {
+            return -1;
+        }
+        return MemHive_MapContains(state, replica, key);
+    }
+
     return MemHive_Contains(state, (MemHive *)o->hive, key);
 }
 
 static PyObject *
-memhive_sub_py_listen(MemHiveSub *o, PyObject *args)
+memhive_sub_py_snapshot(MemHiveSub *o, PyObject *args)
 {
     if (memhive_ensure_open(o)) {
         return NULL;
     }
+    module_state *state = PyType_GetModuleState(Py_TYPE(o));
+
+    if (o->replica == NULL) {
+        return MemHive_Snapshot(state, (MemHive *)o->hive);
+    }
 
-    module_state *state = MemHive_GetModuleStateByObj((PyObject*)o);
-    MemQueue *q = &((MemHive *)o->hive)->for_subs;
+    if (memhive_sub_replica_sync(o, state)) {
+        return NULL;
+    }
 
-    memqueue_event_t event;
-    RemoteObject *sender;
-    RemoteObject *remote_val;
-    uint64_t id;
+    Py_ssize_t nshards = ((MemHive *)o->hive)->nshards;
+    if (nshards == 1) {
+        return Py_NewRef(o->replica[0].copy);
+    }
+
+    PyObject *mut = PyObject_CallMethod(o->replica[0].copy, "mutate", NULL);
+    if (mut == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i = 1; i < nshards; i++) {
+        PyObject *res = PyObject_CallMethod(
+            mut, "update", "O", o->replica[i].copy);
+        if (res == NULL) {
+            Py_DECREF(mut);
+            return NULL;
+        }
+        Py_DECREF(res);
+    }
+    PyObject *snapshot = PyObject_CallMethod(mut, "finish", NULL);
+    Py_DECREF(mut);
+    return snapshot;
+}
+
+static PyObject *
+memhive_sub_py_enable_replica(MemHiveSub *o, PyObject *args)
+{
+    // Serve reads from a local replica of the index, synced with it
+    // at most every `max_staleness` seconds; with inf it's only
+    // synced by sync_replica().
+
+    double max_staleness;
+    if (!PyArg_ParseTuple(args, "d:enable_replica", &max_staleness)) {
+        return NULL;
+    }
+    if (isnan(max_staleness) || max_staleness < 0) {
+        PyErr_SetString(PyExc_ValueError, "max_staleness must be >= 0");
+        return NULL;
+    }
 
-    if (MemQueue_Listen(q, state, o->channel,
-                        &event, &sender, &id, &remote_val))
+    if (memhive_ensure_open(o)) {
+        return NULL;
+    }
+    module_state *state = PyType_GetModuleState(Py_TYPE(o));
+
+    if (isinf(max_staleness)) {
+        o->replica_staleness = INT64_MAX;
+    } else {
+        if (max_staleness > MEMHIVE_TIMEOUT_MAX) {
+            max_staleness = MEMHIVE_TIMEOUT_MAX;
+        }
+        o->replica_staleness = (int64_t)(max_staleness * 1e9);
+    }
+
+    if (o->replica != NULL) {
+        Py_RETURN_NONE;
+    }
+
+    Py_ssize_t nshards = ((MemHive *)o->hive)->nshards;
+    o->replica = PyMem_RawCalloc((size_t)nshards, sizeof(MemHiveReplica));
+    if (o->replica == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    if (MemHive_SyncReplica(state, (MemHive *)o->hive, o)
+        || PyTime_Monotonic(&o->replica_synced))
     {
+        MemHive_ClearReplica((MemHive *)o->hive, o);
         return NULL;
     }
 
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_sub_py_sync_replica(MemHiveSub *o, PyObject *args)
+{
+    if (memhive_ensure_open(o)) {
+        return NULL;
+    }
+    if (o->replica == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "replica is not enabled");
+        return NULL;
+    }
+    module_state *state = PyType_GetModuleState(Py_TYPE(o));
+    if (MemHive_SyncReplica(state, (MemHive *)o->hive, o)
+        || PyTime_Monotonic(&o->replica_synced))
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+memhive_sub_tp_iter(MemHiveSub *o)
+{
+    PyObject *snapshot = memhive_sub_py_snapshot(o, NULL);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    PyObject *it = PyObject_GetIter(snapshot);
+    Py_DECREF(snapshot);
+    return it;
+}
+
+static PyObject *
+sub_make_message(MemHiveSub *o, MemQueueItem *item)
+{
+    module_state *state = MemHive_GetModuleStateByObj((PyObject*)o);
+    memqueue_event_t event = item->event;
+    uint64_t id = item->id;
+
     PyObject *ret = NULL;
 
-    PyObject *payload = MemHive_CopyObject(state, remote_val);
+    PyObject *payload = MemHive_CopyObject(state, item->val);
+    if (event == E_HUB_BROADCAST) {
+        // The value is shared by all listeners and released by main
+        // once all of them are done with it.
+        MemQueue_BroadcastDone(item);
+    }
     if (payload == NULL) {
         goto err;
     }
 
-    if (MemHive_RefQueue_Dec(o->main_refs, remote_val)) {
+    if (event != E_HUB_BROADCAST
+        && MemHive_RefQueue_Dec(o->main_refs, item->val))
+    {
         goto err;
     }
 
@@ -147,7 +339,7 @@ memhive_sub_py_listen(MemHiveSub *o, PyObject *args)
                 (PyObject *)o,
                 payload,
                 D_FROM_SUB,
-                0,
+                o->main_channel,
                 id
             );
             break;
@@ -165,6 +357,11 @@ memhive_sub_py_listen(MemHiveSub *o, PyObject *args)
             );
             break;
 
+        case E_HUB_WATCH:
+            // `id` is the index version after the commit.
+            ret = MemQueueWatch_New(state, payload, id);
+            break;
+
         default:
             Py_UNREACHABLE();
     }
@@ -183,21 +380,253 @@ err:
 }
 
 static PyObject *
-memhive_sub_py_request(MemHiveSub *o, PyObject *arg)
+sub_listen(MemHiveSub *o, int block, const struct timespec *deadline)
 {
+    // Returns None if there's no message and `block` is 0 or
+    // `deadline` has passed.
+
+    if (memhive_ensure_open(o)) {
+        return NULL;
+    }
+
+    module_state *state = MemHive_GetModuleStateByObj((PyObject*)o);
+    MemQueue *q = &((MemHive *)o->hive)->for_subs;
+
+    MemQueueItem item;
+    ssize_t n;
+
+    if (block) {
+        PyTime_t since;
+        if (PyTime_MonotonicRaw(&since)) {
+            return NULL;
+        }
+        atomic_store_explicit(&o->listening_since, since,
+                              memory_order_relaxed);
+
+        n = MemQueue_ListenMany(q, state, o->channel, 1, deadline, &item, 1);
+
+        PyTime_t now;
+        if (PyTime_MonotonicRaw(&now) == 0) {
+            atomic_fetch_add_explicit(&o->idle_ns, now - since,
+                                      memory_order_relaxed);
+        }
+        atomic_store_explicit(&o->listening_since, 0, memory_order_relaxed);
+    } else {
+        n = MemQueue_ListenMany(q, state, o->channel, 0, NULL, &item, 1);
+    }
+
+    if (n < 0) {
+        return NULL;
+    }
+    if (n == 0) {
+        Py_RETURN_NONE;
+    }
+
+    return sub_make_message(o, &item);
+}
+
+static PyObject *
+memhive_sub_py_listen(MemHiveSub *o, PyObject *args)
+{
+    PyObject *timeout = NULL;
+    if (!PyArg_ParseTuple(args, "|O:listen", &timeout)) {
+        return NULL;
+    }
+    int block;
+    struct timespec ts;
+    const struct timespec *deadline;
+    if (MemHive_ParseTimeout(timeout, &block, &ts, &deadline)) {
+        return NULL;
+    }
+    return sub_listen(o, block, deadline);
+}
+
+static PyObject *
+memhive_sub_py_try_listen(MemHiveSub *o, PyObject *args)
+{
+    return sub_listen(o, 0, NULL);
+}
+
+static PyObject *
+memhive_sub_py_listen_many(MemHiveSub *o, PyObject *args)
+{
+    // Up to `max_items` messages; waits for the first one for up to
+    // `timeout` seconds (forever if None). Can return an empty list.
+    Py_ssize_t max_items;
+    PyObject *timeout = NULL;
+    if (!PyArg_ParseTuple(args, "n|O:listen_many", &max_items, &timeout)) {
+        return NULL;
+    }
+    if (memhive_ensure_open(o)) {
+        return NULL;
+    }
+    int block;
+    struct timespec ts;
+    const struct timespec *deadline;
+    if (MemHive_ParseTimeout(timeout, &block, &ts, &deadline)) {
+        return NULL;
+    }
+
+    module_state *state = MemHive_GetModuleStateByObj((PyObject*)o);
+    MemQueue *q = &((MemHive *)o->hive)->for_subs;
+
+    PyTime_t since = 0;
+    if (block) {
+        if (PyTime_MonotonicRaw(&since)) {
+            return NULL;
+        }
+        atomic_store_explicit(&o->listening_since, since,
+                              memory_order_relaxed);
+    }
+
+    PyObject *ret = MemHive_ListenMany(
+        state, (PyObject *)o, q, o->channel, max_items, block, deadline,
+        (MemHive_MessageFunc)sub_make_message);
+
+    if (block) {
+        PyTime_t now;
+        if (PyTime_MonotonicRaw(&now) == 0) {
+            atomic_fetch_add_explicit(&o->idle_ns, now - since,
+                                      memory_order_relaxed);
+        }
+        atomic_store_explicit(&o->listening_since, 0, memory_order_relaxed);
+    }
+    return ret;
+}
+
+static PyObject *
+memhive_sub_py_readiness_fd(MemHiveSub *o, PyObject *args)
+{
+    if (memhive_ensure_open(o)) {
+        return NULL;
+    }
+    module_state *state = MemHive_GetModuleStateByObj((PyObject*)o);
+    MemQueue *q = &((MemHive *)o->hive)->for_subs;
+    int fd = MemQueue_ReadinessFd(q, state, o->channel);
+    if (fd < 0) {
+        return NULL;
+    }
+    return PyLong_FromLong(fd);
+}
+
+static PyObject *
+memhive_sub_py_request(MemHiveSub *o, PyObject *args, PyObject *kwds)
+{
+    // The main interpreter takes requests of a higher `priority` first.
+    static char *kwlist[] = {"arg", "priority", NULL};
+    PyObject *arg;
+    int priority = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|$i:request", kwlist,
+                                     &arg, &priority))
+    {
+        return NULL;
+    }
+    if (MemHive_CheckPriority(priority)) {
+        return NULL;
+    }
+
     if (memhive_ensure_open(o)) {
         return NULL;
     }
     MemQueue *q = &((MemHive *)o->hive)->for_main;
     module_state *state = MemHive_GetModuleStateByObj((PyObject*)o);
     TRACK(state, arg);
-    if (MemQueue_HubRequest(q, state, 0, (PyObject*)o, ++o->req_id_cnt, arg)) {
+    if (MemQueue_PutWait(q, state, E_HUB_REQUEST, o->main_channel,
+                         (PyObject*)o, ++o->req_id_cnt, arg, priority,
+                         1, NULL))
+    {
         return NULL;
     }
     Py_RETURN_NONE;
 }
 
 
+static PyObject *
+memhive_sub_py_request_many(MemHiveSub *o, PyObject *args)
+{
+    // Sends all of `args` to the main interpreter under one lock
+    // acquisition.
+    if (memhive_ensure_open(o)) {
+        return NULL;
+    }
+    PyObject *seq = PySequence_Fast(args,
+                                    "request_many() expects an iterable");
+    if (seq == NULL) {
+        return NULL;
+    }
+    MemQueue *q = &((MemHive *)o->hive)->for_main;
+    module_state *state = MemHive_GetModuleStateByObj((PyObject*)o);
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        TRACK(state, items[i]);
+    }
+    uint64_t first_id = o->req_id_cnt + 1;
+    o->req_id_cnt += (uint64_t)n;
+    int r = MemQueue_PutMany(q, state, E_HUB_REQUEST, o->main_channel,
+                             (PyObject*)o, first_id, items, n,
+                             1, NULL, NULL);
+    Py_DECREF(seq);
+    if (r) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static int
+memhive_sub_add_watch(MemHiveSub *o, PyObject *key, int is_prefix)
+{
+    if (!MEMHIVE_IS_VALID_KEY(key)) {
+        PyErr_Format(PyExc_TypeError,
+                     "only str keys can be watched, got %R", key);
+        return -1;
+    }
+    Py_ssize_t len;
+    const char *data = PyUnicode_AsUTF8AndSize(key, &len);
+    if (data == NULL) {
+        return -1;
+    }
+    return MemHive_Watch((MemHive *)o->hive, o, data, len, is_prefix);
+}
+
+static PyObject *
+memhive_sub_py_watch(MemHiveSub *o, PyObject *arg)
+{
+    // A str argument is a key prefix, anything else must be
+    // an iterable of keys. Changes of watched keys are delivered
+    // by `listen()`.
+
+    if (memhive_ensure_open(o)) {
+        return NULL;
+    }
+
+    if (PyUnicode_Check(arg)) {
+        if (memhive_sub_add_watch(o, arg, 1)) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
+    PyObject *it = PyObject_GetIter(arg);
+    if (it == NULL) {
+        return NULL;
+    }
+    PyObject *key;
+    while ((key = PyIter_Next(it)) != NULL) {
+        int r = memhive_sub_add_watch(o, key, 0);
+        Py_DECREF(key);
+        if (r) {
+            Py_DECREF(it);
+            return NULL;
+        }
+    }
+    Py_DECREF(it);
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject *
 memhive_sub_py_do_refs(MemHiveSub *o, PyObject *args)
 {
@@ -217,6 +646,7 @@ memhive_sub_py_close(MemHiveSub *o, PyObject *args)
         Py_RETURN_NONE;
     }
     o->closed = 1;
+    MemHive_ClearReplica((MemHive*)o->hive, o);
     if (MemHive_RefQueue_Dec(o->main_refs, o->hive)) {
         return NULL;
     }
@@ -294,6 +724,7 @@ memhive_sub_py_report_error(MemHiveSub *o, PyObject *args)
     }
 
     module_state *state = MemHive_GetModuleStateByObj((PyObject *)o);
+    TRACK(state, res);
 
     int ret = MemQueue_Put(
         &((MemHive*)o->hive)->subs_health,
@@ -304,7 +735,8 @@ memhive_sub_py_report_error(MemHiveSub *o, PyObject *args)
         o->sub_id,
         res
     );
-    Py_CLEAR(ser_err);
+    // The queue holds its own reference until main is done with it.
+    Py_DECREF(res);
 
     if (ret) {
         return NULL;
@@ -314,9 +746,22 @@ memhive_sub_py_report_error(MemHiveSub *o, PyObject *args)
 }
 
 static PyMethodDef MemHiveSub_methods[] = {
-    {"request", (PyCFunction)memhive_sub_py_request, METH_O, NULL},
-    {"listen", (PyCFunction)memhive_sub_py_listen, METH_NOARGS, NULL},
+    {"request", (PyCFunction)memhive_sub_py_request,
+        METH_VARARGS | METH_KEYWORDS, NULL},
+    {"request_many", (PyCFunction)memhive_sub_py_request_many, METH_O, NULL},
+    {"listen", (PyCFunction)memhive_sub_py_listen, METH_VARARGS, NULL},
+    {"try_listen", (PyCFunction)memhive_sub_py_try_listen, METH_NOARGS, NULL},
+    {"listen_many", (PyCFunction)memhive_sub_py_listen_many,
+        METH_VARARGS, NULL},
+    {"readiness_fd", (PyCFunction)memhive_sub_py_readiness_fd,
+        METH_NOARGS, NULL},
+    {"watch", (PyCFunction)memhive_sub_py_watch, METH_O, NULL},
     {"process_refs", (PyCFunction)memhive_sub_py_do_refs, METH_NOARGS, NULL},
+    {"snapshot", (PyCFunction)memhive_sub_py_snapshot, METH_NOARGS, NULL},
+    {"enable_replica", (PyCFunction)memhive_sub_py_enable_replica,
+        METH_VARARGS, NULL},
+    {"sync_replica", (PyCFunction)memhive_sub_py_sync_replica,
+        METH_NOARGS, NULL},
     {"close", (PyCFunction)memhive_sub_py_close, METH_NOARGS, NULL},
     {"report_error", (PyCFunction)memhive_sub_py_report_error,
         METH_VARARGS, NULL},
@@ -333,6 +778,7 @@ PyType_Slot MemHiveSub_TypeSlots[] = {
     {Py_mp_length, (lenfunc)memhive_sub_tp_len},
     {Py_mp_subscript, (binaryfunc)memhive_sub_tp_subscript},
     {Py_sq_contains, (objobjproc)memhive_sub_tp_contains},
+    {Py_tp_iter, (getiterfunc)memhive_sub_tp_iter},
     {Py_tp_init, (initproc)memhive_sub_tp_init},
     {Py_tp_dealloc, (destructor)memhive_sub_tp_dealloc},
     {0, NULL},
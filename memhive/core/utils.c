@@ -1,4 +1,6 @@
+#include <math.h>
 #include <string.h>
+#include <time.h>
 
 #include "memhive.h"
 #include "debug.h"
@@ -146,3 +148,126 @@ MemHive_CopyObject(module_state *state, RemoteObject *ro)
         return NULL;
     }
 }
+
+
+int
+MemHive_ParseTimeout(PyObject *timeout, int *block, struct timespec *ts,
+                     const struct timespec **deadline)
+{
+    *block = 1;
+    *deadline = NULL;
+    if (timeout == NULL || timeout == Py_None) {
+        return 0;
+    }
+
+    double secs = PyFloat_AsDouble(timeout);
+    if (secs == -1.0 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (isnan(secs) || secs < 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+        return -1;
+    }
+    if (secs == 0) {
+        *block = 0;
+        return 0;
+    }
+    if (isinf(secs)) {
+        return 0;
+    }
+    // Far enough in the future to never come, and to still fit in
+    // a 32-bit time_t once added to the current time.
+    if (secs > MEMHIVE_TIMEOUT_MAX) {
+        secs = MEMHIVE_TIMEOUT_MAX;
+    }
+
+    if (clock_gettime(CLOCK_REALTIME, ts)) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    time_t whole = (time_t)secs;
+    ts->tv_sec += whole;
+    ts->tv_nsec += (long)((secs - (double)whole) * 1e9);
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+    *deadline = ts;
+    return 0;
+}
+
+int
+MemHive_CheckPriority(int priority)
+{
+    if (priority < 0 || priority >= MEMQUEUE_PRIORITIES) {
+        PyErr_Format(PyExc_ValueError,
+                     "priority must be between 0 and %d",
+                     MEMQUEUE_PRIORITIES - 1);
+        return -1;
+    }
+    return 0;
+}
+
+// Messages taken out of the queue per lock acquisition.
+#define LISTEN_MANY_BATCH 256
+
+PyObject *
+MemHive_ListenMany(module_state *state, PyObject *owner,
+                   MemQueue *queue, ssize_t channel,
+                   Py_ssize_t max_items, int block,
+                   const struct timespec *deadline,
+                   MemHive_MessageFunc make)
+{
+    if (max_items < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_items must be >= 1");
+        return NULL;
+    }
+
+    PyObject *ret = PyList_New(0);
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    MemQueueItem items[LISTEN_MANY_BATCH];
+
+    while (PyList_GET_SIZE(ret) < max_items) {
+        Py_ssize_t want = max_items - PyList_GET_SIZE(ret);
+        if (want > LISTEN_MANY_BATCH) {
+            want = LISTEN_MANY_BATCH;
+        }
+        // Only wait for the first message.
+        int first = PyList_GET_SIZE(ret) == 0;
+        ssize_t n = MemQueue_ListenMany(queue, state, channel,
+                                        first ? block : 0, deadline,
+                                        items, want);
+        if (n < 0) {
+            if (!first && PyErr_ExceptionMatches(state->ClosedQueueError)) {
+                // Return what we've got, the next call will raise.
+                PyErr_Clear();
+                break;
+            }
+            Py_DECREF(ret);
+            return NULL;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            PyObject *msg = (*make)(owner, &items[i]);
+            if (msg == NULL || PyList_Append(ret, msg)) {
+                Py_XDECREF(msg);
+                Py_DECREF(ret);
+                // Don't hold up the release of broadcasts we won't get to.
+                for (i++; i < n; i++) {
+                    MemQueue_BroadcastDone(&items[i]);
+                }
+                return NULL;
+            }
+            Py_DECREF(msg);
+        }
+
+        if (n < want) {
+            break;
+        }
+    }
+
+    return ret;
+}
@@ -3,6 +3,7 @@
 
 #include "module.h"
 #include "debug.h"
+#include "queue.h"
 
 // A type alias for PyObject* pointers to objects owned by a different
 // sub-interpreter.
@@ -12,4 +13,31 @@ PyObject * MemHive_CopyString(PyObject *o);
 
 PyObject * MemHive_CopyObject(module_state *, RemoteObject *);
 
+// Turns a message taken out of a queue into what `listen()` returns.
+typedef PyObject * (*MemHive_MessageFunc)(PyObject *, MemQueueItem *);
+
+// The longest timeout (and TTL) in seconds, a bit over 3 years;
+// longer ones are clamped to it. Still fits in a 32-bit time_t once
+// added to the current time, and in a PyTime_t in nanoseconds.
+#define MEMHIVE_TIMEOUT_MAX 1e8
+
+// Parses a `timeout` argument in seconds. None (or NULL) and inf
+// wait forever and set `*deadline` to NULL, 0 sets `*block` to 0;
+// otherwise `*deadline` points to `ts`, set to when to give up.
+// Negative and nan timeouts raise ValueError.
+int MemHive_ParseTimeout(PyObject *timeout, int *block,
+                         struct timespec *ts,
+                         const struct timespec **deadline);
+
+// Raises ValueError unless 0 <= `priority` < MEMQUEUE_PRIORITIES.
+int MemHive_CheckPriority(int priority);
+
+// A list of up to `max_items` messages from `channel` of `queue`,
+// taken in batches with MemQueue_ListenMany().
+PyObject * MemHive_ListenMany(module_state *state, PyObject *owner,
+                              MemQueue *queue, ssize_t channel,
+                              Py_ssize_t max_items, int block,
+                              const struct timespec *deadline,
+                              MemHive_MessageFunc make);
+
 #endif
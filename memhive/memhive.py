@@ -1,140 +1,341 @@
+import bisect
 import builtins
+import collections
 import dataclasses
 import itertools
 import marshal
+import os
 import sys
 import textwrap
 import threading
-
-if sys.version_info[:2] >= (3, 13):
-    Py_3_13 = True
-    import _interpreters as subint
-else:
-    Py_3_13 = False
-    import _xxsubinterpreters as subint
+import time
+import traceback
 
 from . import core
 from . import errors
 
 
-class CoreMemHive(core.MemHive):
+# Runs once in every worker interpreter: defines `__register()`, which
+# creates the interpreter's MemHiveSub, and `__run()`, which runs a
+# `main()` packed by `CoreMemHive.pack_main()`; for a `handler()`
+# worker, `__start()` and `__dispatch()` instead. They are called by
+# the native worker and dispatch threads (see core/pool.h). It is
+# compiled and marshalled once per process; workers only get the bytes.
+_WORKER_BOOTSTRAP_SRC = textwrap.dedent('''\
+    import marshal as __marshal
+    import sys as __sys
+    import traceback as __traceback
+    import types as __types
 
-    def __init__(self):
-        super().__init__()
+    __sys.path = __marshal.loads(__env)
 
-        self._workers = []
+    import memhive.core as __core
 
-        # Using `itertools.count()` here as opposed to `count += 1`,
-        # as the former is thread-safe. We also don't want sub ids
-        # to start at 0 (that's reserved for the main interpreter
-        # and I'd like to avoid any possible confusion)
-        # and we don't want them to appear to be mapped to real
-        # subinterpreter IDs (they can be out of sync anyway),
-        # hence a random offset.
-        self._sub_counter = itertools.count(42).__next__
+    if hasattr(__core, 'enable_object_tracking'):
+        __core.enable_object_tracking()
 
+    __sub = None
+    __handler = None
 
-    def add_worker(self, *, main=None):
-        def runner(code):
-            if Py_3_13:
-                sub = subint.create('isolated')
-            else:
-                sub = subint.create(isolated=True)
-            try:
-                subint.run_string(sub, code)
-            except Exception as ex:
-                # XXX: serialize exceptions properly
-                print('Unhandled error in a subinterpreter', type(ex), ex)
-                raise
-            finally:
-                subint.destroy(sub)
-
-        sub_id = self._sub_counter()
-        code = self._make_code(main=main, sub_id=sub_id)
-        worker_thread = threading.Thread(target=runner, args=(code,))
-        worker_thread.start()
-        self._workers.append(worker_thread)
-        return sub_id
+    def __register(hive_id, sub_id, exclusive=False):
+        global __sub
+        try:
+            __sub = __core.MemHiveSub(hive_id, sub_id, exclusive)
+        except __core.ClosedQueueError:
+            raise
+        except BaseException as ex:
+            nex = RuntimeError('COULD NOT INSTANTIATE SUB')
+            nex.__cause__ = ex
+            __traceback.print_exception(nex, file=__sys.stderr)
+            raise nex
+        return __sub
 
-    def _make_code(self, *, main, sub_id):
-        hive_id = repr(id(self))
-        sys_path = repr(sys.path)
+    def __unpack(payload, what):
+        global __sub
+        try:
+            name, code, defaults = __marshal.loads(payload)
+            return __types.FunctionType(code, globals(), name, defaults)
+        except Exception as ex:
+            __sub.report_error(
+                'RuntimeError',
+                f'failed to unserialize the "{what}()" worker function',
+                ex
+            )
+            __sub.close()
+            __sub = None
+            return None
 
-        main_name = repr(main.__name__)
-        main_code = repr(marshal.dumps(main.__code__))
-        main_defs = repr(marshal.dumps(main.__defaults__))
+    def __run(payload):
+        global __sub
+        main = __unpack(payload, 'main')
+        if main is None:
+            return
 
-        return textwrap.dedent(f'''\
-            import marshal as __marshal
-            import os as __os
-            import sys as __sys
-            import traceback as __traceback
-            import types as __types
+        __sub.report_start()
+        try:
+            main(__sub)
+        except __core.ClosedQueueError:
+            __sub.report_close() # XXX do this properly
+        except Exception as ex:
+            __sub.report_error(
+                'RuntimeError',
+                'unhandled exception during the "main()" worker call',
+                ex
+            )
+        except BaseException as ex:
+            __sub.report_error(
+                'RuntimeError',
+                'unhandled base exception during the "main()"'
+                'worker call',
+                ex
+            )
+            raise
+        else:
+            __sub.report_close()
+        finally:
+            __sub.close()
+            __sub = None
 
-            import memhive.core as __core
+    def __start(payload):
+        global __handler
+        __handler = __unpack(payload, 'handler')
+        if __handler is None:
+            return False
+        __sub.report_start()
+        return True
 
-            if hasattr(__core, 'enable_object_tracking'):
-                __core.enable_object_tracking()
+    def __dispatch(max_items):
+        # Handles what's there without waiting for more; returns
+        # False once the worker is done.
+        global __sub
+        done = True
+        try:
+            for msg in __sub.listen_many(max_items, 0):
+                __handler(__sub, msg)
+            done = False
+        except __core.ClosedQueueError:
+            __sub.report_close()
+        except Exception as ex:
+            __sub.report_error(
+                'RuntimeError',
+                'unhandled exception during the "handler()" worker call',
+                ex
+            )
+        except BaseException as ex:
+            __sub.report_error(
+                'RuntimeError',
+                'unhandled base exception during the "handler()" worker call',
+                ex
+            )
+            raise
+        finally:
+            if done:
+                __sub.close()
+                __sub = None
+        return not done
+''')
 
-            __sys.path = {sys_path}
+_WORKER_BOOTSTRAP = marshal.dumps(
+    compile(_WORKER_BOOTSTRAP_SRC, '<memhive-worker>', 'exec'))
+
+
+# How often `map()` checks on its workers while waiting for results.
+_MAP_POLL_INTERVAL = 0.1
+
+
+def _map_handler(sub, req):
+    # Runs a chunk of `MemHive.map()`: chunks are pushed to this worker
+    # only, as `(packed_fn, items)` tuples; the response is
+    # `(True, results)` or `(False, error_name, error_message)`. The
+    # worker serves the hive's `map()` calls until it's closed, so the
+    # functions it has unpacked are kept for the next chunks.
+    import marshal
+    import types
+
+    from memhive.core import QueueRequest
+
+    if not isinstance(req, QueueRequest):
+        # E.g. a broadcast; every worker gets its own copy and this
+        # one has no use for it.
+        return
+    try:
+        packed_fn, items = req.arg
+    except (TypeError, ValueError):
+        raise TypeError(
+            f'map() worker got a message that is not a chunk: {req!r}')
+
+    fns = globals().setdefault('_map_fns', {})
+    fn = fns.get(packed_fn)
+    if fn is None:
+        if len(fns) >= 64:
+            # Don't keep every function ever mapped.
+            fns.clear()
+        name, code, defaults = marshal.loads(packed_fn)
+        fn = fns[packed_fn] = types.FunctionType(
+            code, globals(), name, defaults)
+
+    try:
+        results = tuple([fn(item) for item in items])
+    except Exception as ex:
+        req((False, type(ex).__name__, str(ex)))
+    else:
+        req((True, results))
+
+
+def _map_chunks(iterable, chunksize):
+    it = iter(iterable)
+    while chunk := tuple(itertools.islice(it, chunksize)):
+        yield chunk
+
+
+class _MapWorkers:
+
+    # The workers serving one `map()` call. Each chunk is pushed to the
+    # one with the fewest of the call's chunks pending, and only it can
+    # take it.
+
+    def __init__(self, hive, statuses):
+        self._mem = hive._mem
+        self._statuses = {status.wid: status for status in statuses}
+        self._pending = dict.fromkeys(self._statuses, 0)
+        self._owners = {}
+
+    def wait_started(self):
+        # A worker's sub is only registered once it starts.
+        for status in self._statuses.values():
+            status.ready.wait()
+
+    def push(self, chunk):
+        wid = min(self._pending, key=self._pending.get)
+        status = self._statuses[wid]
+        try:
+            msg_id = self._mem.push_to(wid, chunk)
+        except KeyError:
+            raise RuntimeError(
+                f'map() worker {wid} has exited') from status.error
+        self._pending[wid] += 1
+        self._owners[msg_id] = wid
+        return msg_id
+
+    def done(self, msg_id):
+        # Returns False if `msg_id` isn't one of ours.
+        wid = self._owners.pop(msg_id, None)
+        if wid is None:
+            return False
+        self._pending[wid] -= 1
+        return True
+
+    def exited(self):
+        # A worker that has exited with chunks pending. Check before
+        # waiting for results: everything it had sent by then will
+        # still arrive.
+        for wid, status in self._statuses.items():
+            if self._pending[wid] and status.completed.is_set():
+                return status
+        return None
+
+    def exited_error(self, status):
+        return RuntimeError(
+            f'map() worker {status.wid} exited with chunks pending')
+
+
+def _deadline(timeout):
+    if timeout is None:
+        return None
+    try:
+        return time.monotonic() + timeout
+    except TypeError:
+        # Left for the core to reject.
+        return None
+
+
+def _remaining(deadline):
+    # The timeout left for another try of `listen()` & co. after one
+    # has only got `map()` responses.
+    if deadline is None:
+        return None
+    return max(deadline - time.monotonic(), 0)
+
+
+def _map_results(data):
+    if data[0]:
+        return data[1]
+    _, err_name, err_msg = data
+    err_type = getattr(builtins, err_name, None)
+    if not (isinstance(err_type, type)
+            and issubclass(err_type, Exception)):
+        err_type = RuntimeError
+        err_msg = f'{err_name}: {err_msg}'
+    raise err_type(err_msg)
+
+
+def _cpu_topology(cpu):
+    base = f'/sys/devices/system/cpu/cpu{cpu}/topology'
+    try:
+        with open(f'{base}/physical_package_id') as f:
+            package = int(f.read())
+        with open(f'{base}/core_id') as f:
+            core_id = int(f.read())
+    except (OSError, ValueError):
+        return (0, cpu)
+    return (package, core_id)
 
-            try:
-                __sub = __core.MemHiveSub({hive_id}, {sub_id})
-            except BaseException as ex:
-                nex = RuntimeError('COULD NOT INSTANTIATE SUB')
-                nex.__cause__ = ex
-                __traceback.print_exception(nex, file=__sys.stderr)
-                raise nex
-
-            if __sub is not None:
-                try:
-                    __main = __types.FunctionType(
-                        __marshal.loads({main_code}),
-                        globals(),
-                        {main_name},
-                        __marshal.loads({main_defs})
-                    )
-                except Exception as ex:
-                    __sub.report_error(
-                        'RuntimeError',
-                        'failed to unserialize the "main()" worker function',
-                        ex
-                    )
-                    __sub.close()
-                    __sub = None
-
-            if __sub is not None:
-                __sub.report_start()
-                try:
-                    __main(__sub)
-                except __core.ClosedQueueError:
-                    __sub.report_close() # XXX do this properly
-                except Exception as ex:
-                    __sub.report_error(
-                        'RuntimeError',
-                        'unhandled exception during the "main()" worker call',
-                        ex
-                    )
-                except BaseException as ex:
-                    __sub.report_error(
-                        'RuntimeError',
-                        'unhandled base exception during the "main()"'
-                        'worker call',
-                        ex
-                    )
-                    raise
-                else:
-                    __sub.report_close()
-                finally:
-                    __sub.close()
-                    __sub = None
-
-        ''')
-
-    def join_worker_threads(self):
-        for w in self._workers:
-            w.join()
-        self._workers.clear()
+
+def _cpu_order(cpus, policy):
+    # 'compact' fills all hardware threads of a core, then all cores
+    # of a package before moving on; 'scatter' puts consecutive workers
+    # on different packages and cores, using hyperthread siblings last.
+    topo = {cpu: _cpu_topology(cpu) for cpu in cpus}
+    by_core = sorted(cpus, key=lambda cpu: (topo[cpu], cpu))
+    if policy == 'compact':
+        return by_core
+
+    siblings = {}
+    for cpu in by_core:
+        siblings.setdefault(topo[cpu], []).append(cpu)
+    packages = sorted({package for package, _ in siblings})
+    core_rank = {}
+    for package in packages:
+        in_package = [core for core in siblings if core[0] == package]
+        for rank, core in enumerate(in_package):
+            core_rank[core] = rank
+
+    return sorted(cpus, key=lambda cpu: (
+        siblings[topo[cpu]].index(cpu),
+        core_rank[topo[cpu]],
+        packages.index(topo[cpu][0]),
+    ))
+
+
+def _allowed_cpus():
+    if not hasattr(os, 'sched_getaffinity'):
+        raise NotImplementedError(
+            'CPU affinity is not supported on this platform')
+    return os.sched_getaffinity(0)
+
+
+class CoreMemHive(core.MemHive):
+
+    def __init__(self, *, pool_size=0, dispatch_threads=1, **kwargs):
+        super().__init__(**kwargs)
+
+        # Up to `pool_size` interpreters are kept around after their
+        # worker is done (or started in advance by `fill_pool()`), with
+        # the imports done, waiting for the next `main` to run. Their
+        # MemHiveSub is registered once they get one. Workers with
+        # a `handler` share `dispatch_threads` threads.
+        self.init_workers(
+            pool_size, dispatch_threads, _WORKER_BOOTSTRAP,
+            marshal.dumps(sys.path))
+
+    def pack_main(self, main):
+        # The same payload can be passed to any number of workers.
+        return marshal.dumps((main.__name__, main.__code__, main.__defaults__))
+
+    def add_worker(self, *, main=None):
+        sub_id = self.acquire_worker()
+        self.run_worker(sub_id, self.pack_main(main))
+        return sub_id
 
 
 @dataclasses.dataclass
@@ -146,16 +347,238 @@ class WorkerStatus:
         default_factory=threading.Event)
     completed: threading.Event = dataclasses.field(
         default_factory=threading.Event)
+    # Told to stop, or found gone by `push_to()`; no more keyed pushes.
+    retired: bool = False
+    # Runs a `handler()` on a dispatch thread, see `start_workers()`.
+    handler: bool = False
+    # Only gets messages sent to it, like `map()`'s workers; no keyed
+    # pushes either.
+    exclusive: bool = False
+
+
+class _KeyRing:
+
+    # Consistent hashing of keys over workers: every worker owns
+    # `replicas` points on a ring of hashes and a key goes to the owner
+    # of the first point at or after its own hash. A worker joining or
+    # leaving only moves the keys next to its points.
+
+    def __init__(self, wids, replicas=64):
+        self.wids = frozenset(wids)
+        points = sorted(
+            (hash((wid, i)), wid) for wid in self.wids for i in range(replicas))
+        self._hashes = [h for h, _ in points]
+        self._owners = [wid for _, wid in points]
+
+    def lookup(self, key):
+        # Hashing a 1-tuple spreads out small ints, which hash to
+        # themselves.
+        i = bisect.bisect_left(self._hashes, hash((key,)))
+        return self._owners[i % len(self._owners)]
+
+
+@dataclasses.dataclass(frozen=True)
+class ScalingEvent:
+
+    action: str     # 'up' or 'down'
+    wid: int
+    depth: int      # pushed messages waiting for a worker
+    load: float     # mean busy fraction of the autoscaled workers
+
+
+class Autoscaler:
+
+    # Adds a worker when more than `scale_up_depth` pushed messages
+    # per worker are waiting for `scale_up_after` samples in a row,
+    # and retires the least busy one when nothing is waiting and the
+    # workers were busy less than `scale_down_load` of the time for
+    # `scale_down_after` samples in a row. Workers are "busy" when
+    # they aren't blocked in `listen()`.
+
+    def __init__(self, hive, *, main, min_workers, max_workers, interval,
+                 scale_up_depth, scale_down_load, scale_up_after,
+                 scale_down_after, on_event):
+        if not 0 <= min_workers <= max_workers:
+            raise ValueError(
+                'expected 0 <= min_workers <= max_workers')
+
+        self._hive = hive
+        self._main = main
+        self._min_workers = min_workers
+        self._max_workers = max_workers
+        self._interval = interval
+        self._scale_up_depth = scale_up_depth
+        self._scale_down_load = scale_down_load
+        self._scale_up_after = scale_up_after
+        self._scale_down_after = scale_down_after
+        self.on_event = on_event
+
+        self._wids = set()
+        self._samples = {}
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run)
+
+    def start(self):
+        for _ in range(self._min_workers):
+            self._scale_up(depth=0, load=0.0)
+        self._thread.start()
+
+    def stop(self):
+        # Let the workers finish the pushed messages first, then
+        # retire all of them.
+        self._stop.set()
+        self._thread.join()
+        mem = self._hive._mem
+        while mem.subs_queue_depth() and self._alive():
+            time.sleep(self._interval)
+        for wid in list(self._wids):
+            self._scale_down(wid, depth=0, load=0.0)
+
+    def _alive(self):
+        workers = self._hive._workers
+        return any(not workers[wid].completed.is_set() for wid in self._wids)
+
+    def _sample_load(self):
+        # Busy fraction per worker since the previous sample.
+        current = self._hive._mem.worker_load()
+        loads = {}
+        for wid in list(self._wids):
+            if wid not in current:
+                if self._hive._workers[wid].completed.is_set():
+                    # Exited on its own.
+                    self._wids.discard(wid)
+                    self._samples.pop(wid, None)
+                # Otherwise not started yet.
+                continue
+            lifetime, idle = current[wid]
+            prev_lifetime, prev_idle = self._samples.get(wid, (0, 0))
+            elapsed = lifetime - prev_lifetime
+            if elapsed > 0:
+                loads[wid] = 1.0 - (idle - prev_idle) / elapsed
+            self._samples[wid] = (lifetime, idle)
+        return loads
+
+    def _scale_up(self, *, depth, load):
+        [status] = self._hive.start_workers(1, main=self._main)
+        self._wids.add(status.wid)
+        self._hive._mem.report_scaling('up', status.wid, depth, load)
+
+    def _scale_down(self, wid, *, depth, load):
+        self._wids.discard(wid)
+        self._samples.pop(wid, None)
+        if self._hive._workers[wid].completed.is_set():
+            return
+        # Reported first so that `close()`, which waits for the worker
+        # to report back, doesn't miss the event.
+        self._hive._mem.report_scaling('down', wid, depth, load)
+        self._hive._workers[wid].retired = True
+        try:
+            self._hive._mem.retire_worker(wid)
+        except KeyError:
+            # Exited in the meantime.
+            pass
+
+    def _run(self):
+        self._hive._pin_listener()
+        mem = self._hive._mem
+        over = under = 0
+        while not self._stop.wait(self._interval):
+            depth = mem.subs_queue_depth()
+            loads = self._sample_load()
+            load = sum(loads.values()) / len(loads) if loads else 0.0
+            nworkers = len(self._wids)
+
+            if (depth > self._scale_up_depth * nworkers
+                    and nworkers < self._max_workers):
+                over += 1
+                under = 0
+                if over >= self._scale_up_after:
+                    over = 0
+                    self._scale_up(depth=depth, load=load)
+            elif (depth == 0 and load < self._scale_down_load
+                    and nworkers > self._min_workers):
+                under += 1
+                over = 0
+                if under >= self._scale_down_after:
+                    under = 0
+                    wid = min(self._wids, key=lambda w: loads.get(w, 0.0))
+                    self._scale_down(wid, depth=depth, load=load)
+            else:
+                over = under = 0
 
 
 class MemHive:
 
-    def __init__(self):
-        self._mem = CoreMemHive()
+    def __init__(self, *, group_commit_window=None, ttl_sweep_interval=1.0,
+                 shards=1, pool_size=0, listener_affinity=None,
+                 ring_capacity=0, queue_capacity=0, work_stealing=False,
+                 dispatch_threads=None):
+        # `group_commit_window` (seconds) enables group commit: concurrent
+        # `__setitem__` calls arriving within the window are applied to
+        # the index as one mutation with a single root swap.
+        #
+        # With `shards` > 1 the index is partitioned by key hash, each
+        # shard having its own root and lock, so writers don't stall
+        # readers of unrelated keys. Iteration and `snapshot()` then
+        # have to merge the shards into a new Map.
+        #
+        # `pool_size` subinterpreters are started in advance and kept
+        # for reuse once their workers are done, which makes starting
+        # a worker much cheaper.
+        #
+        # With `ring_capacity` > 0 `push()` goes through a lock-free
+        # ring buffer of that size shared by all workers, and waits for
+        # room when it's full.
+        #
+        # `queue_capacity` bounds how many pushed messages can wait for
+        # a worker; `push()` then waits for room or raises
+        # QueueFullError, see `queue_stats()` for how often that
+        # happens.
+        #
+        # With `work_stealing` `push()` deals messages round-robin to
+        # per-worker queues instead of one shared queue; a worker that
+        # runs out steals from the back of the busiest other one.
+        #
+        # Workers added with a `handler` run on up to `dispatch_threads`
+        # threads (the number of CPUs by default), see `start_workers()`.
+        if dispatch_threads is None:
+            dispatch_threads = os.cpu_count() or 1
+        self._mem = CoreMemHive(
+            group_commit_window=group_commit_window, shards=shards,
+            pool_size=pool_size, ring_capacity=ring_capacity,
+            queue_capacity=queue_capacity, work_stealing=work_stealing,
+            dispatch_threads=dispatch_threads)
         self._inside = False
         self._closed = False
 
+        # Keys set with a TTL are removed by a background thread
+        # every `ttl_sweep_interval` seconds (started on first use).
+        self._ttl_sweep_interval = ttl_sweep_interval
+        self._ttl_sweeper = None
+        self._ttl_sweeper_lock = threading.Lock()
+        self._ttl_sweeper_stop = threading.Event()
+
+        # CPUs to pin the hive's own background threads to.
+        if listener_affinity is not None:
+            listener_affinity = set(listener_affinity)
+            if not listener_affinity <= _allowed_cpus():
+                raise ValueError('listener_affinity lists unavailable CPUs')
+        self._listener_affinity = listener_affinity
+
         self._workers = {}
+        self._workers_placed = 0
+        self._key_ring = None
+
+        # Responses to `map()` chunks are routed by message id to the
+        # call waiting for them, whoever listens; other messages taken
+        # by `map()` wait in `_stashed` for `listen()`. `map()` runs on
+        # the workers in `_map_statuses`.
+        self._map_waiters = {}
+        self._map_lock = threading.Lock()
+        self._stashed = collections.deque()
+        self._map_statuses = []
+        self._autoscaler = None
+        self.scaling_events = []
         self._health_listener = None
         self._health_listener_started = threading.Event()
 
@@ -165,11 +588,242 @@ class MemHive:
         if not self._inside:
             raise RuntimeError("MemHive hasn't entered its context")
 
-    def add_worker(self, *, main=None):
+    def add_worker(self, *, main=None, handler=None, affinity=None):
+        self.add_workers(1, main=main, handler=handler, affinity=affinity)
+
+    def add_workers(self, n, *, main=None, handler=None, affinity=None):
+        # Workers are started concurrently; returns once all of them
+        # are running `main()`.
+        started = self.start_workers(
+            n, main=main, handler=handler, affinity=affinity)
+        for status in started:
+            status.ready.wait()
+
+    def start_workers(self, n, *, main=None, handler=None, affinity=None):
+        # Doesn't wait for the workers to start, see
+        # `wait_workers_started()`.
+        #
+        # `affinity` pins each worker's thread to one CPU: it's either
+        # a list of CPUs to assign round-robin, or 'compact'/'scatter'
+        # to place workers near to or far from the previously added
+        # ones (see `_cpu_order()`).
+        #
+        # Workers given a `handler` instead of a `main` don't get
+        # a thread each: `handler(sub, msg)` is called with every
+        # message `sub.listen()` would return, on one of the hive's
+        # dispatch threads. Those sleep until one of their workers has
+        # a message, so thousands of mostly idle workers cost a few
+        # threads, and a message is handled without waking a thread
+        # per worker. A handler must not block (e.g. in `sub.listen()`)
+        # as that stalls the other workers of its thread. The worker
+        # exits once it's retired or the hive is closed.
         self._ensure_active()
-        wid = self._mem.add_worker(main=main)
-        self._workers[wid] = WorkerStatus(wid=wid)
-        self._workers[wid].ready.wait()
+        if (main is None) == (handler is None):
+            raise ValueError('either main or handler is required')
+        if handler is not None:
+            if affinity is not None:
+                raise ValueError(
+                    'handler workers run on the dispatch threads, '
+                    'they have no affinity of their own')
+            return self._start_handlers(n, handler)
+
+        cpus = self._place_workers(n, affinity)
+        started = []
+        payload = self._mem.pack_main(main)
+        for cpu in cpus:
+            wid = self._mem.acquire_worker()
+            self._workers[wid] = status = WorkerStatus(wid=wid)
+            self._mem.run_worker(wid, payload, cpu)
+            started.append(status)
+        return started
+
+    def _start_handlers(self, n, handler, *, exclusive=False):
+        # `exclusive` workers only get messages sent to them, never
+        # those of `push()`.
+        payload = self._mem.pack_main(handler)
+        started = []
+        for _ in range(n):
+            wid = self._mem.acquire_handler()
+            self._workers[wid] = status = WorkerStatus(
+                wid=wid, handler=True, exclusive=exclusive)
+            self._mem.run_handler(wid, payload, exclusive)
+            started.append(status)
+        return started
+
+    def _place_workers(self, n, affinity):
+        if affinity is None:
+            return [-1] * n
+
+        allowed = _allowed_cpus()
+        if isinstance(affinity, str):
+            if affinity not in ('compact', 'scatter'):
+                raise ValueError(
+                    f'unknown affinity policy {affinity!r}, expected '
+                    f'"compact", "scatter" or a list of CPUs')
+            order = _cpu_order(allowed, affinity)
+            first = self._workers_placed
+            self._workers_placed += n
+            return [order[(first + i) % len(order)] for i in range(n)]
+
+        cpus = list(affinity)
+        if not cpus:
+            raise ValueError('affinity must list at least one CPU')
+        for cpu in cpus:
+            if cpu not in allowed:
+                raise ValueError(f'CPU {cpu!r} is not available')
+        return [cpus[i % len(cpus)] for i in range(n)]
+
+    def _pin_listener(self):
+        if self._listener_affinity is not None:
+            os.sched_setaffinity(0, self._listener_affinity)
+
+    def autoscale(self, *, main, min_workers=1, max_workers=None,
+                  interval=0.1, scale_up_depth=1, scale_down_load=0.25,
+                  scale_up_after=2, scale_down_after=10, on_event=None):
+        # Runs between `min_workers` and `max_workers` (the number of
+        # CPUs by default) workers running `main()`, depending on how
+        # many pushed messages are waiting; see `Autoscaler`. Decisions
+        # are delivered by the health listener thread: appended to
+        # `scaling_events` and passed to `on_event()`.
+        self._ensure_active()
+        if self._autoscaler is not None:
+            raise RuntimeError('autoscaling is already enabled')
+        if max_workers is None:
+            max_workers = max(os.cpu_count() or 1, min_workers)
+        self._autoscaler = Autoscaler(
+            self,
+            main=main,
+            min_workers=min_workers,
+            max_workers=max_workers,
+            interval=interval,
+            scale_up_depth=scale_up_depth,
+            scale_down_load=scale_down_load,
+            scale_up_after=scale_up_after,
+            scale_down_after=scale_down_after,
+            on_event=on_event,
+        )
+        self._autoscaler.start()
+
+    def map(self, fn, iterable, *, chunksize=1, workers=None,
+            max_inflight=None):
+        # Like `builtins.map()`, but `fn` is called in `workers` (the
+        # number of CPUs by default) workers of the hive's own.
+        # Items are pushed to the workers in tuples of `chunksize`;
+        # at most `max_inflight` (2 per worker by default) chunks are
+        # waiting for results at any time. Items and results are copied
+        # between interpreters like `push()` messages, so they have to
+        # be str, bytes, numbers, None, tuples of those or Maps.
+        #
+        # The workers are started by the first call that gets to
+        # iterating and kept for the next ones until `close()`; a call
+        # asking for more starts the missing ones. They're handler
+        # workers (see `start_workers()`): a subinterpreter each, but no
+        # thread of their own, so at most `dispatch_threads` of them
+        # run at once, and a chunk keeps the other handler workers of
+        # its dispatch thread waiting. They only get chunks, never the
+        # messages of `push()`. Results are matched to the chunks by
+        # message id, so `listen()` can be called meanwhile: it never
+        # returns them and still gets every other message.
+        self._ensure_active()
+        if chunksize < 1:
+            raise ValueError('chunksize must be >= 1')
+        if workers is None:
+            workers = os.cpu_count() or 1
+        if workers < 1:
+            raise ValueError('workers must be >= 1')
+        if max_inflight is None:
+            max_inflight = 2 * workers
+        if max_inflight < 1:
+            raise ValueError('max_inflight must be >= 1')
+        return self._map(
+            self._mem.pack_main(fn), _map_chunks(iterable, chunksize),
+            workers, max_inflight)
+
+    def _map(self, packed_fn, chunks, workers, max_inflight):
+        # The workers are started on the first `next()`, so a result
+        # that's never iterated doesn't start them.
+        mapped = _MapWorkers(self, self._map_workers(workers))
+        inflight = collections.deque()
+        done = {}
+        try:
+            mapped.wait_started()
+            for chunk in chunks:
+                if len(inflight) >= max_inflight:
+                    yield from self._map_wait(
+                        inflight.popleft(), done, mapped)
+                inflight.append(
+                    self._map_push(mapped, (packed_fn, chunk), done))
+            while inflight:
+                yield from self._map_wait(inflight.popleft(), done, mapped)
+        finally:
+            # Don't leave responses to an abandoned `map()` behind.
+            while inflight:
+                msg_id = inflight.popleft()
+                while msg_id not in done:
+                    self._map_receive(mapped)
+                done.pop(msg_id)
+
+    def _map_workers(self, n):
+        with self._map_lock:
+            live = [status for status in self._map_statuses
+                    if not status.retired and not status.completed.is_set()]
+            if len(live) < n:
+                live.extend(self._start_handlers(
+                    n - len(live), _map_handler, exclusive=True))
+            self._map_statuses = live
+            return live[:n]
+
+    def _map_push(self, mapped, chunk, done):
+        # Under the lock, so that the response can't be routed before
+        # we're waiting for it.
+        with self._map_lock:
+            msg_id = mapped.push(chunk)
+            self._map_waiters[msg_id] = (mapped, done)
+        return msg_id
+
+    def _map_wait(self, msg_id, done, mapped):
+        while msg_id not in done:
+            self._map_receive(mapped)
+        return _map_results(done.pop(msg_id))
+
+    def _map_receive(self, mapped):
+        # Takes one message; it's either a response to some `map()`
+        # call (not necessarily this one) or for `listen()`.
+        exited = mapped.exited()
+        msg = self._mem.listen(_MAP_POLL_INTERVAL)
+        if msg is None:
+            if exited is not None:
+                raise mapped.exited_error(exited) from exited.error
+            return
+        if not self._route_map_response(msg):
+            self._stashed.append(msg)
+
+    def _route_map_response(self, msg):
+        if not isinstance(msg, core.QueueResponse):
+            return False
+        with self._map_lock:
+            waiter = self._map_waiters.pop(msg.id, None)
+        if waiter is None:
+            return False
+        mapped, done = waiter
+        mapped.done(msg.id)
+        done[msg.id] = msg.data
+        return True
+
+    def _retire_workers(self, statuses):
+        for status in statuses:
+            # A worker's sub is only registered once it starts.
+            status.ready.wait()
+            status.retired = True
+            try:
+                self._mem.retire_worker(status.wid)
+            except KeyError:
+                # Exited in the meantime.
+                pass
+
+    def wait_workers_started(self):
+        for status in list(self._workers.values()):
+            status.ready.wait()
 
     def __getitem__(self, key):
         self._ensure_active()
@@ -179,21 +833,204 @@ class MemHive:
         self._ensure_active()
         return key in self._mem
 
+    def __len__(self):
+        self._ensure_active()
+        return len(self._mem)
+
+    def __iter__(self):
+        self._ensure_active()
+        return iter(self._mem)
+
+    def snapshot(self):
+        self._ensure_active()
+        return self._mem.snapshot()
+
     def __setitem__(self, key, val):
         self._ensure_active()
         self._mem[key] = val
 
+    def __delitem__(self, key):
+        self._ensure_active()
+        del self._mem[key]
+
+    def pop(self, key, *default):
+        self._ensure_active()
+        return self._mem.pop(key, *default)
+
+    def set(self, key, val, *, ttl=None):
+        # An expired key stays visible until the next sweep. An infinite
+        # `ttl` is the same as none.
+        self._ensure_active()
+        self._mem.set(key, val, ttl)
+        if ttl is not None:
+            self._ensure_ttl_sweeper()
+
+    def sweep_expired(self):
+        self._ensure_active()
+        return self._mem.sweep_expired()
+
+    def _ensure_ttl_sweeper(self):
+        with self._ttl_sweeper_lock:
+            if self._ttl_sweeper is None:
+                self._ttl_sweeper = threading.Thread(
+                    target=self._sweep_expired_keys)
+                self._ttl_sweeper.start()
+
+    def _sweep_expired_keys(self):
+        self._pin_listener()
+        while not self._ttl_sweeper_stop.wait(self._ttl_sweep_interval):
+            # Keep sweeping: dying here would stop TTLs from expiring
+            # for the rest of the hive's life.
+            try:
+                self._mem.sweep_expired()
+            except Exception:
+                traceback.print_exc()
+
+    def cas(self, key, expected, new):
+        # `expected` is compared by identity with the current value.
+        self._ensure_active()
+        return self._mem.cas(key, expected, new)
+
+    def setdefault(self, key, value):
+        self._ensure_active()
+        return self._mem.setdefault(key, value)
+
+    def update_key(self, key, fn, *default):
+        # `fn` is called outside of the index lock and can be called
+        # more than once if `key` is updated concurrently.
+        self._ensure_active()
+        return self._mem.update_key(key, fn, *default)
+
+    def index_version(self):
+        self._ensure_active()
+        return self._mem.index_version()
+
+    def memory_stats(self, *, deep=False, shared_with=None):
+        self._ensure_active()
+        return self._mem.memory_stats(deep=deep, shared_with=shared_with)
+
     def broadcast(self, message):
         self._ensure_active()
         self._mem.broadcast(message)
 
-    def push(self, message):
+    def push(self, message, timeout=None, *, priority=0):
+        # If the queue is full, waits up to `timeout` seconds (forever
+        # if None, not at all if 0) for room, then raises QueueFullError.
+        # Messages with a higher `priority` (0 to 2) are taken first;
+        # the ring buffer only has priority 0.
+        self._ensure_active()
+        return self._mem.push(message, timeout, priority)
+
+    def push_to(self, wid, message):
+        # Only the worker `wid` gets the message; raises KeyError if it
+        # isn't running. Returns the message id, like `push()`.
+        self._ensure_active()
+        return self._mem.push_to(wid, message)
+
+    def push_keyed(self, key, message):
+        # Messages with the same key go to the same worker for as long
+        # as it runs; when workers come or go only the keys of the ones
+        # next to them on the hash ring move. Returns the worker's id
+        # and the message id.
+        self._ensure_active()
+        while True:
+            live = [status.wid for status in list(self._workers.values())
+                    if status.ready.is_set() and not status.retired
+                    and not status.completed.is_set()
+                    and not status.exclusive]
+            if not live:
+                raise RuntimeError('no running workers to push to')
+            if self._key_ring is None or self._key_ring.wids != set(live):
+                self._key_ring = _KeyRing(live)
+            wid = self._key_ring.lookup(key)
+            try:
+                msg_id = self._mem.push_to(wid, message)
+            except KeyError:
+                # Exited, we haven't heard about it yet.
+                self._workers[wid].retired = True
+                continue
+            return wid, msg_id
+
+    def push_many(self, messages, timeout=None):
+        # Pushes all `messages` at once; returns the list of their ids.
+        # Waits for room like `push()`, `timeout` is for all of them.
+        # If it fails partway, the exception's `pushed` attribute has
+        # the ids of the messages that made it into the queue.
+        self._ensure_active()
+        return self._mem.push_many(messages, timeout)
+
+    def listen(self, timeout=None):
+        # Returns None if nothing came within `timeout` seconds.
         self._ensure_active()
-        self._mem.push(message)
+        deadline = _deadline(timeout)
+        while True:
+            try:
+                return self._stashed.popleft()
+            except IndexError:
+                pass
+            msg = self._mem.listen(timeout)
+            if msg is None or not self._route_map_response(msg):
+                return msg
+            timeout = _remaining(deadline)
 
-    def listen(self):
+    def try_listen(self):
+        # Returns None if there's no message instead of waiting.
         self._ensure_active()
-        return self._mem.listen()
+        try:
+            return self._stashed.popleft()
+        except IndexError:
+            pass
+        while True:
+            msg = self._mem.try_listen()
+            if msg is None or not self._route_map_response(msg):
+                return msg
+
+    def listen_many(self, max_items, timeout=0):
+        # Up to `max_items` messages. By default only takes what's
+        # already waiting; otherwise waits up to `timeout` seconds
+        # (forever if None) for the first one. Returns a list, empty if
+        # nothing came.
+        self._ensure_active()
+        msgs = []
+        while len(msgs) < max_items:
+            try:
+                msgs.append(self._stashed.popleft())
+            except IndexError:
+                break
+        if msgs:
+            # Don't wait, there's something to return already.
+            timeout = 0
+            if len(msgs) == max_items:
+                return msgs
+        deadline = _deadline(timeout)
+        while True:
+            batch = self._mem.listen_many(max_items - len(msgs), timeout)
+            msgs.extend(
+                msg for msg in batch if not self._route_map_response(msg))
+            if msgs or not batch:
+                return msgs
+            timeout = _remaining(deadline)
+
+    def queue_stats(self):
+        # {'depth': ..., 'capacity': ..., 'full': ...} for the queue of
+        # pushed messages; `full` counts pushes that found it full.
+        self._ensure_active()
+        return self._mem.queue_stats()
+
+    def intake_depths(self):
+        # {worker id: its messages waiting for `listen()`}. Every worker
+        # has its own queue, and `listen()` takes from them in turns,
+        # so one that floods main only delays the others a little.
+        self._ensure_active()
+        return self._mem.intake_depths()
+
+    def readiness_fd(self):
+        # Becomes readable when there are messages for `listen()`, see
+        # `MemQueue_ReadinessFd()`. Read it (e.g. `os.eventfd_read()`)
+        # before taking messages with `listen_many()` or `try_listen()`
+        # until there are none left.
+        self._ensure_active()
+        return self._mem.readiness_fd()
 
     def __enter__(self):
         self._inside = True
@@ -204,6 +1041,8 @@ class MemHive:
         self._health_listener.start()
         self._health_listener_started.wait()
 
+        self._mem.fill_pool()
+
         return self
 
     def __exit__(self, *e):
@@ -211,6 +1050,7 @@ class MemHive:
         self.close()
 
     def _listen_for_health_updates(self):
+        self._pin_listener()
         self._health_listener_started.set()
 
         while True:
@@ -225,6 +1065,9 @@ class MemHive:
                     new_err = err_type(err_msg)
                     new_err.__cause__ = exc
                     self._workers[wid].error = new_err
+                    # A worker can fail before it starts; don't leave
+                    # anyone waiting for it.
+                    self._workers[wid].ready.set()
                     self._workers[wid].completed.set()
 
                 case ("CLOSE", wid):
@@ -233,6 +1076,25 @@ class MemHive:
                 case ("START", wid):
                     self._workers[wid].ready.set()
 
+                case ("LOST", wid):
+                    # Its interpreter couldn't be set up (the pool
+                    # printed why).
+                    status = self._workers[wid]
+                    status.error = RuntimeError(
+                        f'worker {wid} could not be started')
+                    status.ready.set()
+                    status.completed.set()
+
+                case ("SCALE", action, wid, depth, load):
+                    event = ScalingEvent(
+                        action=action, wid=wid, depth=depth, load=load)
+                    self.scaling_events.append(event)
+                    if self._autoscaler.on_event is not None:
+                        try:
+                            self._autoscaler.on_event(event)
+                        except Exception:
+                            traceback.print_exc()
+
                 case _:
                     raise RuntimeError(f'unknown message {_}')
 
@@ -244,6 +1106,14 @@ class MemHive:
             return
 
         try:
+            if self._autoscaler is not None:
+                self._autoscaler.stop()
+
+            # Handler workers run until they're told to stop.
+            self._retire_workers([
+                status for status in self._workers.values()
+                if status.handler and not status.retired])
+
             ers = []
             for wrk in self._workers.values():
                 wrk.completed.wait()
@@ -259,6 +1129,13 @@ class MemHive:
         finally:
             self._closed = True
 
+            self._ttl_sweeper_stop.set()
+            with self._ttl_sweeper_lock:
+                if self._ttl_sweeper is not None:
+                    self._ttl_sweeper.join()
+                    self._ttl_sweeper = None
+
+            self._mem.close_pool()
             self._mem.close_subs_health_queue()
             self._health_listener.join()
             self._health_listener = None
@@ -67,6 +67,8 @@ if platform.python_implementation() == 'CPython':
                 "memhive/core/refqueue.c",
                 "memhive/core/module.c",
                 "memhive/core/memhive.c",
+                "memhive/core/pool.c",
+                "memhive/core/ring.c",
                 "memhive/core/sub.c",
                 "memhive/core/utils.c",
                 "memhive/core/map.c",
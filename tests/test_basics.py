@@ -1,9 +1,14 @@
 import io
+import os
+import sys
 import unittest
+import unittest.mock
 import tempfile
+import time
 import traceback
 
 import memhive
+import memhive.asyncio
 
 
 class BasicsTest(unittest.TestCase):
@@ -57,3 +62,526 @@ class BasicsTest(unittest.TestCase):
             )
         else:
             self.fail('exception was not propagated')
+
+    def test_sync_sub_reports_errors(self):
+        def worker(sub):
+            import sys
+            import time
+            msg = ' '.join(['reported', 'error'])   # not interned
+            before = sys.getrefcount(msg)
+            for _ in range(10):
+                sub.report_error('RuntimeError', msg, ValueError('cause'))
+            # Each report is let go of once main has read it.
+            deadline = time.monotonic() + 10
+            while (sys.getrefcount(msg) != before
+                   and time.monotonic() < deadline):
+                time.sleep(0.01)
+                sub.process_refs()
+            sub.request(sys.getrefcount(msg) - before)
+
+        with self.assertRaises(memhive.MemhiveGroupError) as cm:
+            with memhive.MemHive() as m:
+                m.add_worker(main=worker)
+                leaked = m.listen().arg
+
+        self.assertEqual(leaked, 0)
+        [err] = cm.exception.exceptions
+        self.assertIsInstance(err, RuntimeError)
+        self.assertEqual(str(err), 'reported error')
+        self.assertEqual(str(err.__cause__), 'cause')
+
+    def test_sync_pooled_workers(self):
+        def worker(sub):
+            import builtins
+            runs = getattr(builtins, '_test_pool_runs', 0) + 1
+            builtins._test_pool_runs = runs
+            with open(sub['file'], 'a') as f:
+                f.write(f'{runs}\n')
+
+        def failing(sub):
+            1/0
+
+        with tempfile.NamedTemporaryFile() as tmp:
+            with memhive.MemHive(pool_size=2) as m:
+                m['file'] = tmp.name
+                for _ in range(6):
+                    m.add_worker(main=worker)
+
+            with open(tmp.name, 'r') as f:
+                runs = [int(line) for line in f.read().split()]
+            self.assertEqual(len(runs), 6)
+
+        with self.assertRaises(memhive.MemhiveGroupError):
+            with memhive.MemHive(pool_size=1) as m:
+                m.add_worker(main=failing)
+                m.add_worker(main=failing)
+
+    def test_sync_add_workers(self):
+        def worker(sub):
+            with open(sub['file'], 'a') as f:
+                f.write('started\n')
+
+        with tempfile.NamedTemporaryFile() as tmp:
+            with memhive.MemHive() as m:
+                m['file'] = tmp.name
+                m.add_workers(4, main=worker)
+
+            with open(tmp.name, 'r') as f:
+                self.assertEqual(f.read().split(), ['started'] * 4)
+
+    def test_sync_worker_affinity(self):
+        def worker(sub):
+            import os
+            with open(sub['file'], 'a') as f:
+                f.write(f'{sorted(os.sched_getaffinity(0))}\n')
+
+        cpu = min(os.sched_getaffinity(0))
+        with tempfile.NamedTemporaryFile() as tmp:
+            with memhive.MemHive(listener_affinity=[cpu]) as m:
+                m['file'] = tmp.name
+                m.add_worker(main=worker, affinity=[cpu])
+                m.add_workers(2, main=worker, affinity='compact')
+
+                with self.assertRaises(ValueError):
+                    m.add_worker(main=worker, affinity='nearby')
+                with self.assertRaises(ValueError):
+                    m.add_worker(main=worker, affinity=[-1])
+
+            with open(tmp.name, 'r') as f:
+                self.assertEqual(f.read().split('\n')[:1], [f'[{cpu}]'])
+
+    def test_cpu_order(self):
+        # 2 packages x 2 cores x 2 hyperthreads
+        topology = {cpu: (cpu // 4, cpu // 2 % 2) for cpu in range(8)}
+        with unittest.mock.patch.object(
+                memhive.memhive, '_cpu_topology', topology.get):
+            self.assertEqual(
+                memhive.memhive._cpu_order(set(range(8)), 'compact'),
+                [0, 1, 2, 3, 4, 5, 6, 7])
+            self.assertEqual(
+                memhive.memhive._cpu_order(set(range(8)), 'scatter'),
+                [0, 4, 2, 6, 1, 5, 3, 7])
+
+    def test_sync_autoscale(self):
+        def worker(sub):
+            import time
+            while True:
+                sub.listen()
+                time.sleep(0.005)
+
+        events = []
+        with memhive.MemHive() as m:
+            m.autoscale(
+                main=worker, min_workers=1, max_workers=3, interval=0.01,
+                scale_up_after=1, scale_down_after=5, on_event=events.append)
+            for i in range(200):
+                m.push(i)
+            while m._mem.subs_queue_depth():
+                time.sleep(0.01)
+            time.sleep(0.5)
+
+        actions = [e.action for e in m.scaling_events]
+        self.assertEqual(events, m.scaling_events)
+        self.assertGreater(actions.count('up'), 1)
+        self.assertLessEqual(len(set(e.wid for e in events)), 3 * 2)
+        # Every worker was eventually retired.
+        self.assertEqual(actions.count('up'), actions.count('down'))
+        self.assertEqual(
+            sorted(e.wid for e in events if e.action == 'up'),
+            sorted(e.wid for e in events if e.action == 'down'))
+
+    def test_sync_map(self):
+        def square(x):
+            return x * x
+
+        def fail_on_5(x):
+            if x == 5:
+                raise ValueError('five')
+            return x
+
+        def other(sub):
+            # Not one of map()'s workers, gets none of its chunks.
+            while (arg := sub.listen().arg) is not None:
+                sub.request(arg)
+
+        with memhive.MemHive() as m:
+            m.add_worker(main=other)
+            # Its request comes in while map() is listening, and is
+            # left for listen().
+            m.push('mine')
+            self.assertEqual(
+                list(m.map(square, range(100), chunksize=7, workers=3)),
+                [x * x for x in range(100)])
+            self.assertEqual(m.listen().arg, 'mine')
+
+            # Workers are started once the results are asked for, and
+            # kept for the next calls.
+            nworkers = len(m._workers)
+            m.map(square, range(10), workers=4)
+            self.assertEqual(len(m._workers), nworkers)
+            self.assertEqual(list(m.map(square, [], workers=2)), [])
+            self.assertEqual(len(m._workers), nworkers)
+            self.assertEqual(list(m.map(square, [1], workers=4)), [1])
+            self.assertEqual(len(m._workers), nworkers + 1)
+
+            # They never take push() messages.
+            for i in range(20):
+                m.push(i)
+            self.assertEqual(
+                sorted(m.listen(10).arg for _ in range(20)), list(range(20)))
+            m.push(None)
+
+            for kwargs in ({'workers': 0}, {'max_inflight': 0},
+                           {'max_inflight': -1}, {'chunksize': 0}):
+                with self.assertRaises(ValueError):
+                    m.map(square, range(10), **kwargs)
+
+            results = m.map(fail_on_5, range(10), workers=2, max_inflight=1)
+            self.assertEqual([next(results) for _ in range(5)], list(range(5)))
+            with self.assertRaisesRegex(ValueError, 'five'):
+                next(results)
+
+            # An abandoned map() doesn't leave its responses behind.
+            results = m.map(square, range(50), workers=2)
+            self.assertEqual(next(results), 0)
+            results.close()
+            self.assertEqual(list(m.map(square, (2, 3), workers=1)), [4, 9])
+
+        self.assertTrue(all(w.completed.is_set() for w in m._workers.values()))
+
+    def test_sync_try_listen(self):
+        def worker(sub):
+            assert sub.try_listen() is None
+            for i in range(3):
+                sub.request(i)
+
+        with memhive.MemHive() as m:
+            self.assertIsNone(m.try_listen())
+            m.add_worker(main=worker)
+            m.wait_workers_started()
+            args = [m.listen().arg]
+            while len(args) < 3:
+                msg = m.try_listen()
+                if msg is not None:
+                    args.append(msg.arg)
+            self.assertEqual(args, [0, 1, 2])
+            self.assertIsNone(m.try_listen())
+
+    def test_sync_batched_messages(self):
+        def worker(sub):
+            args = []
+            while len(args) < 10:
+                args.extend(msg.arg for msg in sub.listen_many(100, None))
+            sub.request_many(args)
+
+        with memhive.MemHive() as m:
+            started = time.monotonic()
+            self.assertEqual(m.listen_many(10, 0.05), [])
+            self.assertGreaterEqual(time.monotonic() - started, 0.04)
+
+            m.add_worker(main=worker)
+            ids = m.push_many(range(10))
+            self.assertEqual(ids, list(range(ids[0], ids[0] + 10)))
+            args = []
+            while len(args) < 10:
+                args.extend(msg.arg for msg in m.listen_many(4, None))
+            self.assertEqual(args, list(range(10)))
+
+    def test_sync_bounded_queue(self):
+        def worker(sub):
+            total = 0
+            while (arg := sub.listen().arg) is not None:
+                total += arg
+            sub.request(total)
+
+        with memhive.MemHive(queue_capacity=2) as m:
+            self.assertIsNone(m.listen(0.01))
+            m.push(1)
+            m.push(2)
+            with self.assertRaises(memhive.core.QueueFullError):
+                m.push(3, 0)
+            with self.assertRaises(memhive.core.QueueFullError):
+                m.push(3, 0.01)
+            self.assertEqual(
+                m.queue_stats(), {'depth': 2, 'capacity': 2, 'full': 2})
+
+            # Blocked pushes go on as the worker makes room.
+            m.add_worker(main=worker)
+            for i in range(3, 100):
+                m.push(i)
+            m.push(None)
+            self.assertEqual(m.listen(10).arg, sum(range(1, 100)))
+
+        with memhive.MemHive(queue_capacity=2) as m:
+            with self.assertRaises(memhive.core.QueueFullError) as ctx:
+                m.push_many([1, 2, 3], 0.01)
+            first, second = ctx.exception.pushed
+            self.assertEqual(second, first + 1)
+
+            # The messages that made it stay queued; the id of the one
+            # that didn't isn't used up.
+            m.add_worker(main=worker)
+            self.assertEqual(m.push(3), second + 1)
+            m.push(None)
+            self.assertEqual(m.listen(10).arg, 6)
+
+    def test_sync_ring_queue(self):
+        def worker(sub):
+            total = 0
+            while (arg := sub.listen().arg) is not None:
+                total += arg
+            sub.request(total)
+
+        # A ring much smaller than the burst makes push() wait for room.
+        with memhive.MemHive(ring_capacity=4) as m:
+            for _ in range(3):
+                m.add_worker(main=worker)
+            m.wait_workers_started()
+            for i in range(1000):
+                m.push(i)
+            for _ in range(3):
+                m.push(None)
+            self.assertEqual(sum(m.listen().arg for _ in range(3)),
+                             sum(range(1000)))
+
+            self.assertEqual(list(m.map(lambda x: -x, range(50), workers=2)),
+                             [-x for x in range(50)])
+
+    def test_sync_work_stealing(self):
+        def worker(sub):
+            from memhive.core import QueueRequest
+            while isinstance(msg := sub.listen(), QueueRequest):
+                sub.request(msg.arg)
+
+        # Pushes are only dealt to running workers, not to idle pool
+        # threads. Stolen messages come from the back, so there's no
+        # sentinel to stop on.
+        with memhive.MemHive(pool_size=4, work_stealing=True) as m:
+            m.push(0)
+            for _ in range(2):
+                m.add_worker(main=worker)
+            m.wait_workers_started()
+            for i in range(1, 1000):
+                m.push(i)
+            self.assertEqual(sorted(m.listen().arg for _ in range(1000)),
+                             list(range(1000)))
+            self.assertEqual(m.queue_stats()['depth'], 0)
+            m.broadcast(None)
+
+    def test_sync_work_stealing_churn(self):
+        def quitter(sub):
+            # Exits with the messages dealt to it left untaken.
+            import time
+            sub.request('up')
+            while 'go' not in sub:
+                time.sleep(0.001)
+
+        def stealer(sub):
+            # Give the quitters time to let go of their channels.
+            import time
+            time.sleep(0.01)
+            sub.request(sub.listen().arg)
+
+        # A channel released with dealt messages is reused once they've
+        # been stolen: more workers come and go than there are channels.
+        nworkers = 8
+        with memhive.MemHive(pool_size=2 * nworkers,
+                             work_stealing=True) as m:
+            for round in range(300 // nworkers + 1):
+                quitters = m.start_workers(nworkers, main=quitter)
+                for _ in range(nworkers):
+                    self.assertEqual(m.listen(10).arg, 'up')
+                for i in range(nworkers):
+                    m.push(i)
+                m['go'] = round
+                for status in quitters:
+                    self.assertTrue(status.completed.wait(10))
+                del m['go']
+
+                m.start_workers(nworkers, main=stealer)
+                self.assertEqual(
+                    sorted(m.listen(10).arg for _ in range(nworkers)),
+                    list(range(nworkers)))
+
+    def test_sync_keyed_push(self):
+        def worker(sub):
+            from memhive.core import QueueRequest
+            seen = {}
+            while isinstance(msg := sub.listen(), QueueRequest):
+                seen[msg.arg] = seen.get(msg.arg, 0) + 1
+                sub.request((msg.arg, seen[msg.arg]))
+
+        def push_keys(m, keys):
+            wids = {key: m.push_keyed(key, key)[0] for key in keys}
+            replies = dict(m.listen().arg for _ in keys)
+            return wids, replies
+
+        with memhive.MemHive() as m:
+            # map()'s workers don't count.
+            self.assertEqual(list(m.map(lambda x: x, [1], workers=2)), [1])
+            with self.assertRaises(RuntimeError):
+                m.push_keyed(1, 1)
+
+            m.add_workers(3, main=worker)
+            wids, replies = push_keys(m, range(100))
+            self.assertEqual(len(set(wids.values())), 3)
+            self.assertEqual(set(replies.values()), {1})
+
+            # A key keeps going to the same worker...
+            again, replies = push_keys(m, range(100))
+            self.assertEqual(again, wids)
+            self.assertEqual(set(replies.values()), {2})
+
+            # ...and a new worker only takes some of the keys over.
+            m.add_worker(main=worker)
+            moved, replies = push_keys(m, range(100))
+            new = {key for key in wids if moved[key] != wids[key]}
+            self.assertTrue(0 < len(new) < 100)
+            self.assertEqual(len(set(moved[key] for key in new)), 1)
+            self.assertEqual(
+                replies, {key: 1 if key in new else 3 for key in range(100)})
+
+            wid = wids[0]
+            msg_id = m.push_to(wid, 0)
+            self.assertEqual(m.push_keyed(0, 0), (wid, msg_id + 1))
+            self.assertEqual(m.listen().arg, (0, 3 if 0 in new else 4))
+            self.assertEqual(m.listen().arg, (0, 4 if 0 in new else 5))
+            with self.assertRaises(KeyError):
+                m.push_to(12345, 0)
+            m.broadcast(None)
+
+    def test_sync_priorities(self):
+        def worker(sub):
+            sub.request('later', priority=0)
+            sub.request('sooner', priority=2)
+            got = []
+            while (arg := sub.listen().arg) is not None:
+                got.append(arg)
+            sub.request(tuple(got))
+
+        with memhive.MemHive() as m:
+            for i in range(5):
+                m.push(('bulk', i))
+            m.push(('urgent', 0), priority=2)
+            m.push(('high', 0), priority=1)
+            m.push(('urgent', 1), priority=2)
+            m.push(None)
+            with self.assertRaises(ValueError):
+                m.push(0, priority=3)
+
+            m.add_worker(main=worker)
+            # Requests sent later but at a higher priority come first
+            # once both are waiting.
+            time.sleep(0.1)
+            self.assertEqual(m.listen().arg, 'sooner')
+            self.assertEqual(m.listen().arg, 'later')
+            self.assertEqual(
+                m.listen().arg,
+                (('urgent', 0), ('urgent', 1), ('high', 0),
+                 *(('bulk', i) for i in range(5))))
+
+    def test_sync_fair_intake(self):
+        def worker(sub):
+            name, n = sub.listen().arg
+            sub.request_many([(name, i) for i in range(n)])
+            sub.listen()
+
+        with memhive.MemHive() as m:
+            m.add_workers(2, main=worker)
+            flood, quiet = m._workers
+            m.push_to(flood, ('flood', 200))
+            m.push_to(quiet, ('quiet', 3))
+            while m.intake_depths() != {flood: 200, quiet: 3}:
+                time.sleep(0.01)
+
+            # Workers take turns, the flood doesn't hold up the rest.
+            got = [m.listen().arg for _ in range(203)]
+            quiet_at = [i for i, (name, _) in enumerate(got)
+                        if name == 'quiet']
+            self.assertEqual(len(quiet_at), 3)
+            self.assertLess(max(quiet_at), 10)
+            self.assertEqual([i for name, i in got if name == 'flood'],
+                             list(range(200)))
+            self.assertEqual(m.intake_depths(), {flood: 0, quiet: 0})
+            m.broadcast(None)
+
+    def test_sync_broadcast(self):
+        def worker(sub):
+            got = []
+            while (arg := sub.listen().arg) is not None:
+                got.append(arg)
+            sub.request(tuple(got))
+
+        def late_worker(sub):
+            # Broadcasts sent before the worker started aren't for it.
+            sub.request(sub.listen(0.1))
+
+        # Idle pool threads aren't readers: broadcasts sent while
+        # they're idle neither wait for them nor reach their next worker.
+        with memhive.MemHive(pool_size=5) as m:
+            payload = 'payload' * 10
+            refs = sys.getrefcount(payload)
+            m.broadcast(payload)
+            m.broadcast(0)
+            self.assertEqual(sys.getrefcount(payload), refs)
+
+            for _ in range(3):
+                m.add_worker(main=worker)
+            m.wait_workers_started()
+            for i in range(100):
+                m.broadcast(i)
+            m.broadcast(None)
+            for _ in range(3):
+                self.assertEqual(m.listen().arg, tuple(range(100)))
+
+            m.add_worker(main=late_worker)
+            self.assertIsNone(m.listen().arg)
+
+
+class AsyncBasicsTest(unittest.IsolatedAsyncioTestCase):
+
+    async def test_async_ensure_workers_started(self):
+        def worker(sub):
+            with open(sub['file'], 'a') as f:
+                f.write('started\n')
+
+        with tempfile.NamedTemporaryFile() as tmp:
+            async with memhive.asyncio.AsyncMemHive() as m:
+                m['file'] = tmp.name
+                m.add_worker(main=worker)
+                m.add_workers(2, main=worker)
+                await m.ensure_workers_started()
+
+            with open(tmp.name, 'r') as f:
+                self.assertEqual(f.read().split(), ['started'] * 3)
+
+    async def test_async_map(self):
+        def add_one(x):
+            return x + 1
+
+        async with memhive.asyncio.AsyncMemHive() as m:
+            results = [
+                r async for r in m.map(add_one, range(40), chunksize=3,
+                                       workers=2)
+            ]
+            self.assertEqual(results, list(range(1, 41)))
+
+    async def test_async_worker_listen(self):
+        async def worker(sub):
+            seen = 0
+            async for req in sub.listen():
+                sub.request(req.arg * 2)
+                seen += 1
+                if seen == 100:
+                    break
+
+        async with memhive.asyncio.AsyncMemHive() as m:
+            m.add_async_worker(main=worker)
+            for i in range(100):
+                m.push(i)
+            results = []
+            async for req in m.listen():
+                results.append(req.arg)
+                if len(results) == 100:
+                    break
+            self.assertEqual(results, [i * 2 for i in range(100)])
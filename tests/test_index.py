@@ -0,0 +1,354 @@
+import threading
+import time
+import unittest
+
+import memhive
+
+
+class IndexTest(unittest.TestCase):
+
+    def test_index_group_commit(self):
+        nthreads = 8
+        nkeys = 50
+
+        def writer(m, n):
+            for i in range(nkeys):
+                m[f'k{n}_{i}'] = i
+
+        with memhive.MemHive(group_commit_window=0.002) as m:
+            threads = [
+                threading.Thread(target=writer, args=(m, n))
+                for n in range(nthreads)
+            ]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+
+            for n in range(nthreads):
+                for i in range(nkeys):
+                    self.assertEqual(m[f'k{n}_{i}'], i)
+
+            # Concurrent writes must have been folded into fewer commits.
+            self.assertLess(m.index_version(), nthreads * nkeys)
+
+    def test_index_group_commit_bad_key(self):
+        with memhive.MemHive(group_commit_window=0) as m:
+            with self.assertRaises(TypeError):
+                m[[]] = 1
+            m['a'] = 1
+            self.assertEqual(m['a'], 1)
+            self.assertEqual(m.index_version(), 1)
+
+    def test_index_group_commit_bad_shard(self):
+        class Key:
+            def __init__(self, fail):
+                self.fail = fail
+
+            def __hash__(self):
+                # Lands in the last shard, after the others are committed.
+                return 0xF0000000
+
+            def __eq__(self, other):
+                if self.fail or getattr(other, 'fail', False):
+                    raise ZeroDivisionError
+                return self is other
+
+        nthreads = 8
+        errors = []
+
+        def writer(m, n):
+            try:
+                if n == 0:
+                    m[Key(True)] = n
+                else:
+                    m[f'k{n}'] = n
+            except ZeroDivisionError as e:
+                errors.append(e)
+
+        with memhive.MemHive(shards=4, group_commit_window=0.05) as m:
+            m[Key(False)] = -1
+            base = m.index_version()
+
+            threads = [
+                threading.Thread(target=writer, args=(m, n))
+                for n in range(nthreads)
+            ]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+
+            self.assertEqual(len(errors), 1)
+            for n in range(1, nthreads):
+                self.assertEqual(m[f'k{n}'], n)
+
+            # Only the failed shard's writes are retried: no write is
+            # committed twice.
+            self.assertLessEqual(m.index_version() - base, nthreads - 1)
+
+    def test_index_group_commit_bad_window(self):
+        for window in (-1, float('nan'), float('inf')):
+            with self.assertRaises(ValueError):
+                memhive.MemHive(group_commit_window=window)
+
+    def test_index_cas(self):
+        with memhive.MemHive() as m:
+            a = 'a' * 100
+            m['k'] = a
+            self.assertFalse(m.cas('k', 'b', 'c'))
+            self.assertFalse(m.cas('missing', a, 'c'))
+            self.assertTrue(m.cas('k', a, 'c'))
+            self.assertEqual(m['k'], 'c')
+            self.assertNotIn('missing', m)
+
+    def test_index_setdefault(self):
+        with memhive.MemHive() as m:
+            self.assertEqual(m.setdefault('k', 1), 1)
+            self.assertEqual(m.setdefault('k', 2), 1)
+            self.assertEqual(m['k'], 1)
+
+    def test_index_update_key(self):
+        nthreads = 8
+        nincs = 200
+
+        def incr(m):
+            for _ in range(nincs):
+                m.update_key('n', lambda v: v + 1)
+
+        with memhive.MemHive() as m:
+            with self.assertRaises(KeyError):
+                m.update_key('n', lambda v: v + 1)
+            self.assertEqual(m.update_key('n', lambda v: v + 1, -1), 0)
+
+            threads = [
+                threading.Thread(target=incr, args=(m,))
+                for _ in range(nthreads)
+            ]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+
+            self.assertEqual(m['n'], nthreads * nincs)
+
+    def test_index_delete(self):
+        with memhive.MemHive() as m:
+            m['a'] = 1
+            m['b'] = 2
+            del m['a']
+            self.assertNotIn('a', m)
+            with self.assertRaises(KeyError):
+                del m['a']
+
+            self.assertEqual(m.pop('b'), 2)
+            self.assertEqual(m.pop('b', 42), 42)
+            with self.assertRaises(KeyError):
+                m.pop('b')
+            self.assertEqual(len(m._mem), 0)
+
+    def test_index_ttl(self):
+        with memhive.MemHive(ttl_sweep_interval=3600) as m:
+            m.set('a', 1, ttl=0)
+            m.set('b', 2, ttl=0)
+            m.set('c', 3, ttl=3600)
+            m.set('d', 4, ttl=0)
+            m['d'] = 5  # drops the TTL
+
+            version = m.index_version()
+            self.assertEqual(m.sweep_expired(), 2)
+            self.assertEqual(m.index_version(), version + 1)
+
+            self.assertNotIn('a', m)
+            self.assertNotIn('b', m)
+            self.assertEqual(m['c'], 3)
+            self.assertEqual(m['d'], 5)
+            self.assertEqual(m.sweep_expired(), 0)
+
+    def test_index_ttl_non_finite(self):
+        with memhive.MemHive(ttl_sweep_interval=3600) as m:
+            with self.assertRaises(ValueError):
+                m.set('a', 1, ttl=float('nan'))
+            self.assertNotIn('a', m)
+
+            m.set('b', 2, ttl=0)
+            m.set('b', 3, ttl=float('inf'))  # drops the TTL
+            m.set('c', 4, ttl=1e300)
+            self.assertEqual(m.sweep_expired(), 0)
+            self.assertEqual(m['b'], 3)
+            self.assertEqual(m['c'], 4)
+
+    def test_index_ttl_background_sweep(self):
+        with memhive.MemHive(ttl_sweep_interval=0.01) as m:
+            m.set('a', 1, ttl=0.01)
+            for _ in range(500):
+                if 'a' not in m:
+                    break
+                time.sleep(0.01)
+            self.assertNotIn('a', m)
+
+    def test_index_sharded(self):
+        with memhive.MemHive(shards=8) as m:
+            for i in range(200):
+                m[f'k{i}'] = i
+            m.set('t', 't', ttl=0)
+            self.assertEqual(len(m), 201)
+            self.assertEqual(m.sweep_expired(), 1)
+
+            del m['k0']
+            self.assertEqual(m.pop('k1'), 1)
+            self.assertTrue(m.cas('k2', 2, 'two'))
+            self.assertEqual(m.setdefault('k3', None), 3)
+
+            self.assertEqual(len(m), 198)
+            self.assertEqual(
+                sorted(m), sorted(f'k{i}' for i in range(2, 200)))
+
+            snap = m.snapshot()
+            self.assertEqual(len(snap), 198)
+            self.assertEqual(snap['k2'], 'two')
+            self.assertEqual(snap['k199'], 199)
+
+            m['k199'] = 0
+            self.assertEqual(snap['k199'], 199)
+
+    def test_index_sharded_sub_reads(self):
+        # A failed assertion in the worker fails the test with
+        # a MemhiveGroupError.
+        def worker(sub):
+            snap = sub.snapshot()
+            assert len(snap) == 3
+            assert snap['b'] == (2, 'x')
+            assert len(sub) == 3
+            assert sorted(sub) == ['a', 'b', 'c']
+            assert 'c' in sub
+            assert sub['a'] == 1
+
+        with memhive.MemHive(shards=4) as m:
+            m['a'] = 1
+            m['b'] = (2, 'x')
+            m['c'] = 3
+            m.add_worker(main=worker)
+
+    def test_index_bad_shards(self):
+        with self.assertRaises(ValueError):
+            memhive.MemHive(shards=0)
+
+    def test_index_watch(self):
+        # A failed assertion in the worker fails the test with
+        # a MemhiveGroupError.
+        def worker(sub):
+            sub.watch('cfg.')
+            sub.watch(['x'])
+            sub.request('ready')
+
+            events = [sub.listen() for _ in range(6)]
+            assert [sorted(e.keys) for e in events] == [
+                ['cfg.a'],
+                ['x'],
+                ['cfg.a'],
+                ['cfg.b'],
+                ['cfg.c'],
+                ['cfg.b', 'cfg.c'],
+            ], [e.keys for e in events]
+
+            versions = [e.version for e in events]
+            assert versions == sorted(set(versions)), versions
+
+        with memhive.MemHive(ttl_sweep_interval=3600) as m:
+            m.add_worker(main=worker)
+            m.listen()
+
+            m['cfg.a'] = 1
+            m['other'] = 2
+            m['x'] = 3
+            m['xx'] = 4
+            del m['cfg.a']
+            m.set('cfg.b', 5, ttl=0)
+            m.set('cfg.c', 6, ttl=0)
+            self.assertEqual(m.sweep_expired(), 2)
+
+    def test_index_watch_bad_key(self):
+        def worker(sub):
+            try:
+                sub.watch([1])
+            except TypeError:
+                pass
+            else:
+                raise AssertionError('TypeError was not raised')
+
+        with memhive.MemHive() as m:
+            m.add_worker(main=worker)
+
+    def test_index_watch_unencodable_key(self):
+        # Watchers are notified after the commit; a key that can't be
+        # encoded can't match a watch and mustn't fail the write.
+        def worker(sub):
+            sub.watch(['a'])
+            sub.request('ready')
+            assert sub.listen().keys == ('a',)
+
+        with memhive.MemHive() as m:
+            m.add_worker(main=worker)
+            m.listen()
+
+            key = 'a\udc80'
+            m[key] = 1
+            self.assertEqual(m[key], 1)
+            self.assertTrue(m.cas(key, 1, 2))
+            self.assertEqual(m.pop(key), 2)
+            self.assertNotIn(key, m)
+            m.set(key, 3, ttl=0)
+            self.assertEqual(m.sweep_expired(), 1)
+
+            m['a'] = 4
+
+    def test_index_replica(self):
+        # A failed assertion in the worker fails the test with
+        # a MemhiveGroupError.
+        def worker(sub):
+            sub.watch(['k0', 'c'])
+            try:
+                sub.enable_replica(float('nan'))
+            except ValueError:
+                pass
+            else:
+                raise AssertionError('ValueError was not raised')
+            sub.enable_replica(1e300)
+            sub.enable_replica(float('inf'))    # synced on request only
+            assert sub['a'] == 1
+            assert len(sub) == 50
+            assert sorted(sub)[:2] == ['a', 'k0']
+
+            sub.request('synced')
+            assert sub.listen().keys == ('k0',)
+
+            # Still within the staleness window.
+            assert sub['a'] == 1
+            assert 'b' not in sub
+
+            sub.sync_replica()
+            assert sub['a'] == 2
+            assert sub['b']['x'] == (1, 2)
+            assert 'k0' not in sub
+            assert len(sub) == 50
+
+            sub.enable_replica(0)
+            sub.request('fresh')
+            assert sub.listen().keys == ('c',)
+            assert sub['c'] == 3
+
+        for shards in (1, 4):
+            with memhive.MemHive(shards=shards) as m:
+                m['a'] = 1
+                for i in range(49):
+                    m[f'k{i}'] = i
+                m.add_worker(main=worker)
+
+                m.listen()
+                m['a'] = 2
+                m['b'] = memhive.Map({'x': (1, 2)})
+                del m['k0']
+
+                m.listen()
+                m['c'] = 3
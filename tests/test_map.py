@@ -0,0 +1,60 @@
+import unittest
+
+import memhive
+
+
+class MapTest(unittest.TestCase):
+
+    def test_map_memory_usage(self):
+        empty = memhive.Map().memory_usage()
+        self.assertEqual(
+            empty['nodes'], {'N_BITMAP': 1, 'N_ARRAY': 0, 'N_COLLISION': 0})
+        self.assertEqual(empty['key_bytes'], 0)
+        self.assertNotIn('shared_nodes', empty)
+
+        m = memhive.Map({f'k{i}': (i, 'v' * 100) for i in range(1000)})
+        usage = m.memory_usage()
+        self.assertGreater(usage['nodes']['N_ARRAY'], 0)
+        self.assertGreater(usage['node_bytes'], 0)
+        self.assertGreater(usage['key_bytes'], 1000 * len('k0'))
+
+        deep = m.memory_usage(deep=True)
+        self.assertEqual(deep['nodes'], usage['nodes'])
+        self.assertGreater(deep['value_bytes'], usage['value_bytes'] + 100000)
+
+        nested = memhive.Map({'m': m})
+        self.assertEqual(
+            nested.memory_usage(deep=True)['node_bytes'],
+            usage['node_bytes']
+            + memhive.Map({'m': None}).memory_usage()['node_bytes'])
+
+        m2 = m.set('k0', None)
+        shared = m2.memory_usage(shared_with=m)
+        total = sum(shared['nodes'].values())
+        self.assertGreater(shared['shared_nodes'], 0)
+        self.assertLess(shared['shared_nodes'], total)
+        self.assertEqual(
+            m.memory_usage(shared_with=m)['shared_nodes'], total)
+
+        with self.assertRaises(TypeError):
+            m.memory_usage(shared_with={})
+
+    def test_map_memory_stats(self):
+        with memhive.MemHive(shards=4) as m:
+            for i in range(100):
+                m[f'k{i}'] = i
+            stats = m.memory_stats()
+            self.assertEqual(stats['shards'], 4)
+            self.assertGreaterEqual(stats['nodes']['N_BITMAP'], 4)
+            self.assertGreater(stats['key_bytes'], 0)
+
+        with memhive.MemHive() as m:
+            for i in range(100):
+                m[f'k{i}'] = i
+            before = m.snapshot()
+            m['k0'] = -1
+
+            stats = m.memory_stats(shared_with=before)
+            total = sum(stats['nodes'].values())
+            self.assertGreater(stats['shared_nodes'], 0)
+            self.assertLess(stats['shared_nodes'], total)
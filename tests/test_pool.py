@@ -0,0 +1,121 @@
+import marshal
+import time
+import unittest
+import unittest.mock
+
+import memhive
+
+
+def _wait_for(cond, timeout=10):
+    deadline = time.monotonic() + timeout
+    while not cond():
+        if time.monotonic() > deadline:
+            raise AssertionError('timed out')
+        time.sleep(0.01)
+
+
+class PoolTest(unittest.TestCase):
+
+    def test_pool_close_with_idle_threads(self):
+        with memhive.MemHive(pool_size=4) as m:
+            _wait_for(lambda: m._mem.pool_stats()['idle'] == 4)
+
+        self.assertEqual(m._mem.pool_stats()['threads'], 0)
+
+    def test_pool_recycle_past_size(self):
+        def worker(sub):
+            sub.listen()
+
+        with memhive.MemHive(pool_size=2) as m:
+            _wait_for(lambda: m._mem.pool_stats()['idle'] == 2)
+            m.add_workers(5, main=worker)
+            stats = m._mem.pool_stats()
+            for _ in range(5):
+                m.push(None)
+            self.assertEqual(stats['threads'], 5)
+            self.assertEqual(stats['idle'], 0)
+
+            # Two are kept for the next workers, the rest exit.
+            _wait_for(lambda: m._mem.pool_stats() == {
+                'threads': 2, 'idle': 2,
+                'dispatch_threads': 0, 'handlers': 0})
+
+            m.add_workers(2, main=worker)
+            stats = m._mem.pool_stats()
+            m.push(None)
+            m.push(None)
+            self.assertEqual(stats['threads'], 2)
+
+        self.assertEqual(m._mem.pool_stats()['threads'], 0)
+
+    def test_pool_failed_bootstrap(self):
+        def worker(sub):
+            pass
+
+        def handler(sub, msg):
+            pass
+
+        broken = marshal.dumps(
+            compile('raise ImportError("no luck")', '<broken>', 'exec'))
+
+        with unittest.mock.patch('memhive.memhive._WORKER_BOOTSTRAP', broken):
+            for pool_size in (0, 2):
+                for kwargs in ({'main': worker}, {'handler': handler}):
+                    with self.assertRaises(memhive.MemhiveGroupError) as ctx:
+                        with memhive.MemHive(pool_size=pool_size) as m:
+                            m.add_workers(3, **kwargs)
+
+                    self.assertEqual(len(ctx.exception.exceptions), 3)
+                    for ex in ctx.exception.exceptions:
+                        self.assertIsInstance(ex, RuntimeError)
+                        self.assertIn('could not be started', str(ex))
+
+    def test_pool_handlers(self):
+        def handler(sub, msg):
+            from memhive.core import QueueBroadcast
+            if isinstance(msg, QueueBroadcast):
+                sub.request(msg.arg)
+            else:
+                msg(msg.arg * 2)
+
+        with memhive.MemHive(dispatch_threads=2) as m:
+            m.add_workers(30, handler=handler)
+            self.assertEqual(m._mem.pool_stats(), {
+                'threads': 0, 'idle': 0,
+                'dispatch_threads': 2, 'handlers': 30})
+
+            for i in range(1000):
+                m.push(i)
+            results = sorted(m.listen().data for _ in range(1000))
+            self.assertEqual(results, [i * 2 for i in range(1000)])
+
+            m.broadcast('hi')
+            self.assertEqual(
+                [m.listen().arg for _ in range(30)], ['hi'] * 30)
+
+            wid = next(iter(m._workers))
+            m._mem.retire_worker(wid)
+            m._workers[wid].completed.wait()
+            self.assertIsNone(m._workers[wid].error)
+            _wait_for(lambda: m._mem.pool_stats()['handlers'] == 29)
+
+            with self.assertRaisesRegex(ValueError, 'either main or handler'):
+                m.add_worker(main=handler, handler=handler)
+            with self.assertRaisesRegex(ValueError, 'no affinity'):
+                m.add_worker(handler=handler, affinity=[0])
+
+        self.assertEqual(m._mem.pool_stats(), {
+            'threads': 0, 'idle': 0, 'dispatch_threads': 0, 'handlers': 0})
+
+    def test_pool_handler_error(self):
+        def handler(sub, msg):
+            1 / 0
+
+        with self.assertRaises(memhive.MemhiveGroupError) as ctx:
+            with memhive.MemHive(dispatch_threads=1) as m:
+                m.add_workers(2, handler=handler)
+                m.push(None)
+                _wait_for(lambda: m._mem.pool_stats()['handlers'] == 1)
+
+        [ex] = ctx.exception.exceptions
+        self.assertEqual(str(ex.__cause__), 'division by zero')